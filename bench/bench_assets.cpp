@@ -0,0 +1,257 @@
+// AssetWriter / AssetFile benchmark and self check: a container is written to a file, opened through MappedFile
+// and through the in-memory path, and every section is compared. Truncated containers, out-of-range section tables
+// and flipped bytes must be refused or fail cleanly. Exits with 1 when a check fails.
+// usage: bench_assets [vertices] [path]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../src/core/imp/asset_container.h"
+
+static int failures = 0;
+
+#define CHECK(X)                                                        \
+    do                                                                  \
+    {                                                                   \
+        if(!(X))                                                        \
+        {                                                               \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #X);         \
+            ++failures;                                                 \
+        }                                                               \
+    } while(0)
+
+using Clock = std::chrono::steady_clock;
+using Bytes = data_core::ser::data_t;
+
+static double Millis(Clock::time_point a, Clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); }
+
+struct Vertex
+{
+    float pos[3];
+    float uv[2];
+    float normal[3];
+};
+DECLARE_DATA_TYPE(Vertex);
+DECLARE_DATA_SER_BULK(Vertex);
+
+struct Content
+{
+    std::vector<Vertex>      vertices;
+    std::vector<uint32_t>    indices;
+    std::vector<std::string> names = { "hero", "sword", "" };
+    std::vector<int>         parents = { -1, 0, 1, 1 };
+};
+
+static Content MakeContent(size_t vertices)
+{
+    Content c;
+    c.vertices.resize(vertices);
+    for(size_t i = 0; i < vertices; ++i)
+        c.vertices[i] = { { float(i), 1, 2 }, { 0.5f, 0.25f }, { 0, 0, 1 } };
+    c.indices.resize(vertices * 2);
+    for(size_t i = 0; i < c.indices.size(); ++i)
+        c.indices[i] = uint32_t(i * 3 % (vertices ? vertices : 1));
+    return c;
+}
+
+static void Write(AssetWriter& w, const Content& c)
+{
+    w.AddBlob("hero.vertices", c.vertices);
+    w.AddBlob("hero.indices", c.indices, 2);
+    w.AddValue("names", c.names);
+    w.AddValue("bones", c.parents, 3);
+    w.AddBlob("empty", std::vector<float>{});
+}
+
+static void Verify(const AssetFile& f, const Content& c, const char* path)
+{
+    const int before = failures;
+    CHECK(f.IsOpen() && f.Schema() == 7 && f.SectionCount() == 5);
+    if(!f.IsOpen())
+        return;
+
+    auto v  = f.Blob<Vertex>("hero.vertices");
+    auto ix = f.Blob<uint32_t>("hero.indices");
+    CHECK(v.size() == c.vertices.size() && memcmp(v.data(), c.vertices.data(), v.size_bytes()) == 0);
+    CHECK(ix.size() == c.indices.size() && memcmp(ix.data(), c.indices.data(), ix.size_bytes()) == 0);
+    CHECK(f.Find("hero.indices")->schema == 2);
+
+    std::vector<std::string> names;
+    std::vector<int>         parents;
+    uint32_t                 schema = 0;
+    CHECK(f.Load("names", names) && names == c.names);
+    CHECK(f.Load("bones", parents, &schema) && parents == c.parents && schema == 3);
+    CHECK(f.Blob<float>("empty").empty() && f.Blob<float>("missing").empty() && !f.Load("missing", parents));
+
+    int thrown = 0;
+    try { f.Blob<float>("hero.indices"); } catch(std::invalid_argument&) { ++thrown; }
+    try { f.Load("names", parents); } catch(std::invalid_argument&) { ++thrown; }
+    CHECK(thrown == 2);
+    printf("%-22s %s\n", path, failures != before ? "failed" : "ok");
+}
+
+static void RoundTrip(size_t vertices, const std::string& path)
+{
+    const Content c = MakeContent(vertices);
+
+    auto t0 = Clock::now();
+    AssetWriter w(7);
+    Write(w, c);
+    CHECK(w.Save(path));
+    auto t1 = Clock::now();
+
+    {
+        AssetFile f(path);
+        auto t2 = Clock::now();
+        auto v  = f.Blob<Vertex>("hero.vertices");
+        auto t3 = Clock::now();
+        // the mapping starts on a page, sections on ALIGN
+        CHECK(reinterpret_cast<uintptr_t>(v.data()) % AssetFormat::ALIGN == 0);
+        Verify(f, c, "mapped file");
+        printf("%-22s %zu vertices: write %.2f ms, open %.3f ms, blob %.4f ms\n", "timing", vertices, Millis(t0, t1), Millis(t1, t2), Millis(t2, t3));
+    }
+
+    {
+        AssetWriter mem(7);
+        Write(mem, c);
+        const Bytes& bytes = mem.Finish();
+        AssetFile    f;
+        CHECK(f.Open(data_core::ser::view_t(bytes)));
+        Verify(f, c, "buffer");
+    }
+
+    MappedFile missing;
+    CHECK(!missing.Open(path + ".missing") && !missing.IsOpen());
+    std::remove(path.c_str());
+}
+
+static bool Opens(const Bytes& bytes)
+{
+    AssetFile f;
+    return f.Open(data_core::ser::view_t(bytes));
+}
+
+// patches the header or the first section entry of a copy of good
+static Bytes Patched(const Bytes& good, const std::function<void(AssetFormat::Header&, AssetFormat::Section&)>& patch)
+{
+    Bytes               b = good;
+    AssetFormat::Header h;
+    memcpy(&h, b.data(), sizeof(h));
+    AssetFormat::Section s;
+    memcpy(&s, b.data() + h.sections, sizeof(s));
+    const uint64_t table = h.sections;
+    patch(h, s);
+    memcpy(b.data(), &h, sizeof(h));
+    memcpy(b.data() + table, &s, sizeof(s));
+    return b;
+}
+
+static void Corruption()
+{
+    const int before = failures;
+    std::vector<int> parents = { -1, 0, 1, 1 };
+    std::vector<uint32_t> indices(10, 7);
+    AssetWriter w;
+    w.AddValue("x", parents);
+    w.AddBlob("y", indices);
+    const Bytes good = w.Finish();
+    CHECK(Opens(good));
+    CHECK(AssetWriter(1).Finish().size() == sizeof(AssetFormat::Header));
+
+    // every truncation loses the section table or the header
+    int opened = 0;
+    for(size_t cut = 0; cut < good.size(); ++cut)
+        opened += Opens(Bytes(good.begin(), good.begin() + cut));
+    CHECK(opened == 0);
+
+    using H = AssetFormat::Header;
+    using S = AssetFormat::Section;
+    CHECK(!Opens(Patched(good, [](H& h, S&) { h.magic[0] = 'X'; })));
+    CHECK(!Opens(Patched(good, [](H& h, S&) { h.version = AssetFormat::VERSION + 1; })));
+    CHECK(!Opens(Patched(good, [](H& h, S&) { h.endian = 0x04030201; })));
+    CHECK(!Opens(Patched(good, [](H& h, S&) { h.size += 1; })));
+    CHECK(!Opens(Patched(good, [](H& h, S&) { h.section_count = 0xFFFFFFFF; })));
+    CHECK(!Opens(Patched(good, [](H& h, S&) { h.section_count += 1; })));
+    CHECK(!Opens(Patched(good, [](H& h, S&) { h.sections = h.size; })));
+    CHECK(!Opens(Patched(good, [](H& h, S&) { h.sections = ~uint64_t(0) - 63; })));
+    CHECK(!Opens(Patched(good, [](H& h, S&) { h.names_size = h.size; })));
+    CHECK(!Opens(Patched(good, [](H& h, S& s) { s.offset = h.size; })));
+    CHECK(!Opens(Patched(good, [](H&, S& s) { s.offset += 1; })));
+    CHECK(!Opens(Patched(good, [](H&, S& s) { s.size = ~uint64_t(0); })));
+    CHECK(!Opens(Patched(good, [](H&, S& s) { s.name_offset = ~uint64_t(0); })));
+    CHECK(!Opens(Patched(good, [](H&, S& s) { s.kind = 3; })));
+
+    // a blob whose size does not match stride * count
+    Bytes blob = good;
+    {
+        H h;
+        memcpy(&h, blob.data(), sizeof(h));
+        S s;
+        memcpy(&s, blob.data() + h.sections + sizeof(S), sizeof(s));
+        s.count += 1;
+        memcpy(blob.data() + h.sections + sizeof(S), &s, sizeof(s));
+    }
+    CHECK(!Opens(blob));
+
+    // an element count far past the end of the section throws before the vector is allocated
+    for(int count : { 100000000, 2000000000, -1 })
+    {
+        Bytes b = good;
+        H     h;
+        memcpy(&h, b.data(), sizeof(h));
+        S s;
+        memcpy(&s, b.data() + h.sections, sizeof(s));
+        memcpy(b.data() + s.offset + sizeof(size_t), &count, sizeof(count));
+        AssetFile f;
+        CHECK(f.Open(data_core::ser::view_t(b)));
+        int thrown = 0;
+        try
+        {
+            std::vector<int> q;
+            f.Load("x", q);
+        }
+        catch(std::runtime_error&)
+        {
+            ++thrown;
+        }
+        CHECK(thrown == 1);
+    }
+
+    // a flipped byte is refused, throws on load or loads; it never reads out of bounds
+    for(size_t i = 0; i < good.size(); ++i)
+    {
+        Bytes b = good;
+        b[i] ^= 0xFF;
+        AssetFile f;
+        if(!f.Open(data_core::ser::view_t(b)))
+            continue;
+        try
+        {
+            std::vector<int> q;
+            f.Load("x", q);
+            f.Blob<uint32_t>("y");
+        }
+        catch(std::exception&)
+        {
+        }
+    }
+    printf("%-22s %s\n", "corruption", failures != before ? "failed" : "ok");
+}
+
+int main(int argc, char** argv)
+{
+    const size_t      vertices = argc > 1 ? size_t(atoll(argv[1])) : size_t(1) << 20;
+    const std::string path     = argc > 2 ? argv[2] : "bench_assets.wasset";
+
+    RoundTrip(vertices, path);
+    Corruption();
+
+    if(failures)
+        printf("%d checks failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+// Shared registry microbenchmark: n threads look up and update random keys of one map.
+// ConcurrentHashMap against std::unordered_map behind a std::mutex and behind a std::shared_mutex.
+// usage: bench_hash_map [total_ops] [write_percent]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../src/core/imp/concurrent_hash_map.h"
+
+static constexpr uint64_t KEYS = 1 << 14;
+
+struct MutexMap
+{
+    std::unordered_map<uint64_t, uint64_t> map;
+    std::mutex                             mutex;
+
+    bool Find(uint64_t k, uint64_t& out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = map.find(k);
+        if(it == map.end())
+            return false;
+        out = it->second;
+        return true;
+    }
+
+    void Assign(uint64_t k, uint64_t v)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        map[k] = v;
+    }
+};
+
+struct SharedMutexMap
+{
+    std::unordered_map<uint64_t, uint64_t> map;
+    std::shared_mutex                      mutex;
+
+    bool Find(uint64_t k, uint64_t& out)
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = map.find(k);
+        if(it == map.end())
+            return false;
+        out = it->second;
+        return true;
+    }
+
+    void Assign(uint64_t k, uint64_t v)
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        map[k] = v;
+    }
+};
+
+struct ShardedMap
+{
+    ConcurrentHashMap<uint64_t, uint64_t> map;
+
+    bool Find(uint64_t k, uint64_t& out) { return map.find(k, out); }
+    void Assign(uint64_t k, uint64_t v) { map.insert_or_assign(k, v); }
+};
+
+template<typename M>
+double Run(int threads, size_t total, int write_percent)
+{
+    M map;
+    for(uint64_t k = 0; k < KEYS; k += 2)
+        map.Assign(k, k);
+
+    const size_t per_thread = total / threads;
+    std::atomic<bool>     start{false};
+    std::atomic<uint64_t> sink{0};
+
+    std::vector<std::thread> pool;
+    for(int i = 0; i < threads; ++i)
+    {
+        pool.emplace_back([&, i] {
+            uint64_t x = 0x9E3779B97F4A7C15ull * (i + 1);
+            uint64_t local = 0;
+            while(!start.load())
+                std::this_thread::yield();
+            for(size_t k = 0; k < per_thread; ++k)
+            {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                const uint64_t key = x % KEYS;
+                if(int(x >> 40) % 100 < write_percent)
+                    map.Assign(key, k);
+                else
+                {
+                    uint64_t v;
+                    if(map.Find(key, v))
+                        local += v;
+                }
+            }
+            sink.fetch_add(local);
+        });
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    start.store(true);
+    for(auto& t : pool)
+        t.join();
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return double(per_thread * threads) / sec / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+    const size_t total         = argc > 1 ? size_t(atoll(argv[1])) : (size_t(1) << 22);
+    const int    write_percent = argc > 2 ? atoi(argv[2]) : 10;
+
+    printf("%d%% writes\n", write_percent);
+    printf("%-18s %8s %12s\n", "map", "threads", "Mops/s");
+    for(int n : {1, 2, 4, 8, 16})
+    {
+        printf("%-18s %8d %12.2f\n", "mutex", n, Run<MutexMap>(n, total, write_percent));
+        printf("%-18s %8d %12.2f\n", "shared_mutex", n, Run<SharedMutexMap>(n, total, write_percent));
+        printf("%-18s %8d %12.2f\n", "ConcurrentHashMap", n, Run<ShardedMap>(n, total, write_percent));
+    }
+    return 0;
+}
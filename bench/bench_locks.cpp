@@ -0,0 +1,150 @@
+// Lock contention microbenchmark.
+// shared: n threads increment one counter under one lock, the critical section touches a few cache lines.
+// rw:     the same with 90% of the sections taken as readers where the lock supports it.
+// array:  every thread locks its own element of an array, unpadded locks false share.
+// usage: bench_locks [total_ops]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "../src/core/imp/spinlocker.h"
+#include "../src/core/imp/locks.h"
+
+struct Section
+{
+    uint64_t data[32] = {};
+
+    void Write(uint64_t v)
+    {
+        for(auto& d : data)
+            d += v;
+    }
+
+    uint64_t Read() const
+    {
+        uint64_t s = 0;
+        for(auto d : data)
+            s += d;
+        return s;
+    }
+};
+
+template<typename L>
+struct IsShared : std::false_type {};
+template<>
+struct IsShared<RWSpinLock> : std::true_type {};
+template<>
+struct IsShared<std::shared_mutex> : std::true_type {};
+
+template<typename F>
+double Measure(int threads, size_t per_thread, F body)
+{
+    std::atomic<bool>        start{false};
+    std::vector<std::thread> pool;
+    for(int i = 0; i < threads; ++i)
+        pool.emplace_back([&, i] {
+            while(!start.load())
+                std::this_thread::yield();
+            body(i);
+        });
+
+    auto t0 = std::chrono::steady_clock::now();
+    start.store(true);
+    for(auto& t : pool)
+        t.join();
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return double(per_thread * threads) / sec / 1e6;
+}
+
+template<typename L>
+double Shared(int threads, size_t total, bool readers)
+{
+    L        lock;
+    Section  section;
+    uint64_t sink = 0;
+    const size_t per_thread = total / threads;
+
+    double ret = Measure(threads, per_thread, [&](int) {
+        uint64_t local = 0;
+        for(size_t k = 0; k < per_thread; ++k)
+        {
+            if constexpr(IsShared<L>::value)
+            {
+                if(readers && k % 10)
+                {
+                    lock.lock_shared();
+                    local += section.Read();
+                    lock.unlock_shared();
+                    continue;
+                }
+            }
+            if(readers && k % 10)
+            {
+                lock.lock();
+                local += section.Read();
+                lock.unlock();
+                continue;
+            }
+            lock.lock();
+            section.Write(k);
+            lock.unlock();
+        }
+        lock.lock();
+        sink += local;
+        lock.unlock();
+    });
+    if(sink == 1)
+        printf(" ");
+    return ret;
+}
+
+template<typename L>
+double Array(int threads, size_t total)
+{
+    struct Item
+    {
+        L        lock;
+        uint64_t value = 0;
+    };
+    std::vector<Item> items(threads);
+    const size_t per_thread = total / threads;
+
+    return Measure(threads, per_thread, [&](int i) {
+        Item& item = items[i];
+        for(size_t k = 0; k < per_thread; ++k)
+        {
+            item.lock.lock();
+            ++item.value;
+            item.lock.unlock();
+        }
+    });
+}
+
+template<typename L>
+void Row(const char* name, int n, size_t total)
+{
+    printf("%-12s %8d %12.2f %12.2f %12.2f\n", name, n, Shared<L>(n, total, false), Shared<L>(n, total, true), Array<L>(n, total));
+}
+
+int main(int argc, char** argv)
+{
+    const size_t total = argc > 1 ? size_t(atoll(argv[1])) : (size_t(1) << 20);
+
+    printf("%-12s %8s %12s %12s %12s\n", "lock", "threads", "shared Mops", "rw Mops", "array Mops");
+    for(int n : {1, 2, 4, 8, 16})
+    {
+        Row<SpinLocker>("SpinLocker", n, total);
+        Row<std::mutex>("std::mutex", n, total);
+        Row<std::shared_mutex>("shared_mutex", n, total);
+        Row<TTASLock>("TTASLock", n, total);
+        Row<TicketLock>("TicketLock", n, total);
+        Row<RWSpinLock>("RWSpinLock", n, total);
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+// Run queue microbenchmark: n producers and n consumers move a fixed number of values through a queue.
+// usage: bench_queues [total_ops]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "../src/core/imp/lockfreelist.h"
+#include "../src/core/imp/mpmc_queue.h"
+
+// LockFreeList used as a queue the way the thread pool used it: the iterator locks the first free node,
+// that node is taken and unlinked. The pool serialized the removal with rm_locker.
+struct ListQueue
+{
+    LockFreeList<uintptr_t> list;
+    SpinLocker              rm_locker;
+
+    void Push(uintptr_t v) { list.AddNode(v); }
+
+    bool TryPop(uintptr_t& out)
+    {
+        rm_locker.lock();
+        auto it = list.begin();
+        bool ret = it != list.end();
+        if(ret)
+        {
+            auto node = it.val;
+            out = node->val;
+            list.RemoveNode(node);
+            ++it;
+            // ++ locked the next node, this is not a full walk
+            if(it != list.end())
+                it.val->unlock();
+        }
+        rm_locker.unlock();
+        return ret;
+    }
+};
+
+struct BoundedQueue
+{
+    MPMCQueue<uintptr_t> ring{1024};
+
+    void Push(uintptr_t v)
+    {
+        while(!ring.TryPush(v))
+            std::this_thread::yield();
+    }
+
+    bool TryPop(uintptr_t& out) { return ring.TryPop(out); }
+};
+
+struct SegmentedQueue
+{
+    SegmentedMPMCQueue<uintptr_t> ring{1024};
+
+    void Push(uintptr_t v) { ring.Push(v); }
+    bool TryPop(uintptr_t& out) { return ring.TryPop(out); }
+};
+
+template<typename Q>
+double Run(int threads, size_t total)
+{
+    Q queue;
+    const size_t per_thread = total / threads;
+    std::atomic<size_t> consumed{0};
+    std::atomic<bool>   start{false};
+
+    std::vector<std::thread> pool;
+    for(int i = 0; i < threads; ++i)
+    {
+        pool.emplace_back([&] {
+            while(!start.load())
+                std::this_thread::yield();
+            for(size_t k = 0; k < per_thread; ++k)
+                queue.Push(k + 1);
+        });
+        pool.emplace_back([&] {
+            while(!start.load())
+                std::this_thread::yield();
+            uintptr_t v;
+            while(consumed.load(std::memory_order_relaxed) < per_thread * threads)
+            {
+                if(queue.TryPop(v))
+                    consumed.fetch_add(1, std::memory_order_relaxed);
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    start.store(true);
+    for(auto& t : pool)
+        t.join();
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return double(per_thread * threads) / sec / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+    const size_t total = argc > 1 ? size_t(atoll(argv[1])) : (size_t(1) << 18);
+
+    printf("%-14s %8s %12s\n", "queue", "threads", "Mops/s");
+    for(int n : {1, 4, 16, 64})
+    {
+        printf("%-14s %4dx%-3d %12.2f\n", "LockFreeList", n, n, Run<ListQueue>(n, total));
+        printf("%-14s %4dx%-3d %12.2f\n", "MPMCQueue", n, n, Run<BoundedQueue>(n, total));
+        printf("%-14s %4dx%-3d %12.2f\n", "SegmentedMPMC", n, n, Run<SegmentedQueue>(n, total));
+    }
+    return 0;
+}
@@ -0,0 +1,210 @@
+// Ref benchmark and self check: make_ref, make_local_ref and Ref<T>(new T) lifetimes, copies across threads,
+// WeakRef::lock after the object is gone, over-aligned objects and deallocators. Exits with 1 when a check fails.
+// usage: bench_ref [objects]
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/core/imp/data.h"
+
+static int failures = 0;
+
+#define CHECK(X)                                                        \
+    do                                                                  \
+    {                                                                   \
+        if(!(X))                                                        \
+        {                                                               \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #X);         \
+            ++failures;                                                 \
+        }                                                               \
+    } while(0)
+
+using Clock = std::chrono::steady_clock;
+
+static double Nanos(Clock::time_point a, Clock::time_point b, size_t n) { return std::chrono::duration<double, std::nano>(b - a).count() / double(n); }
+
+static std::atomic<int> alive{0};
+
+struct Object
+{
+    int         v;
+    std::string s;
+
+    Object(int v = 0, std::string s = {}) : v(v), s(std::move(s)) { ++alive; }
+    ~Object() { --alive; }
+};
+
+struct alignas(64) Wide
+{
+    float lanes[16] = {};
+
+    Wide() { ++alive; }
+    ~Wide() { --alive; }
+};
+
+struct Throws
+{
+    Throws() { throw std::runtime_error("Throws"); }
+};
+
+// strong and weak references of one object, the object goes with the last Ref and a WeakRef cannot bring it back
+static void Lifetime(Ref<Object> r, const char* name)
+{
+    const int before = failures;
+    CHECK(r.has() && r->v == 5 && r->s == "five" && alive == 1);
+
+    WeakRef<Object> w;
+    w = r;
+    {
+        Ref<Object> copy = r;
+        Ref<Object> back = w.lock();
+        CHECK((Object*)copy == (Object*)r && (Object*)back == (Object*)r);
+    }
+    Ref<Object> moved = std::move(r);
+    CHECK(!r.has() && moved.has() && alive == 1);
+
+    moved = Ref<Object>();
+    CHECK(alive == 0 && !w.has() && !w.lock().has());
+    printf("%-22s %s\n", name, failures != before ? "failed" : "ok");
+}
+
+static void Ownership()
+{
+    const int before = failures;
+    CHECK(sizeof(Ref<Object>) == 2 * sizeof(void*));
+    Ref<Object> none = nullptr;
+    CHECK(!none.has());
+
+    // over-aligned objects keep their alignment in the shared allocation and on their own
+    {
+        Ref<Wide> a = make_ref<Wide>();
+        Ref<Wide> b = make_local_ref<Wide>();
+        Ref<Wide> c(new Wide());
+        CHECK(reinterpret_cast<uintptr_t>((Wide*)a) % alignof(Wide) == 0);
+        CHECK(reinterpret_cast<uintptr_t>((Wide*)b) % alignof(Wide) == 0);
+        CHECK(reinterpret_cast<uintptr_t>((Wide*)c) % alignof(Wide) == 0);
+        CHECK(alive == 3);
+    }
+    CHECK(alive == 0);
+
+    // the deallocator sees the object once, when the last Ref goes, and decides whether it is deleted
+    {
+        Object* raw   = new Object(1);
+        int     calls = 0;
+        {
+            Ref<Object> r(raw);
+            r.SetDeallocator([&](void* p) { ++calls; return p != raw; });
+            Ref<Object> copy = r;
+            WeakRef<Object> w;
+            w = copy;
+        }
+        CHECK(calls == 1 && alive == 1);
+        delete raw;
+
+        Ref<Object> r(new Object(2));
+        r.SetDeallocator([&](void*) { ++calls; return true; });
+        r = Ref<Object>();
+        CHECK(calls == 2 && alive == 0);
+    }
+
+    // a throwing constructor leaves nothing behind
+    int thrown = 0;
+    try { make_ref<Throws>(); } catch(std::runtime_error&) { ++thrown; }
+    try { make_local_ref<Throws>(); } catch(std::runtime_error&) { ++thrown; }
+    CHECK(thrown == 2);
+    printf("%-22s %s\n", "ownership", failures != before ? "failed" : "ok");
+}
+
+// copies, weak locks and releases of one object from several threads
+static void Threads(size_t rounds)
+{
+    const int before = failures;
+    {
+        Ref<Object>     r = make_ref<Object>(7);
+        WeakRef<Object> w;
+        w = r;
+        std::vector<std::thread> threads;
+        for(int t = 0; t < 4; ++t)
+            threads.emplace_back([r, &w, rounds] {
+                for(size_t i = 0; i < rounds; ++i)
+                {
+                    Ref<Object>     a = r;
+                    Ref<Object>     b = w.lock();
+                    WeakRef<Object> c;
+                    c = a;
+                }
+            });
+        for(auto& t : threads)
+            t.join();
+        CHECK(alive == 1 && r->v == 7);
+        r = Ref<Object>();
+        CHECK(alive == 0 && !w.lock().has());
+    }
+
+    // the last Ref and the last WeakRef race
+    for(size_t i = 0; i < 1000; ++i)
+    {
+        Ref<Object>     r = make_ref<Object>(int(i));
+        WeakRef<Object> w;
+        w = r;
+        std::thread t([w]() mutable {
+            Ref<Object> l = w.lock();
+            if(l.has())
+                l->s = "locked";
+        });
+        r = Ref<Object>();
+        t.join();
+    }
+    CHECK(alive == 0);
+    printf("%-22s %s\n", "threads", failures != before ? "failed" : "ok");
+}
+
+static void Timing(size_t n)
+{
+    auto t0 = Clock::now();
+    for(size_t i = 0; i < n; ++i)
+        Ref<Object> r = make_ref<Object>(int(i));
+    auto t1 = Clock::now();
+    for(size_t i = 0; i < n; ++i)
+        Ref<Object> r = make_local_ref<Object>(int(i));
+    auto t2 = Clock::now();
+    for(size_t i = 0; i < n; ++i)
+        Ref<Object> r(new Object(int(i)));
+    auto t3 = Clock::now();
+    for(size_t i = 0; i < n; ++i)
+        std::shared_ptr<Object> r = std::make_shared<Object>(int(i));
+    auto t4 = Clock::now();
+
+    Ref<Object> r = make_ref<Object>();
+    auto t5 = Clock::now();
+    for(size_t i = 0; i < n; ++i)
+        Ref<Object> copy = r;
+    auto t6 = Clock::now();
+
+    printf("%-22s make_ref %.1f ns, make_local_ref %.1f ns, new %.1f ns, make_shared %.1f ns, copy %.1f ns\n", "create + destroy", Nanos(t0, t1, n),
+           Nanos(t1, t2, n), Nanos(t2, t3, n), Nanos(t3, t4, n), Nanos(t5, t6, n));
+}
+
+int main(int argc, char** argv)
+{
+    const size_t objects = argc > 1 ? size_t(atoll(argv[1])) : size_t(1000000);
+
+    Lifetime(make_ref<Object>(5, "five"), "make_ref");
+    Lifetime(make_local_ref<Object>(5, "five"), "make_local_ref");
+    Lifetime(Ref<Object>(new Object(5, "five")), "new");
+    Ownership();
+    Threads(objects / 10);
+    Timing(objects);
+
+    if(failures)
+        printf("%d checks failed\n", failures);
+    return failures ? 1 : 0;
+}
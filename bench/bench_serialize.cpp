@@ -0,0 +1,208 @@
+// ser benchmark and self check: round trips of nested structs, std::vector, std::string and Data (RawValue),
+// vectors of ints and of MVector in bulk, truncated buffers. Exits with 1 when a check fails.
+// usage: bench_serialize [ints]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../src/core/imp/data.h"
+#include "../src/core/imp/wmath.h"
+
+using namespace data_core;
+
+static int failures = 0;
+
+#define CHECK(X)                                                        \
+    do                                                                  \
+    {                                                                   \
+        if(!(X))                                                        \
+        {                                                               \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #X);         \
+            ++failures;                                                 \
+        }                                                               \
+    } while(0)
+
+using Clock = std::chrono::steady_clock;
+
+static double Millis(Clock::time_point a, Clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); }
+
+struct Item
+{
+    int                id = 0;
+    std::string        name;
+    std::vector<float> weights;
+
+    bool operator==(const Item&) const = default;
+};
+DECLARE_DATA_STRUCT_AND_SERIALIZE(Item, id, name, weights);
+
+struct Scene
+{
+    Item                          root;
+    std::vector<Item>             items;
+    std::vector<std::vector<int>> grid;
+    std::vector<std::string>      tags;
+
+    bool operator==(const Scene&) const = default;
+};
+DECLARE_DATA_STRUCT_AND_SERIALIZE(Scene, root, items, grid, tags);
+
+// a field serializer the bulk path would bypass
+struct Clamped
+{
+    int v = 0;
+};
+DECLARE_DATA_TYPE(Clamped);
+DECLARE_DATA_SERIALIZER_FUNC(Clamped)
+{
+    DECLARE_DATA_SERIALIZER_DEFAULT_HEADER(Clamped);
+    Write(offset, serealized, deserealized->v < 0 ? 0 : deserealized->v);
+    return offset;
+}
+DECLARE_DATA_DESERIALIZER_FUNC(Clamped)
+{
+    DECLARE_DATA_DESERIALIZER_DEFAULT_HEADER(Clamped);
+    deserealized->v = Read<int>(offset, serealized);
+    return offset;
+}
+DECLARE_DATA_SERIALIZABLE(Clamped);
+
+template<typename T>
+static bool RoundTrip(const T& in, T& out, ser::data_t* bytes = nullptr)
+{
+    ser::data_t buf;
+    const size_t written = ser::Serialize(ser::Writer(buf), &in);
+    const size_t read    = ser::Deserialize(ser::view_t(buf), &out);
+    if(bytes)
+        *bytes = buf;
+    return written == buf.size() && read == written;
+}
+
+static Scene MakeScene()
+{
+    Scene s;
+    s.root = { 1, "root", { 1.0f, 2.0f } };
+    for(int i = 0; i < 100; ++i)
+        s.items.push_back({ i, "item " + std::to_string(i), std::vector<float>(size_t(i % 7), float(i)) });
+    s.grid = { { 1, 2, 3 }, {}, { 4 } };
+    s.tags = { "a", "", std::string(1000, 'x') };
+    return s;
+}
+
+static void Values()
+{
+    const Scene scene = MakeScene();
+    Scene       back;
+    ser::data_t bytes;
+    CHECK(RoundTrip(scene, back, &bytes));
+    CHECK(back == scene);
+
+    std::string s("text with\0zero", 14), s2;
+    CHECK(RoundTrip(s, s2) && s2 == s);
+
+    std::vector<std::vector<std::string>> nested = { { "a", "bb" }, {}, { "ccc" } }, nested2;
+    CHECK(RoundTrip(nested, nested2) && nested2 == nested);
+
+    // vectors of structs go through the element serializer
+    std::vector<Clamped> clamped = { { -5 }, { 7 } }, clamped2;
+    CHECK(RoundTrip(clamped, clamped2) && clamped2.size() == 2 && clamped2[0].v == 0 && clamped2[1].v == 7);
+
+    // Data holds a RawValue, it deserializes into a Data of the same type
+    Data d = MakeScene();
+    Data e = Scene();
+    e.Deserialize(d.Serialize());
+    CHECK(*e.as<Scene>() == scene);
+
+    std::vector<Data> list = { Data(int(42)), Data(std::string("x")) }, list2 = { Data(int(0)), Data(std::string()) };
+    CHECK(RoundTrip(list, list2) && *list2[0].as<int>() == 42 && *list2[1].as<std::string>() == "x");
+
+    // cut buffers throw instead of reading past the end
+    int thrown = 0;
+    for(size_t cut : { size_t(0), size_t(4), bytes.size() / 2, bytes.size() - 1 })
+    {
+        try
+        {
+            Scene part;
+            ser::Deserialize(ser::view_t(bytes.data(), cut), &part);
+        }
+        catch(...)
+        {
+            ++thrown;
+        }
+    }
+    CHECK(thrown == 4);
+
+    // a vector size past the end of the buffer throws before the vector is allocated
+    ser::data_t names;
+    ser::Serialize(ser::Writer(names), &scene.tags);
+    const int huge = 2000000000;
+    memcpy(names.data() + sizeof(size_t), &huge, sizeof(huge));
+    try
+    {
+        std::vector<std::string> part;
+        ser::Deserialize(ser::view_t(names), &part);
+    }
+    catch(std::runtime_error&)
+    {
+        ++thrown;
+    }
+    CHECK(thrown == 5);
+    printf("%-22s %s\n", "values", failures ? "failed" : "ok");
+}
+
+static void Ints(size_t count)
+{
+    std::vector<int> v(count);
+    for(size_t i = 0; i < count; ++i)
+        v[i] = int(i * 7);
+
+    ser::data_t buf;
+    auto t0 = Clock::now();
+    const size_t written = ser::Serialize(ser::Writer(buf), &v);
+    auto t1 = Clock::now();
+    std::vector<int> back;
+    const size_t read = ser::Deserialize(ser::view_t(buf), &back);
+    auto t2 = Clock::now();
+    auto view = ser::VectorView<int>(buf);
+    auto t3 = Clock::now();
+
+    CHECK(written == buf.size() && read == written && back == v);
+    CHECK(view.size() == count && (count == 0 || view[count - 1] == v[count - 1]));
+    const double mb = double(written) / (1024.0 * 1024.0);
+    printf("%-22s %zu ints, %.1f MB: write %.2f ms, read %.2f ms, view %.4f ms\n", "vector<int>", count, mb, Millis(t0, t1), Millis(t1, t2), Millis(t2, t3));
+}
+
+static void Vectors(size_t count)
+{
+    std::vector<MVector<float, 4>> v(count);
+    for(size_t i = 0; i < count; ++i)
+        v[i]._data[0] = float(i);
+
+    ser::data_t buf;
+    auto t0 = Clock::now();
+    ser::Serialize(ser::Writer(buf), &v);
+    auto t1 = Clock::now();
+    std::vector<MVector<float, 4>> back;
+    ser::Deserialize(ser::view_t(buf), &back);
+    auto t2 = Clock::now();
+
+    CHECK(back.size() == count && (count == 0 || back[count - 1]._data[0] == float(count - 1)));
+    printf("%-22s %zu vectors: write %.2f ms, read %.2f ms\n", "vector<MVector4f>", count, Millis(t0, t1), Millis(t1, t2));
+}
+
+int main(int argc, char** argv)
+{
+    const size_t ints = argc > 1 ? size_t(atoll(argv[1])) : size_t(1600000);
+
+    Values();
+    Ints(ints);
+    Vectors(ints / 4);
+
+    if(failures)
+        printf("%d checks failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+// TaskJobSystem benchmark and self check: job throughput, nested fan-out, task period jitter,
+// return codes and drain. Exits with 1 when a check fails.
+// usage: bench_task_job [jobs]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../src/core/imp/task_job_system.h"
+
+static int failures = 0;
+
+#define CHECK(X)                                                        \
+    do                                                                  \
+    {                                                                   \
+        if(!(X))                                                        \
+        {                                                               \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #X);         \
+            ++failures;                                                 \
+        }                                                               \
+    } while(0)
+
+using Clock = std::chrono::steady_clock;
+
+static double Seconds(Clock::time_point t0) { return std::chrono::duration<double>(Clock::now() - t0).count(); }
+
+static void JobThroughput(int threads, size_t jobs)
+{
+    TaskJobSystem system((unsigned char)threads);
+    std::atomic<size_t> done{0};
+    auto t0 = Clock::now();
+    for(size_t i = 0; i < jobs; ++i)
+        system.add_job([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+    system.quiesce();
+    const double sec = Seconds(t0);
+    CHECK(done.load() == jobs);
+    printf("%-22s %7d %12.2f Mjobs/s\n", "jobs", threads, double(jobs) / sec / 1e6);
+}
+
+// every job adds fanout children until depth is reached
+static void FanOut(int threads, int fanout, int depth)
+{
+    TaskJobSystem system((unsigned char)threads);
+    std::atomic<size_t> done{0};
+    struct Spawn
+    {
+        static void Run(TaskJobSystem* system, std::atomic<size_t>* done, int fanout, int depth)
+        {
+            done->fetch_add(1, std::memory_order_relaxed);
+            if(depth == 0)
+                return;
+            for(int i = 0; i < fanout; ++i)
+                system->add_job(Run, system, done, fanout, depth - 1);
+        }
+    };
+    size_t expected = 0;
+    for(size_t level = 1, n = 0; n <= size_t(depth); ++n, level *= fanout)
+        expected += level;
+
+    auto t0 = Clock::now();
+    system.add_job(Spawn::Run, &system, &done, fanout, depth);
+    system.quiesce();
+    const double sec = Seconds(t0);
+    CHECK(done.load() == expected);
+    printf("%-22s %7d %12.2f Mjobs/s (%zu jobs)\n", "fan-out", threads, double(expected) / sec / 1e6, expected);
+}
+
+// 1 ms task for 200 ms, reports how far the turns drift from the period
+static void TaskJitter(int threads)
+{
+    TaskJobSystem system((unsigned char)threads);
+    std::vector<int64_t> stamps;
+    stamps.reserve(512);
+    std::atomic<bool> finished{false};
+    const auto t0 = Clock::now();
+    system.add_task({1, 1000}, [&]() -> int
+    {
+        stamps.push_back(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+        if(Clock::now() - t0 > std::chrono::milliseconds(200))
+        {
+            finished.store(true);
+            return TaskJobSystem::RSTOP;
+        }
+        return TaskJobSystem::RAGAIN;
+    });
+    while(!finished.load())
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    system.drain();
+
+    std::vector<int64_t> error;
+    for(size_t i = 1; i < stamps.size(); ++i)
+        error.push_back(std::abs(stamps[i] - int64_t(i) * 1000 - stamps[0]));
+    std::sort(error.begin(), error.end());
+    CHECK(stamps.size() >= 150 && stamps.size() <= 260);
+    if(error.empty())
+        return;
+    printf("%-22s %7d %8zu turns, drift p50 %lld us p99 %lld us\n", "task 1ms", threads, stamps.size(),
+        (long long)error[error.size() / 2], (long long)error[error.size() * 99 / 100]);
+}
+
+struct Counter
+{
+    int calls = 0;
+    int Tick(int limit) { return ++calls < limit ? TaskJobSystem::RIMMEDIATELY : TaskJobSystem::RSTOP; }
+};
+
+static void ReturnCodes()
+{
+    TaskJobSystem system(2);
+
+    // RSTOP calls stopped() once and deletes the task
+    struct Stopping : public TaskJobSystem::ITask
+    {
+        std::atomic<int>* calls;
+        std::atomic<int>* stops;
+        virtual int call() { return ++*calls < 5 ? TaskJobSystem::RAGAIN : TaskJobSystem::RSTOP; }
+        virtual bool can_call() { return true; }
+        virtual void after_call() {}
+        virtual void stopped() { ++*stops; }
+    };
+    std::atomic<int> calls{0}, stops{0};
+    auto task = new Stopping();
+    task->calls = &calls;
+    task->stops = &stops;
+    system.add_task(task);
+
+    // RSLEEP waits the sleep period, not the delay
+    std::atomic<int> sleeps{0};
+    auto sleeper = new TaskJobSystem::Task<>([&]() { ++sleeps; return TaskJobSystem::RSLEEP; });
+    sleeper->delay = {0, 0};
+    sleeper->sleep = {20, 1000};
+    system.add_task(sleeper);
+
+    Counter counter;
+    system.add_task({0, 0}, &counter, &Counter::Tick, 100);
+
+    // a job waits until can_call() holds
+    struct Gated : public TaskJobSystem::IJob
+    {
+        std::atomic<bool>* open;
+        std::atomic<bool>* ran;
+        virtual bool can_call() { return open->load(); }
+        virtual void call() { ran->store(true); }
+        virtual void after_call() {}
+    };
+    std::atomic<bool> open{false}, ran{false};
+    auto gated = new Gated();
+    gated->open = &open;
+    gated->ran  = &ran;
+    system.add_job(gated);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(!ran.load());
+    open.store(true);
+    system.quiesce();
+    CHECK(ran.load());
+    CHECK(calls.load() == 5 && stops.load() == 1);
+    CHECK(counter.calls == 100);
+    // 100 ms of 20 ms sleeps
+    CHECK(sleeps.load() >= 3 && sleeps.load() <= 7);
+
+    CHECK(system.drain(std::chrono::seconds(1)));
+    CHECK(system.task_count_approx() == 0 && system.job_count_approx() == 0);
+    printf("%-22s %s\n", "return codes", failures ? "failed" : "ok");
+}
+
+// drain stops long period tasks at once and drops jobs left after the timeout
+static void Drain()
+{
+    TaskJobSystem system(1);
+    std::atomic<int> stops{0};
+    auto task = new TaskJobSystem::Task<>([]() { return TaskJobSystem::RAGAIN; });
+    task->delay = {3600, 1};
+    system.add_task(task);
+
+    std::atomic<int> ran{0};
+    system.add_job([&] { std::this_thread::sleep_for(std::chrono::milliseconds(50)); ++ran; });
+    for(int i = 0; i < 100; ++i)
+        system.add_job([&] { std::this_thread::sleep_for(std::chrono::milliseconds(10)); ++ran; });
+
+    auto t0 = Clock::now();
+    const bool in_time = system.drain(std::chrono::milliseconds(20));
+    CHECK(!in_time);
+    CHECK(Seconds(t0) < 0.5);
+    CHECK(ran.load() < 101);
+    CHECK(system.task_count_approx() == 0 && system.job_count_approx() == 0);
+
+    // the system keeps working after a drain
+    system.add_job([&] { ran.store(1000); });
+    system.quiesce();
+    CHECK(ran.load() == 1000);
+    printf("%-22s %s\n", "drain", failures ? "failed" : "ok");
+}
+
+int main(int argc, char** argv)
+{
+    const size_t jobs = argc > 1 ? size_t(atoll(argv[1])) : (size_t(1) << 18);
+
+    printf("%-22s %7s\n", "case", "threads");
+    for(int threads : {0, 1, 2, 4, 8})
+        JobThroughput(threads, jobs);
+    for(int threads : {1, 4, 8})
+        FanOut(threads, 8, 5);
+    for(int threads : {1, 4})
+        TaskJitter(threads);
+    ReturnCodes();
+    Drain();
+
+    if(failures)
+        printf("%d checks failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,341 @@
+// ThredaPool and TaskJobSystem benchmark suite, results go to stdout and to a JSON file for regression tracking.
+// Every case runs for 1, 2, 4 ... max_threads workers:
+//   pool_throughput      empty one-shot messages, Shared and WorkStealing scheduler
+//   pool_latency         send to completion of one message at a time, percentiles in ns
+//   pool_fan_out_in      a message sends fanout children and waits for all of them with when_all
+//   pool_parallel_for    parallel_for over a range of cheap iterations
+//   pool_timer_jitter    1 ms repeating message, distance of the turns from the period in us
+//   job_throughput       empty TaskJobSystem jobs
+//   job_latency          add_job to the start of the job, percentiles in ns
+//   task_timer_jitter    1 ms TaskJobSystem task, distance of the turns from the period in us
+// Self checks run first, the exit code is 1 when one fails.
+// usage: bench_threading [output.json] [max_threads] [scale]
+// scale multiplies the iteration counts, 0.1 gives a quick run.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/core/imp/nlohmannjson.hpp"
+#include "../src/core/imp/thread_pool.h"
+#include "../src/core/imp/task_job_system.h"
+
+using Clock = std::chrono::steady_clock;
+using json  = nlohmann::json;
+
+static double scale = 1.0;
+static json   results = json::array();
+static int    failures = 0;
+
+#define CHECK(X)                                                        \
+    do                                                                  \
+    {                                                                   \
+        if(!(X))                                                        \
+        {                                                               \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #X);         \
+            ++failures;                                                 \
+        }                                                               \
+    } while(0)
+
+static size_t Scaled(size_t n) { return std::max<size_t>(1, size_t(double(n) * scale)); }
+
+static double Seconds(Clock::time_point t0) { return std::chrono::duration<double>(Clock::now() - t0).count(); }
+
+static int64_t Nanos(Clock::time_point a, Clock::time_point b) { return std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count(); }
+
+static void Report(const char* name, int threads, const char* unit, double value, json extra = json::object())
+{
+    json r   = std::move(extra);
+    r["name"]    = name;
+    r["threads"] = threads;
+    r["unit"]    = unit;
+    r["value"]   = value;
+    results.push_back(r);
+    printf("%-22s %7d %14.2f %s\n", name, threads, value, unit);
+}
+
+// p50 goes to value, the rest to the record
+static void ReportPercentiles(const char* name, int threads, const char* unit, std::vector<int64_t> samples)
+{
+    if(samples.empty())
+        return;
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double p) { return double(samples[std::min(samples.size() - 1, size_t(p * double(samples.size())))]); };
+    json extra = {
+        {"p50", at(0.5)}, {"p90", at(0.9)}, {"p99", at(0.99)}, {"p999", at(0.999)},
+        {"max", double(samples.back())}, {"samples", samples.size()}};
+    Report(name, threads, unit, at(0.5), extra);
+    printf("%-22s %7s p90 %.0f p99 %.0f p999 %.0f max %.0f\n", "", "", at(0.9), at(0.99), at(0.999), double(samples.back()));
+}
+
+static ThredaPool::Config PoolConfig(int threads, ThredaPool::Scheduler scheduler = ThredaPool::Scheduler::Shared)
+{
+    ThredaPool::Config config;
+    config.threads    = threads;
+    config.scheduler  = scheduler;
+    config.use_budget = false;
+    config.name       = "bench";
+    return config;
+}
+
+// copies of a Response share the value, reading it leaves it in place
+static void ResponseValueChecks()
+{
+    const int before = failures;
+    for(int threads : {0, 2})
+    {
+        ThredaPool pool(PoolConfig(threads));
+        const std::string text(48, 'x');
+        auto make = [text] { return text; };
+        auto r    = pool.send<decltype(make), std::string>(make);
+        auto copy = r;
+        CHECK(r.get() == text);
+        CHECK(r.get() == text);
+        CHECK(copy.get() == text);
+        auto size = r.then([](std::string& s) { return s.size(); });
+        CHECK(size.get() == text.size());
+        CHECK(std::string(copy) == text);
+    }
+    printf("%-22s %s\n", "response value", failures != before ? "failed" : "ok");
+}
+
+// once the pool is warm, fire-and-forget sends take every message, response and callable from ObjectPool caches
+static void SendAllocationChecks()
+{
+    const int before = failures;
+    ThredaPool pool(PoolConfig(2));
+    std::atomic<size_t> done{0};
+    auto round = [&] {
+        for(int i = 0; i < 1000; ++i)
+            pool.send([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+        pool.quiesce();
+    };
+    for(int r = 0; r < 20; ++r)
+        round();
+    const ObjectPool::Stats warm = ObjectPool::GetStats();
+    for(int r = 0; r < 100; ++r)
+        round();
+    const ObjectPool::Stats after = ObjectPool::GetStats();
+    CHECK(done.load() == 120000);
+    CHECK(after.heap_allocs == warm.heap_allocs);
+    printf("%-22s %s\n", "send allocations", failures != before ? "failed" : "ok");
+}
+
+static void PoolThroughput(int threads, ThredaPool::Scheduler scheduler, const char* name)
+{
+    ThredaPool pool(PoolConfig(threads, scheduler));
+    const size_t count = Scaled(1000000);
+    std::atomic<size_t> done{0};
+    auto t0 = Clock::now();
+    for(size_t i = 0; i < count; ++i)
+        pool.send([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+    pool.quiesce();
+    Report(name, threads, "Mmsg/s", double(count) / Seconds(t0) / 1e6);
+}
+
+static void PoolLatency(int threads)
+{
+    ThredaPool pool(PoolConfig(threads));
+    const size_t count = Scaled(20000);
+    std::vector<int64_t> samples;
+    samples.reserve(count);
+    for(size_t i = 0; i < count; ++i)
+    {
+        auto t0 = Clock::now();
+        pool.send([] {}).wait();
+        samples.push_back(Nanos(t0, Clock::now()));
+    }
+    ReportPercentiles("pool_latency", threads, "ns", std::move(samples));
+}
+
+static void PoolFanOutIn(int threads)
+{
+    ThredaPool pool(PoolConfig(threads));
+    const size_t rounds = Scaled(2000);
+    const int    fanout = 64;
+    std::atomic<size_t> done{0};
+    std::vector<int64_t> samples;
+    samples.reserve(rounds);
+    for(size_t r = 0; r < rounds; ++r)
+    {
+        auto t0 = Clock::now();
+        pool.send([&pool, &done, fanout] {
+            std::vector<ThredaPool::Response<void>> children;
+            children.reserve(fanout);
+            for(int i = 0; i < fanout; ++i)
+                children.push_back(pool.send([&done] { done.fetch_add(1, std::memory_order_relaxed); }));
+            ThredaPool::when_all(children).wait();
+        }).wait();
+        samples.push_back(Nanos(t0, Clock::now()));
+    }
+    if(done.load() != rounds * fanout)
+        printf("pool_fan_out_in: lost children\n");
+    ReportPercentiles("pool_fan_out_in", threads, "ns", std::move(samples));
+}
+
+static void PoolParallelFor(int threads)
+{
+    ThredaPool pool(PoolConfig(threads));
+    const size_t count = Scaled(4000000);
+    std::vector<uint32_t> data(count, 1);
+    auto t0 = Clock::now();
+    pool.parallel_for(0, count, 0, [&data](size_t i) { data[i] = data[i] * 3 + uint32_t(i); }).wait();
+    Report("pool_parallel_for", threads, "Mitems/s", double(count) / Seconds(t0) / 1e6);
+}
+
+// distance of turn i from first + i * period
+static std::vector<int64_t> Jitter(const std::vector<int64_t>& stamps, int64_t period)
+{
+    std::vector<int64_t> ret;
+    for(size_t i = 1; i < stamps.size(); ++i)
+        ret.push_back(std::abs(stamps[i] - stamps[0] - int64_t(i) * period));
+    return ret;
+}
+
+static void PoolTimerJitter(int threads)
+{
+    ThredaPool pool(PoolConfig(threads));
+    const size_t turns = std::max<size_t>(20, Scaled(200));
+    std::vector<int64_t> stamps;
+    stamps.reserve(turns + 16);
+    std::atomic<bool> finished{false};
+    const auto t0 = Clock::now();
+    auto r = pool.send_delayed_repetable(0, 1, [&] {
+        if(finished.load())
+            return;
+        stamps.push_back(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+        if(stamps.size() >= turns)
+            finished.store(true);
+    });
+    while(!finished.load())
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    r.stop();
+    pool.drain();
+    ReportPercentiles("pool_timer_jitter", threads, "us", Jitter(stamps, 1000));
+}
+
+static void JobThroughput(int threads)
+{
+    TaskJobSystem system((unsigned char)threads);
+    const size_t count = Scaled(1000000);
+    std::atomic<size_t> done{0};
+    auto t0 = Clock::now();
+    for(size_t i = 0; i < count; ++i)
+        system.add_job([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+    system.quiesce();
+    Report("job_throughput", threads, "Mjobs/s", double(count) / Seconds(t0) / 1e6);
+}
+
+static void JobLatency(int threads)
+{
+    TaskJobSystem system((unsigned char)threads);
+    const size_t count = Scaled(20000);
+    std::vector<int64_t> samples;
+    samples.reserve(count);
+    for(size_t i = 0; i < count; ++i)
+    {
+        std::atomic<int64_t> started{0};
+        auto t0 = Clock::now();
+        system.add_job([&started, t0] { started.store(Nanos(t0, Clock::now())); });
+        while(started.load() == 0)
+            CpuRelax();
+        samples.push_back(started.load());
+    }
+    system.quiesce();
+    ReportPercentiles("job_latency", threads, "ns", std::move(samples));
+}
+
+static void TaskTimerJitter(int threads)
+{
+    TaskJobSystem system((unsigned char)threads);
+    const size_t turns = std::max<size_t>(20, Scaled(200));
+    std::vector<int64_t> stamps;
+    stamps.reserve(turns + 16);
+    std::atomic<bool> finished{false};
+    const auto t0 = Clock::now();
+    system.add_task({1, 1000}, [&]() -> int {
+        stamps.push_back(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+        if(stamps.size() < turns)
+            return TaskJobSystem::RAGAIN;
+        finished.store(true);
+        return TaskJobSystem::RSTOP;
+    });
+    while(!finished.load())
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    system.drain();
+    ReportPercentiles("task_timer_jitter", threads, "us", Jitter(stamps, 1000));
+}
+
+int main(int argc, char** argv)
+{
+    const std::string out = argc > 1 ? argv[1] : "bench_threading.json";
+    const int hw          = std::max(1, int(std::thread::hardware_concurrency()));
+    const int max_threads = std::min(255, argc > 2 ? std::max(1, atoi(argv[2])) : hw);
+    scale                 = argc > 3 ? atof(argv[3]) : 1.0;
+
+    std::vector<int> counts;
+    for(int n = 1; n < max_threads; n *= 2)
+        counts.push_back(n);
+    counts.push_back(max_threads);
+
+    ResponseValueChecks();
+    SendAllocationChecks();
+
+    printf("%-22s %7s %14s\n", "case", "threads", "value");
+    for(int n : counts)
+    {
+        PoolThroughput(n, ThredaPool::Scheduler::Shared, "pool_throughput");
+        PoolThroughput(n, ThredaPool::Scheduler::WorkStealing, "pool_throughput_ws");
+        PoolLatency(n);
+        PoolFanOutIn(n);
+        PoolParallelFor(n);
+        PoolTimerJitter(n);
+        JobThroughput(n);
+        JobLatency(n);
+        TaskTimerJitter(n);
+    }
+
+    char date[32];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    json doc;
+    doc["meta"] = {
+        {"date", date},
+        {"hardware_threads", hw},
+        {"max_threads", max_threads},
+        {"scale", scale},
+#if defined(__clang__)
+        {"compiler", "clang " __clang_version__},
+#elif defined(__GNUC__)
+        {"compiler", "gcc " __VERSION__},
+#elif defined(_MSC_VER)
+        {"compiler", "msvc " + std::to_string(_MSC_VER)},
+#endif
+#ifdef NDEBUG
+        {"build", "release"},
+#else
+        {"build", "debug"},
+#endif
+    };
+    doc["results"] = results;
+
+    std::ofstream file(out);
+    if(!file)
+    {
+        printf("can not write %s\n", out.c_str());
+        return 1;
+    }
+    file << doc.dump(2) << "\n";
+    printf("results written to %s\n", out.c_str());
+    if(failures)
+        printf("%d checks failed\n", failures);
+    return failures ? 1 : 0;
+}
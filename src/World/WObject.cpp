@@ -142,7 +142,7 @@ void WObject::SetScale(MVector3f scale) {
 }
 
 void WObject::AddTag(std::string tag, Data value) {
-    tags.insert({tag, value});
+    tags.insert(tag, value);
     if (world) world->RegisterTags(Ref<WObject>(this));
 }
 
@@ -152,12 +152,13 @@ void WObject::RemoveTag(std::string tag) {
 }
 
 bool WObject::HasTag(std::string tag) const {
-    return tags.find(tag) != tags.end();
+    return tags.contains(tag);
 }
 
 Data WObject::GetTagValue(std::string tag) const {
-    auto v = tags.find(tag);
-    return (v != tags.end()) ? v->second : Data();
+    Data value;
+    tags.find(tag, value);
+    return value;
 }
 
 // WComponent
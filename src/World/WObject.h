@@ -26,29 +26,51 @@ public:
     template<typename T>
     std::vector<Ref<T>> GetComponentsOfType() {
         std::vector<Ref<T>> result;
+        CollectComponentsOfType<T>(result);
+        return result;
+    }
+
+    // per frame queries: GetComponentsOfType<T>(&FrameResource::Local())
+    template<typename T>
+    std::pmr::vector<Ref<T>> GetComponentsOfType(std::pmr::memory_resource* memory) {
+        std::pmr::vector<Ref<T>> result(memory);
+        CollectComponentsOfType<T>(result);
+        return result;
+    }
+
+    // appends the components of the whole subtree, depth first
+    template<typename T, typename Out>
+    void CollectComponentsOfType(Out& result) {
         for (auto& comp : components) {
             if (auto casted = RefCast<T>(comp)) {
                 result.push_back(casted);
             }
-            std::vector<Ref<T>> t = comp->GetComponentsOfType<T>();
-            if(t.size())
-                result.insert(result.end(), t.begin(), t.end());
+            comp->CollectComponentsOfType<T>(result);
         }
-        return result;
     }
 
     template<typename T>
     std::vector<Ref<T>> GetChildsOfType() {
         std::vector<Ref<T>> result;
+        CollectChildsOfType<T>(result);
+        return result;
+    }
+
+    template<typename T>
+    std::pmr::vector<Ref<T>> GetChildsOfType(std::pmr::memory_resource* memory) {
+        std::pmr::vector<Ref<T>> result(memory);
+        CollectChildsOfType<T>(result);
+        return result;
+    }
+
+    template<typename T, typename Out>
+    void CollectChildsOfType(Out& result) {
         for (auto& child : children) {
             if (auto casted = RefCast<T>(child)) {
                 result.push_back(casted);
             }
-            std::vector<Ref<T>> t = child->GetChildsOfType<T>();
-            if(t.size())
-                result.insert(result.end(), t.begin(), t.end());
+            child->CollectChildsOfType<T>(result);
         }
-        return result;
     }
     
     void SetPosition(MVector3f position);
@@ -65,7 +87,7 @@ public:
     void RemoveTag(std::string tag);
     bool HasTag(std::string tag) const;
     Data GetTagValue(std::string tag) const;
-    const std::unordered_map<std::string, Data>& GetTags() const { return tags; }
+    const ConcurrentHashMap<std::string, Data>& GetTags() const { return tags; }
     
     virtual void Update(float delta_time) {}
 
@@ -80,7 +102,7 @@ protected:
     MMatrix4f local_transform = MMatrix4f::identity();
     std::vector<Ref<WObject>> children;
     std::vector<Ref<WObject>> components;
-    std::unordered_map<std::string, Data> tags;
+    ConcurrentHashMap<std::string, Data> tags{1}; // a few tags per object, one shard keeps it small
     WObject* owner = nullptr;
     WObject* parent = nullptr;
     
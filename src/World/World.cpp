@@ -26,10 +26,17 @@ void World::RemoveObject(Ref<WObject> object) {
 }
 
 std::vector<Ref<WObject>> World::FindObjectsByTag(std::string tag) {
-    if (auto it = tag_registry.find(tag); it != tag_registry.end()) {
-        return it->second;
-    }
-    return {};
+    std::vector<Ref<WObject>> objects;
+    tag_registry.find(tag, objects);
+    return objects;
+}
+
+std::pmr::vector<Ref<WObject>> World::FindObjectsByTag(std::string tag, std::pmr::memory_resource* memory) {
+    std::pmr::vector<Ref<WObject>> objects(memory);
+    tag_registry.visit(tag, [&](const std::vector<Ref<WObject>>& found) {
+        objects.assign(found.begin(), found.end());
+    });
+    return objects;
 }
 
 void World::Update(float delta_time) {
@@ -39,15 +46,16 @@ void World::Update(float delta_time) {
 }
 
 void World::RegisterTags(Ref<WObject> object) {
-    for (const auto& tag : object->GetTags()) {
-        tag_registry[tag.first].push_back(object);
-    }
+    object->GetTags().for_each([&](const std::string& tag, const Data&) {
+        tag_registry.upsert(tag, [&](std::vector<Ref<WObject>>& objects) { objects.push_back(object); });
+    });
 }
 
 void World::UnregisterTags(Ref<WObject> object) {
-    for (const auto& tag : object->GetTags()) {
-        auto& objects = tag_registry[tag.first];
-        auto it = std::remove(objects.begin(), objects.end(), object);
-        objects.erase(it, objects.end());
-    }
+    object->GetTags().for_each([&](const std::string& tag, const Data&) {
+        tag_registry.update(tag, [&](std::vector<Ref<WObject>>& objects) {
+            auto it = std::remove(objects.begin(), objects.end(), object);
+            objects.erase(it, objects.end());
+        });
+    });
 }
\ No newline at end of file
@@ -13,6 +13,7 @@ public:
     void RemoveObject(Ref<WObject> object);
     
     std::vector<Ref<WObject>> FindObjectsByTag(std::string tag);
+    std::pmr::vector<Ref<WObject>> FindObjectsByTag(std::string tag, std::pmr::memory_resource* memory);
     void Update(float delta_time);
     
     std::string GetName() const { return name; }
@@ -25,7 +26,7 @@ public:
 private:
     std::string name;
     std::vector<Ref<WObject>> root_objects;
-    std::unordered_map<std::string, std::vector<Ref<WObject>>> tag_registry;
+    ConcurrentHashMap<std::string, std::vector<Ref<WObject>>> tag_registry;
     
 };
 
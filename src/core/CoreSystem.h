@@ -5,8 +5,9 @@
 class CoreSystem : public ISystem
 {
     DECLARE_SYSTEM(CoreSystem);
+    // no workers of its own, Process() drives the pool from the main loop
     CoreSystem() :
-        thread(0, true)
+        thread(ThredaPool::Config{ .threads = 0, .name = "Core" })
     {
 
     }
@@ -14,9 +15,11 @@ public:
 
     ThredaPool thread;
 
+    // one frame of the main loop, the frame temporaries of this thread are freed at the end
     int Process()
     {
         thread.Process();
+        FrameArena::Local().Reset();
         return 0;
     }
 };
\ No newline at end of file
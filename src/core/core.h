@@ -2,10 +2,14 @@
 
 
 #include "imp/lockfreelist.h"
+#include "imp/concurrent_hash_map.h"
+#include "imp/frame_arena.h"
 #include "imp/thread_pool.h"
+#include "imp/task_graph.h"
 
 #include "imp/nlohmannjson.hpp"
 #include "imp/data.h"
+#include "imp/asset_container.h"
 #include "imp/wmath.h"
 #include "imp/Property.h"
 
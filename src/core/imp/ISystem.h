@@ -2,16 +2,61 @@
 
 
 #include <type_traits>
+#include <vector>
+#include <mutex>
 
+// Systems are created on first Get() and destroyed in reverse creation order,
+// by ShutdownAll() or, failing that, when the registry dies at exit.
 class ISystem
 {
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<std::pair<ISystem*, ISystem**>> systems;
+
+        void Shutdown()
+        {
+            std::vector<std::pair<ISystem*, ISystem**>> list;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                list.swap(systems);
+            }
+            for(auto it = list.rbegin(); it != list.rend(); ++it)
+            {
+                *it->second = nullptr;
+                delete it->first;
+            }
+        }
+
+        ~Registry() { Shutdown(); }
+    };
+
+    static Registry& GetRegistry()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    static ISystem* Register(ISystem* system, ISystem** slot)
+    {
+        Registry& r = GetRegistry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.systems.push_back({ system, slot });
+        return system;
+    }
+
 public:
+    virtual ~ISystem() = default;
+
+    // nullptr once the system was shut down
     template<typename T, typename Check = std::enable_if_t<std::is_base_of_v<ISystem, T>>>
     static T* Get()
     {
-        static T _;
-        return &_;
+        static ISystem* instance = Register(new T(), &instance);
+        return static_cast<T*>(instance);
     }
+
+    static void ShutdownAll() { GetRegistry().Shutdown(); }
 };
 
 #define DECLARE_SYSTEM(T) public: static T* Get() { return ISystem::Get<T>(); } friend class ISystem;
\ No newline at end of file
@@ -1,17 +1,18 @@
 #include <functional>
 #include <utility>
 #include "data.h"
+#include "function.hpp"
 
 
 template<typename T>
 class ReadOnlyProperty {
 private:
-    std::function<T()> getter_;
+    srv_function<T()> getter_;
 
 public:
     ReadOnlyProperty(const ReadOnlyProperty<T>&) = delete;
     ReadOnlyProperty<T>& operator=(const ReadOnlyProperty<T>&) = delete;
-    explicit ReadOnlyProperty(std::function<T()> getter) : getter_(getter) {}
+    explicit ReadOnlyProperty(srv_function<T()> getter) : getter_(std::move(getter)) {}
     
     virtual operator T() const { return getter_(); }
 };
@@ -19,23 +20,23 @@ public:
 template<typename T>
 class WriteOnlyProperty {
 private:
-    std::function<void(const T&)> setter_;
+    srv_function<void(const T&)> setter_;
 public:
     WriteOnlyProperty(const WriteOnlyProperty<T>&) = delete;
     WriteOnlyProperty<T>& operator=(const WriteOnlyProperty<T>&) = delete;
-    explicit WriteOnlyProperty(std::function<void(const T&)> setter) : setter_(setter) {}
+    explicit WriteOnlyProperty(srv_function<void(const T&)> setter) : setter_(std::move(setter)) {}
     
     virtual WriteOnlyProperty<T>& operator=(const T& value) { if(setter_) setter_(value); return *this; }
 };
 
 template<typename T>
 class Property{
-    std::function<T()> getter_;
-    std::function<void(const T&)> setter_;
+    srv_function<T()> getter_;
+    srv_function<void(const T&)> setter_;
 public:
     Property(const Property<T>&) = delete;
     Property<T>& operator=(const Property<T>&) = delete;
-    explicit Property(std::function<T()> getter, std::function<void(const T&)> setter) : getter_(getter), setter_(setter) {}
+    explicit Property(srv_function<T()> getter, srv_function<void(const T&)> setter) : getter_(std::move(getter)), setter_(std::move(setter)) {}
 
     virtual operator T() const { return getter_(); }
     virtual Property<T>& operator=(const T& value) { if(setter_) setter_(value); return *this; }
@@ -101,8 +102,8 @@ public:
 template<typename T>
 class ReactiveProperty {
 private:
-    std::function<T()> getter_;
-    std::function<void(const T&)> setter_;
+    srv_function<T()> getter_;
+    srv_function<void(const T&)> setter_;
     std::vector<ReactiveProperty<T>*> subscribers_;
     ReactiveProperty<T>* owner_ = nullptr;
 
@@ -112,10 +113,10 @@ public:
     ReactiveProperty<T>& operator=(const ReactiveProperty<T>&) = delete;
     
     // Конструкторы
-    ReactiveProperty(std::function<T()> getter, std::function<void(const T&)> setter) 
+    ReactiveProperty(srv_function<T()> getter, srv_function<void(const T&)> setter) 
         : getter_(std::move(getter)), setter_(std::move(setter)) {}
         
-    explicit ReactiveProperty(std::function<T()> getter) 
+    explicit ReactiveProperty(srv_function<T()> getter) 
         : getter_(std::move(getter)), setter_(nullptr) {}
     
     explicit ReactiveProperty(T initial_value) 
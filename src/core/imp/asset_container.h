@@ -0,0 +1,327 @@
+#pragma once
+
+
+#ifndef ASSET_CONTAINER_H
+#define ASSET_CONTAINER_H
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "data.h"
+#include "mapped_file.h"
+
+// Binary container for scenes and assets, made to be mapped and used without parsing.
+//
+//   Header     64 bytes at offset 0
+//   sections   every one starts at a multiple of ALIGN
+//   names      name pool of the sections
+//   table      Section entries
+//
+// All offsets are from the start of the file. A Blob section is an array of trivially copyable elements
+// (vertices, indices, bone matrices), the reader hands it out in place. A Value section is anything the ser
+// serializers write (DECLARE_DATA_SERIALIZABLE types, containers, Data), it is decoded only when it is asked for.
+// Type ids are the compile-time Helper<T>::ID(), a section only loads into the type it was written from.
+// Files are read by builds from other compilers, so only types with a declared id can be written (see StableID):
+// DECLARE_DATA_TYPE (or DECLARE_DATA_STRUCT_AND_SERIALIZE) for element and value types.
+//
+//   AssetWriter w(LEVEL_SCHEMA);
+//   w.AddBlob("hero.vertices", mesh.v);
+//   w.AddBlob("hero.indices", mesh.f);
+//   w.AddValue("hero.bones", bone_parents);
+//   w.Save("hero.wasset");
+//
+//   AssetFile f("hero.wasset");
+//   std::span<const Mesh::Vertex> v = f.Blob<Mesh::Vertex>("hero.vertices");
+struct AssetFormat
+{
+    static constexpr char     MAGIC[8] = {'W', 'E', 'A', 'S', 'S', 'E', 'T', 0};
+    static constexpr uint32_t VERSION  = 2;          // layout of Header and Section and encoding of values, readers refuse other versions
+    static constexpr uint32_t ENDIAN   = 0x01020304; // as written by the producer, files are not byte swapped
+    static constexpr size_t   ALIGN    = 64;
+
+    enum Kind : uint32_t
+    {
+        Blob  = 1,
+        Value = 2,
+    };
+
+    struct Header
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t schema; // version of the contents as a whole, chosen by the writer
+        uint32_t endian;
+        uint32_t section_count;
+        uint64_t size;     // whole file
+        uint64_t sections; // offset of the Section table
+        uint64_t names;    // offset of the name pool
+        uint64_t names_size;
+        uint8_t  reserved[8];
+    };
+
+    struct Section
+    {
+        uint64_t type;   // Helper<T>::ID() of the value, of the element for blobs
+        uint64_t offset; // multiple of ALIGN
+        uint64_t size;   // bytes
+        uint64_t count;  // elements of a blob, 1 for a value
+        uint32_t kind;
+        uint32_t schema; // version of the section contents, chosen by the writer
+        uint32_t stride; // element size of a blob, 0 for a value
+        uint32_t name_size;
+        uint64_t name_offset; // in the name pool
+        uint8_t  reserved[8];
+    };
+
+    static_assert(sizeof(Header) == 64 && sizeof(Section) == 64, "the layout is part of the file format");
+};
+
+class AssetWriter
+{
+    using Section = AssetFormat::Section;
+
+public:
+    explicit AssetWriter(uint32_t schema = 0) : schema(schema) { buf.resize(sizeof(AssetFormat::Header)); }
+
+    template<typename T>
+    void AddBlob(std::string_view name, const T* data, size_t count, uint32_t section_schema = 0)
+    {
+        static_assert(data_core::SerBulk<T>::val, "blobs are used in place, elements must be trivially copyable and hold no pointers");
+        static_assert(alignof(T) <= AssetFormat::ALIGN, "blob elements are aligned to at most AssetFormat::ALIGN");
+        static_assert(data_core::StableID<T>(), "the type id is persisted, declare the element type with DECLARE_DATA_TYPE");
+        Section& s = Begin(name, AssetFormat::Blob, data_core::Helper<T>::ID(), section_schema);
+        s.size     = sizeof(T) * count;
+        s.count    = count;
+        s.stride   = sizeof(T);
+        buf.resize(s.offset + s.size);
+        if(count)
+            memcpy(buf.data() + s.offset, data, s.size);
+    }
+
+    template<typename T>
+    void AddBlob(std::string_view name, const std::vector<T>& data, uint32_t section_schema = 0)
+    {
+        AddBlob(name, data.data(), data.size(), section_schema);
+    }
+
+    // serialized in place at the end of the file
+    template<typename T>
+    void AddValue(std::string_view name, const T& value, uint32_t section_schema = 0)
+    {
+        static_assert(data_core::SerHelper<T>::val, "values need a serializer, see DECLARE_DATA_SERIALIZABLE");
+        static_assert(data_core::StableID<T>(), "the type id is persisted, declare the type with DECLARE_DATA_TYPE");
+        Section& s = Begin(name, AssetFormat::Value, data_core::Helper<T>::ID(), section_schema);
+        s.count    = 1;
+        s.size     = data_core::ser::Serialize(data_core::ser::Writer(buf, s.offset), &value);
+    }
+
+    // appends the name pool and the section table and fills the header, no sections can be added afterwards
+    const data_core::ser::data_t& Finish()
+    {
+        if(finished)
+            return buf;
+        finished = true;
+
+        AssetFormat::Header header = {};
+        memcpy(header.magic, AssetFormat::MAGIC, sizeof(header.magic));
+        header.version       = AssetFormat::VERSION;
+        header.schema        = schema;
+        header.endian        = AssetFormat::ENDIAN;
+        header.section_count = uint32_t(sections.size());
+
+        Align();
+        header.names      = buf.size();
+        header.names_size = names.size();
+        buf.insert(buf.end(), names.begin(), names.end());
+
+        Align();
+        header.sections = buf.size();
+        buf.resize(buf.size() + sections.size() * sizeof(Section));
+        if(!sections.empty())
+            memcpy(buf.data() + header.sections, sections.data(), sections.size() * sizeof(Section));
+
+        header.size = buf.size();
+        memcpy(buf.data(), &header, sizeof(header));
+        return buf;
+    }
+
+    bool Save(const std::string& path)
+    {
+        const auto& bytes = Finish();
+        FILE* f = fopen(path.c_str(), "wb");
+        if(!f)
+            return false;
+        const bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+        return fclose(f) == 0 && ok;
+    }
+
+private:
+    Section& Begin(std::string_view name, AssetFormat::Kind kind, uint64_t type, uint32_t section_schema)
+    {
+        if(finished)
+            throw std::logic_error("AssetWriter: sections added after Finish()");
+        for(auto& s : sections)
+            if(std::string_view(names.data() + s.name_offset, s.name_size) == name)
+                throw std::invalid_argument("AssetWriter: duplicate section name");
+
+        Align();
+        Section s     = {};
+        s.type        = type;
+        s.offset      = buf.size();
+        s.kind        = kind;
+        s.schema      = section_schema;
+        s.name_offset = names.size();
+        s.name_size   = uint32_t(name.size());
+        names.append(name);
+        sections.push_back(s);
+        return sections.back();
+    }
+
+    void Align() { buf.resize((buf.size() + AssetFormat::ALIGN - 1) & ~(AssetFormat::ALIGN - 1)); }
+
+    data_core::ser::data_t buf;
+    std::vector<Section>   sections;
+    std::string            names;
+    uint32_t               schema;
+    bool                   finished = false;
+};
+
+// Reader of the container. Open() checks the header and the section table and nothing else,
+// blobs are handed out in place and values are decoded when they are loaded, so loading costs page faults, not parsing.
+class AssetFile
+{
+    using Section = AssetFormat::Section;
+
+public:
+    AssetFile() = default;
+    explicit AssetFile(const std::string& path) { Open(path); }
+
+    AssetFile(const AssetFile&)            = delete;
+    AssetFile& operator=(const AssetFile&) = delete;
+
+    // maps the file, false when it can not be read or is not a valid container
+    bool Open(const std::string& path)
+    {
+        Close();
+        if(!file.Open(path))
+            return false;
+        if(Attach(data_core::ser::view_t(file.Data(), file.Size())))
+            return true;
+        Close();
+        return false;
+    }
+
+    // a container already in memory, it must outlive the AssetFile. Blobs are in place only as aligned as the buffer is.
+    bool Open(data_core::ser::view_t buffer)
+    {
+        Close();
+        if(Attach(buffer))
+            return true;
+        Close();
+        return false;
+    }
+
+    void Close()
+    {
+        file.Close();
+        bytes    = {};
+        header   = nullptr;
+        sections = nullptr;
+    }
+
+    bool     IsOpen() const { return header != nullptr; }
+    uint32_t Schema() const { return header->schema; }
+
+    size_t         SectionCount() const { return header ? header->section_count : 0; }
+    const Section& SectionAt(size_t i) const { return sections[i]; }
+
+    std::string_view Name(const Section& s) const
+    {
+        return std::string_view((const char*)bytes.data() + header->names + s.name_offset, s.name_size);
+    }
+
+    const Section* Find(std::string_view name) const
+    {
+        for(size_t i = 0; i < SectionCount(); ++i)
+            if(Name(sections[i]) == name)
+                return &sections[i];
+        return nullptr;
+    }
+
+    data_core::ser::view_t Bytes(const Section& s) const { return bytes.subspan(s.offset, s.size); }
+
+    // elements of a blob in place, valid while the file is open. Empty when the section is missing,
+    // throws when it holds another type.
+    template<typename T>
+    std::span<const T> Blob(std::string_view name) const
+    {
+        const Section* s = Find(name);
+        if(!s)
+            return {};
+        if(s->kind != AssetFormat::Blob || s->type != data_core::Helper<T>::ID() || s->stride != sizeof(T))
+            throw std::invalid_argument("AssetFile: section holds another type");
+        const T* data = reinterpret_cast<const T*>(bytes.data() + s->offset);
+        if(reinterpret_cast<uintptr_t>(data) % alignof(T) != 0)
+            throw std::runtime_error("AssetFile: unaligned buffer");
+        return std::span<const T>(data, s->count);
+    }
+
+    // decodes a value into out, false when the section is missing. Throws when it holds another type or is malformed.
+    template<typename T>
+    bool Load(std::string_view name, T& out, uint32_t* section_schema = nullptr) const
+    {
+        const Section* s = Find(name);
+        if(!s)
+            return false;
+        if(s->kind != AssetFormat::Value || s->type != data_core::Helper<T>::ID())
+            throw std::invalid_argument("AssetFile: section holds another type");
+        if(data_core::ser::Deserialize(Bytes(*s), &out) != s->size)
+            throw std::runtime_error("AssetFile: malformed section");
+        if(section_schema)
+            *section_schema = s->schema;
+        return true;
+    }
+
+private:
+    static bool InBounds(uint64_t offset, uint64_t size, uint64_t limit) { return offset <= limit && size <= limit - offset; }
+
+    bool Attach(data_core::ser::view_t buffer)
+    {
+        if(buffer.size() < sizeof(AssetFormat::Header) || reinterpret_cast<uintptr_t>(buffer.data()) % alignof(AssetFormat::Header) != 0)
+            return false;
+        auto h = reinterpret_cast<const AssetFormat::Header*>(buffer.data());
+        if(memcmp(h->magic, AssetFormat::MAGIC, sizeof(h->magic)) != 0 || h->version != AssetFormat::VERSION || h->endian != AssetFormat::ENDIAN)
+            return false;
+        if(h->size > buffer.size() || h->sections % AssetFormat::ALIGN != 0)
+            return false;
+        if(!InBounds(h->sections, uint64_t(h->section_count) * sizeof(Section), h->size) || !InBounds(h->names, h->names_size, h->size))
+            return false;
+
+        auto table = reinterpret_cast<const Section*>(buffer.data() + h->sections);
+        for(uint32_t i = 0; i < h->section_count; ++i)
+        {
+            const Section& s = table[i];
+            if(s.offset % AssetFormat::ALIGN != 0 || !InBounds(s.offset, s.size, h->size) || !InBounds(s.name_offset, s.name_size, h->names_size))
+                return false;
+            if(s.kind == AssetFormat::Blob ? !s.stride || s.size % s.stride != 0 || s.size / s.stride != s.count : s.kind != AssetFormat::Value)
+                return false;
+        }
+
+        bytes    = buffer.first(size_t(h->size));
+        header   = h;
+        sections = table;
+        return true;
+    }
+
+    MappedFile                 file;
+    data_core::ser::view_t     bytes;
+    const AssetFormat::Header* header   = nullptr;
+    const Section*             sections = nullptr;
+};
+
+
+#endif // ASSET_CONTAINER_H
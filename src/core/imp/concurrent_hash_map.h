@@ -0,0 +1,307 @@
+#pragma once
+
+
+#ifndef CONCURRENT_HASH_MAP_H
+#define CONCURRENT_HASH_MAP_H
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <utility>
+#include "locks.h"
+
+// Hash map for registries shared between threads. Keys are spread over a power of two number of shards,
+// every shard is an open addressing table (linear probing, one control byte per slot) behind a RWSpinLock,
+// so readers of one shard never block each other and writers only block their own shard.
+// Values are returned by copy, visit/update/upsert run a callable on the value under the shard lock.
+// Callables must not use the same map, the shard lock is not re-entrant. The lock is released when they throw.
+template<typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+class ConcurrentHashMap
+{
+    struct Entry
+    {
+        K key;
+        V value;
+    };
+
+    static constexpr uint8_t EMPTY   = 0x80;
+    static constexpr uint8_t DELETED = 0xFE;
+
+    struct Shard
+    {
+        mutable RWSpinLock lock; // a cache line of its own
+
+        uint8_t* ctrl  = nullptr; // EMPTY, DELETED or the low 7 bits of the hash
+        Entry*   slots = nullptr;
+        size_t   mask  = 0;
+        size_t   count = 0;
+        size_t   used  = 0; // count and tombstones
+
+        size_t Capacity() const { return slots ? mask + 1 : 0; }
+
+        // slot index or npos
+        size_t Find(const K& key, uint64_t h) const
+        {
+            if(!slots)
+                return npos;
+            const uint8_t tag = uint8_t(h & 0x7F);
+            for(size_t i = size_t(h >> 7) & mask;; i = (i + 1) & mask)
+            {
+                const uint8_t c = ctrl[i];
+                if(c == EMPTY)
+                    return npos;
+                if(c == tag && Eq{}(slots[i].key, key))
+                    return i;
+            }
+        }
+
+        // index of the key, inserted == false, or of a free slot for it, inserted == true
+        template<typename... ARGS>
+        size_t Emplace(const K& key, uint64_t h, bool& inserted, ARGS&&... value)
+        {
+            size_t i = Find(key, h);
+            inserted = i == npos;
+            if(!inserted)
+                return i;
+            if((used + 1) * 8 > Capacity() * 7)
+                Rehash(count * 2 + 2 > Capacity() ? Capacity() * 2 : Capacity());
+
+            i = size_t(h >> 7) & mask;
+            while(ctrl[i] != EMPTY && ctrl[i] != DELETED)
+                i = (i + 1) & mask;
+            if(ctrl[i] == EMPTY)
+                ++used;
+            new(&slots[i]) Entry{key, V(std::forward<ARGS>(value)...)};
+            ctrl[i] = uint8_t(h & 0x7F);
+            ++count;
+            return i;
+        }
+
+        void Erase(size_t i)
+        {
+            slots[i].~Entry();
+            --count;
+            // a slot before an empty one ends no probe chain, it can be empty too
+            if(ctrl[(i + 1) & mask] == EMPTY)
+            {
+                ctrl[i] = EMPTY;
+                --used;
+            }
+            else
+                ctrl[i] = DELETED;
+        }
+
+        void Rehash(size_t capacity)
+        {
+            if(capacity < 8)
+                capacity = 8;
+            uint8_t* old_ctrl  = ctrl;
+            Entry*   old_slots = slots;
+            const size_t old_capacity = Capacity();
+
+            ctrl  = new uint8_t[capacity];
+            slots = std::allocator<Entry>().allocate(capacity);
+            mask  = capacity - 1;
+            used  = count;
+            for(size_t i = 0; i < capacity; ++i)
+                ctrl[i] = EMPTY;
+
+            for(size_t i = 0; i < old_capacity; ++i)
+            {
+                if(old_ctrl[i] & 0x80)
+                    continue;
+                const uint64_t h = Mix(old_slots[i].key);
+                size_t j = size_t(h >> 7) & mask;
+                while(ctrl[j] != EMPTY)
+                    j = (j + 1) & mask;
+                new(&slots[j]) Entry(std::move(old_slots[i]));
+                ctrl[j] = old_ctrl[i];
+                old_slots[i].~Entry();
+            }
+            if(old_slots)
+                std::allocator<Entry>().deallocate(old_slots, old_capacity);
+            delete[] old_ctrl;
+        }
+
+        void Clear()
+        {
+            for(size_t i = 0; i < Capacity(); ++i)
+                if(!(ctrl[i] & 0x80))
+                    slots[i].~Entry();
+            if(slots)
+                std::allocator<Entry>().deallocate(slots, Capacity());
+            delete[] ctrl;
+            ctrl  = nullptr;
+            slots = nullptr;
+            mask  = 0;
+            count = 0;
+            used  = 0;
+        }
+    };
+
+    static constexpr size_t npos = ~size_t(0);
+
+    static uint64_t Mix(const K& key)
+    {
+        uint64_t h = uint64_t(Hash{}(key)) * 0x9E3779B97F4A7C15ull;
+        return h ^ (h >> 29);
+    }
+
+    Shard& For(uint64_t h) const { return shards[(h >> 56) & shard_mask]; }
+
+    Shard* shards;
+    size_t shard_mask;
+
+public:
+    // shards is rounded up to a power of two, at most 256
+    explicit ConcurrentHashMap(size_t shard_count = 64)
+    {
+        size_t c = 1;
+        while(c < shard_count && c < 256)
+            c <<= 1;
+        shards     = new Shard[c];
+        shard_mask = c - 1;
+    }
+
+    ConcurrentHashMap(const ConcurrentHashMap&)            = delete;
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+    ~ConcurrentHashMap()
+    {
+        clear();
+        delete[] shards;
+    }
+
+    // copies the value into out
+    bool find(const K& key, V& out) const
+    {
+        return visit(key, [&](const V& v) { out = v; });
+    }
+
+    bool contains(const K& key) const
+    {
+        return visit(key, [](const V&) {});
+    }
+
+    // f(const V&) under the shared lock of the shard, false when the key is missing
+    template<typename F>
+    bool visit(const K& key, F&& f) const
+    {
+        const uint64_t h = Mix(key);
+        Shard& s = For(h);
+        std::shared_lock<RWSpinLock> lock(s.lock);
+        const size_t i = s.Find(key, h);
+        if(i != npos)
+            f(const_cast<const V&>(s.slots[i].value));
+        return i != npos;
+    }
+
+    // f(V&) under the exclusive lock of the shard, false when the key is missing
+    template<typename F>
+    bool update(const K& key, F&& f)
+    {
+        const uint64_t h = Mix(key);
+        Shard& s = For(h);
+        std::lock_guard<RWSpinLock> lock(s.lock);
+        const size_t i = s.Find(key, h);
+        if(i != npos)
+            f(s.slots[i].value);
+        return i != npos;
+    }
+
+    // f(V&) on the value of key, a default constructed one is inserted first when it is missing.
+    // Returns true when the value was inserted.
+    template<typename F>
+    bool upsert(const K& key, F&& f)
+    {
+        const uint64_t h = Mix(key);
+        Shard& s = For(h);
+        bool inserted;
+        std::lock_guard<RWSpinLock> lock(s.lock);
+        const size_t i = s.Emplace(key, h, inserted);
+        f(s.slots[i].value);
+        return inserted;
+    }
+
+    // false when the key is present already, the value is left as it was
+    bool insert(const K& key, V value)
+    {
+        const uint64_t h = Mix(key);
+        Shard& s = For(h);
+        bool inserted;
+        std::lock_guard<RWSpinLock> lock(s.lock);
+        s.Emplace(key, h, inserted, std::move(value));
+        return inserted;
+    }
+
+    // true when the key was inserted, false when an existing value was replaced
+    bool insert_or_assign(const K& key, V value)
+    {
+        const uint64_t h = Mix(key);
+        Shard& s = For(h);
+        bool inserted;
+        std::lock_guard<RWSpinLock> lock(s.lock);
+        const size_t i = s.Find(key, h);
+        if(i != npos)
+            s.slots[i].value = std::move(value);
+        else
+            s.Emplace(key, h, inserted, std::move(value));
+        return i == npos;
+    }
+
+    bool erase(const K& key)
+    {
+        const uint64_t h = Mix(key);
+        Shard& s = For(h);
+        std::lock_guard<RWSpinLock> lock(s.lock);
+        const size_t i = s.Find(key, h);
+        if(i != npos)
+            s.Erase(i);
+        return i != npos;
+    }
+
+    // f(const K&, const V&) for every entry, one shard at a time under its shared lock.
+    // Not a snapshot, entries changed meanwhile in other shards may be seen or not.
+    template<typename F>
+    void for_each(F&& f) const
+    {
+        for(size_t n = 0; n <= shard_mask; ++n)
+        {
+            Shard& s = shards[n];
+            std::shared_lock<RWSpinLock> lock(s.lock);
+            for(size_t i = 0; i < s.Capacity(); ++i)
+                if(!(s.ctrl[i] & 0x80))
+                    f(const_cast<const K&>(s.slots[i].key), const_cast<const V&>(s.slots[i].value));
+        }
+    }
+
+    // exact only while nobody writes
+    size_t size() const
+    {
+        size_t ret = 0;
+        for(size_t n = 0; n <= shard_mask; ++n)
+        {
+            std::shared_lock<RWSpinLock> lock(shards[n].lock);
+            ret += shards[n].count;
+        }
+        return ret;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    void clear()
+    {
+        for(size_t n = 0; n <= shard_mask; ++n)
+        {
+            std::lock_guard<RWSpinLock> lock(shards[n].lock);
+            shards[n].Clear();
+        }
+    }
+};
+
+
+#endif // CONCURRENT_HASH_MAP_H
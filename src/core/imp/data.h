@@ -3,15 +3,31 @@
 
 
 #include <memory>
+#include <cstdint>
+#include <atomic>
+#include <new>
 #include <cstdio>
 #include <vector>
 #include <unordered_map>
 #include <functional>
 #include <string>
+#include <span>
+#include <algorithm>
+#include <string_view>
+#include <array>
+#include <type_traits>
 #include <string.h>
 #include <tuple>
 #include <list>
 #include <stdexcept>
+#include "function.hpp"
+#include "concurrent_hash_map.h"
+
+// wmath.h, their containers are written in bulk
+template<typename T, uint16_t S>
+struct MVector;
+template<typename T, uint16_t S>
+struct MMatrix;
 
 namespace data_core
 {
@@ -38,74 +54,107 @@ namespace ser
 
 typedef std::vector<uint8_t> data_t;
 
-static void Read(size_t& offset, const data_t& var, void* ret, size_t size)
+// Serialized bytes are read through a view, nested values are read in place without copying the rest of the buffer.
+typedef std::span<const uint8_t> view_t;
+
+// Serialized bytes are written through a Writer: the buffer and the position the current value starts at.
+// Nested values are written in place behind their parent. The buffer grows by doubling, Reserve() sizes it up front.
+struct Writer
+{
+    data_t& buf;
+    size_t  base;
+
+    explicit Writer(data_t& buf, size_t base = 0) : buf(buf), base(base) {}
+
+    // writer for a nested value starting at offset of this one
+    Writer At(size_t offset) const { return Writer(buf, base + offset); }
+
+    void Reserve(size_t size) const
+    {
+        if (buf.capacity() < base + size)
+            buf.reserve(base + size);
+    }
+
+    uint8_t* Grow(size_t offset, size_t size) const
+    {
+        const size_t need = base + offset + size;
+        if (buf.size() < need)
+        {
+            if (buf.capacity() < need)
+                buf.reserve(std::max(need, buf.capacity() * 2));
+            buf.resize(need);
+        }
+        return buf.data() + base + offset;
+    }
+};
+
+static void Read(size_t& offset, view_t var, void* ret, size_t size)
 {
     if (var.size() < offset + size)
         throw(std::runtime_error("Read: buffer to small"));
-    memcpy(ret, var.data() + offset, size);
+    if (size)
+        memcpy(ret, var.data() + offset, size);
     offset += size;
 }
 
 template<class type>
-static void Read(size_t& offset, const data_t& var, type* ret)
+static void Read(size_t& offset, view_t var, type* ret)
 {
     Read(offset, var, ret, sizeof(type));
 }
 
 template<class type>
-static void Read(size_t& offset, const data_t& var, type& ret)
+static void Read(size_t& offset, view_t var, type& ret)
 {
     Read(offset, var, &ret, sizeof(type));
 }
 
 template<class type>
-static type Read(size_t& offset, const data_t& var)
+static type Read(size_t& offset, view_t var)
 {
     type ret;
     Read(offset, var, &ret, sizeof(type));
     return ret;
 }
 
+template<class T>
+static size_t Serialize(Writer ret, const T* var);
+
+template<class T>
+static size_t Deserialize(view_t var, T* ret);
+
 template<class type>
-static void DserRead(size_t& offset, const data_t& var, type* ret)
+static void DserRead(size_t& offset, view_t var, type* ret)
 {
-    data_t temp = data_t(var.begin() + offset, var.end());
-    offset      = offset + Deserialize(temp, ret);
+    if (var.size() < offset)
+        throw(std::runtime_error("DserRead: buffer to small"));
+    offset += Deserialize(var.subspan(offset), ret);
 }
 
-static void Write(size_t& offset, data_t& ret, const void* var, const size_t& size)
+static void Write(size_t& offset, const Writer& ret, const void* var, const size_t& size)
 {
-    if (ret.size() < offset + size)
-        ret.resize(offset + size, 0);
-
-    memcpy(ret.data() + offset, var, size);
+    if (size)
+        memcpy(ret.Grow(offset, size), var, size);
     offset += size;
 }
 
 template<class type>
-static void Write(size_t& offset, data_t& ret, const type* var)
+static void Write(size_t& offset, const Writer& ret, const type* var)
 {
     Write(offset, ret, var, sizeof(type));
 }
 
 template<class type>
-static void Write(size_t& offset, data_t& ret, const type& var)
+static void Write(size_t& offset, const Writer& ret, const type& var)
 {
     Write(offset, ret, &var, sizeof(type));
 }
 
 template<class type>
-static void SerWrite(size_t& offset, data_t& ret, const type* var)
+static void SerWrite(size_t& offset, const Writer& ret, const type* var)
 {
-    data_t temp;
-    Serialize(temp, var);
-    Write(offset, ret, temp.data(), temp.size());
+    offset += Serialize(ret.At(offset), var);
 }
-template<class T>
-static size_t Serialize(data_t& ret, const T* var);
-
-template<class T>
-static size_t Deserialize(const data_t& var, T* ret);
 
 template<class type>
 struct imp_t
@@ -117,20 +166,152 @@ struct SerHelper
 {
     static constexpr bool val = false;
 };
+
+#ifndef DATA_SER_BULK_ALIGN
+#define DATA_SER_BULK_ALIGN 1 // minimal alignment of bulk blocks, 16 or 64 for buffers handed to SIMD code or the GPU as loaded
+#endif
+
+// Container elements written as one block copy instead of one by one through their serializer.
+// Opt-in: arithmetic types, MVector and MMatrix, and types declared with DECLARE_DATA_SER_BULK.
+// Only declare types whose bytes are their whole value: no pointers or handles, no padding
+// (it would go to the output uninitialized) and nothing a field serializer would do differently.
 template<typename T>
-struct Helper
+struct SerBulkBlock
 {
-    static size_t ID()
-    {
-        static const auto v = GID_V(typeid(T).name());
-        return v;
-    }
-    static const char* NAME()
+    static_assert(std::is_trivially_copyable_v<T> && !std::is_pointer_v<T> && !std::is_member_pointer_v<T>, "bulk elements are copied as bytes");
+    static constexpr bool val = true;
+    // the block starts at a multiple of align from the start of the buffer
+    static constexpr size_t align = alignof(T) > DATA_SER_BULK_ALIGN ? alignof(T) : DATA_SER_BULK_ALIGN;
+    static_assert(align < 256, "bulk alignment is written as one byte");
+};
+
+template<typename T, typename = void>
+struct SerBulk
+{
+    static constexpr bool val = false;
+};
+
+template<typename T>
+struct SerBulk<T, std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool>>> : SerBulkBlock<T>
+{};
+
+template<typename T, uint16_t S>
+struct SerBulk<MVector<T, S>> : SerBulkBlock<MVector<T, S>>
+{};
+
+template<typename T, uint16_t S>
+struct SerBulk<MMatrix<T, S>> : SerBulkBlock<MMatrix<T, S>>
+{};
+namespace type_name
+{
+
+// the type name is cut out of the signature of this function
+template<typename T>
+constexpr std::string_view Signature()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    return __FUNCSIG__;
+#else
+    return __PRETTY_FUNCTION__;
+#endif
+}
+
+template<typename T>
+constexpr std::string_view Raw()
+{
+    constexpr std::string_view s = Signature<T>();
+#if defined(_MSC_VER) && !defined(__clang__)
+    // "class std::basic_string_view<...> __cdecl data_core::type_name::Signature<T>(void)"
+    constexpr size_t begin = s.find("Signature<") + 10;
+    constexpr size_t end   = s.rfind(">(void)");
+#else
+    // "... Signature() [with T = T; ...]" (gcc) or "... Signature() [T = T]" (clang)
+    constexpr size_t begin = s.find("T = ") + 4;
+    constexpr size_t semi  = s.find(';', begin);
+    constexpr size_t end   = semi == std::string_view::npos ? s.rfind(']') : semi;
+#endif
+    return s.substr(begin, end - begin);
+}
+
+constexpr bool IsIdent(char c) { return c == '_' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+
+// Drops the class/struct/enum/union keywords msvc prints and every space that is not between two identifiers,
+// so a plain user type gets the same id as DECLARE_DATA_TYPE would give it. Returns the length, out may be nullptr.
+constexpr size_t Normalize(std::string_view in, char* out)
+{
+    constexpr std::string_view keywords[] = {"class ", "struct ", "enum ", "union "};
+    size_t n    = 0;
+    char   prev = 0;
+    for (size_t i = 0; i < in.size(); ++i)
     {
-        static const auto v = typeid(T).name();
-        return v;
-    }
+        if (i == 0 || !IsIdent(in[i - 1]))
+        {
+            bool skip = false;
+            for (auto kw : keywords)
+            {
+                if (in.substr(i, kw.size()) == kw)
+                {
+                    i += kw.size() - 1;
+                    skip = true;
+                    break;
+                }
+            }
+            if (skip)
+                continue;
+        }
+        const char c = in[i];
+        if (c == ' ' && !(IsIdent(prev) && i + 1 < in.size() && IsIdent(in[i + 1])))
+            continue;
+        if (out)
+            out[n] = c;
+        prev = c;
+        ++n;
+    }
+    return n;
+}
+
+template<typename T>
+struct Info
+{
+    static constexpr size_t size = Normalize(Raw<T>(), nullptr);
+    static constexpr auto   name = [] {
+        std::array<char, size + 1> ret{};
+        Normalize(Raw<T>(), ret.data());
+        return ret;
+    }();
+    static constexpr size_t id = GETID(name.data());
+};
+
+} // namespace type_name
+
+// Types without DECLARE_DATA_TYPE get their id from the name the compiler gives them, computed at compile time.
+// Ids are stable between builds of one compiler and standard library only: they spell templates and their
+// arguments differently (std::array<int, 4> and std::array<int,4ull>, inline namespaces of the library).
+// Types whose ids are persisted must be declared, see StableID.
+template<typename T>
+struct Helper
+{
+    static constexpr size_t      ID() { return type_name::Info<std::remove_cv_t<T>>::id; }
+    static constexpr const char* NAME() { return type_name::Info<std::remove_cv_t<T>>::name.data(); }
+    static constexpr bool        STABLE() { return false; }
 };
+
+// true when the id of T is the same from every compiler: T is declared with DECLARE_DATA_TYPE, or it is a
+// template declared with DECLARE_DATA_TEMPLATE_TYPE whose id is built from the ids of such types
+template<typename T>
+constexpr bool StableID()
+{
+    if constexpr (requires { Helper<T>::STABLE(); })
+        return Helper<T>::STABLE();
+    else
+        return true;
+}
+
+template<typename... Ts>
+constexpr bool StableIDs()
+{
+    return (StableID<Ts>() && ...);
+}
 template<typename T>
 struct ConstructorHelper
 {};
@@ -138,9 +319,24 @@ struct ConstructorHelper
 class TypeConverter
 {
 private:
-    static std::unordered_map<size_t, std::unordered_map<size_t, std::function<bool(const void*, void*)>>>& get_converters()
+    typedef srv_function<bool(const void*, void*)> converter_t;
+
+    struct ConverterKey
+    {
+        size_t from;
+        size_t to;
+        bool   operator==(const ConverterKey& other) const { return from == other.from && to == other.to; }
+    };
+
+    struct ConverterKeyHash
+    {
+        size_t operator()(const ConverterKey& key) const { return key.from ^ (key.to * 0x9E3779B97F4A7C15ULL); }
+    };
+
+    // registered from any thread, looked up by pool workers
+    static ConcurrentHashMap<ConverterKey, converter_t, ConverterKeyHash>& get_converters()
     {
-        static std::unordered_map<size_t, std::unordered_map<size_t, std::function<bool(const void*, void*)>>> converters;
+        static ConcurrentHashMap<ConverterKey, converter_t, ConverterKeyHash> converters;
         return converters;
     }
 
@@ -148,8 +344,7 @@ public:
     template<typename From, typename To>
     static bool RegisterConverter()
     {
-        auto& converters                                 = get_converters();
-        converters[Helper<From>::ID()][Helper<To>::ID()] = [](const void* from, void* to) {
+        get_converters().insert_or_assign({Helper<From>::ID(), Helper<To>::ID()}, [](const void* from, void* to) {
             try
             {
                 To&         result = *static_cast<To*>(to);
@@ -157,36 +352,29 @@ public:
                 result             = (To)(source);
                 return true;
             } catch (...) { return false; }
-        };
+        });
         return true;
     }
 
     template<typename From, typename To>
     static bool RegisterConverter(std::function<bool(const From&, To&)> func)
     {
-        auto& converters                                 = get_converters();
-        converters[Helper<From>::ID()][Helper<To>::ID()] = [conv_func = func](const void* from, void* to) {
+        get_converters().insert_or_assign({Helper<From>::ID(), Helper<To>::ID()}, [conv_func = func](const void* from, void* to) {
             try
             {
                 return conv_func(*static_cast<const From*>(from), *static_cast<To*>(to));
             } catch (...) { return false; }
-        };
+        });
         return true;
     }
 
+    // the converter is copied out and runs without the map locked, it may convert again
     static bool TryConvert(size_t from_type, size_t to_type, const void* from, void* to)
     {
-        const auto& converters = get_converters();
-        const auto  it_from    = converters.find(from_type);
-        if (it_from != converters.end())
-        {
-            auto it_to = it_from->second.find(to_type);
-            if (it_to != it_from->second.end())
-            {
-                return it_to->second(from, to);
-            }
-        }
-        return false;
+        converter_t converter;
+        if (!get_converters().find({from_type, to_type}, converter))
+            return false;
+        return converter(from, to);
     }
 
     template<typename To, typename From>
@@ -197,9 +385,7 @@ public:
 
     static bool CanConvert(size_t from_type, size_t to_type)
     {
-        const auto& converters = get_converters();
-        const auto  it_from    = converters.find(from_type);
-        return it_from != converters.end() && it_from->second.find(to_type) != it_from->second.end();
+        return get_converters().contains({from_type, to_type});
     }
 };
 
@@ -228,10 +414,12 @@ struct RawData
     }
     virtual void* ptr() { return nullptr; };
     virtual const void* ptr() const { return nullptr; };
+    // gives the object up without deleting it, the deallocator of its pointer keeps it
+    virtual void detach() {}
 
 
-    virtual size_t Serialize(ser::data_t& ret) const { return 0; }
-    virtual size_t Deserialize(const ser::data_t& var) { return 0; }
+    virtual size_t Serialize(ser::Writer) const { return 0; }
+    virtual size_t Deserialize(ser::view_t) { return 0; }
 };
 
 template<typename T>
@@ -251,6 +439,7 @@ public:
     virtual ~RawValue() { delete data; };
     virtual void* ptr() override { return data; }
     virtual const void* ptr() const override { return data; };
+    virtual void detach() override { data = nullptr; }
                   operator T&() { return data; }
                   operator const T&() const { return *data; }
     template<bool A = typename std::enable_if<std::is_pointer<T>::value == true>::type* = nullptr>
@@ -259,17 +448,17 @@ public:
         return **(T)data;
     }
 
-    virtual size_t Serialize(ser::data_t& ret) const override
+    virtual size_t Serialize(ser::Writer ret) const override
     {
         if constexpr (SerHelper<T>::val)
-            return ser::Serialize(ret, &data);
+            return ser::Serialize(ret, (const T*)data);
         else
             throw(std::runtime_error("Non Serializeble"));
     }
-    virtual size_t Deserialize(const ser::data_t& var) override
+    virtual size_t Deserialize(ser::view_t var) override
     {
         if constexpr (SerHelper<T>::val)
-            return ser::Deserialize(var, &data);
+            return ser::Deserialize(var, data);
         else
             throw(std::runtime_error("Non Serializeble"));
     }
@@ -303,83 +492,193 @@ struct RawValue<char[S]> : public RawValue<std::string>
     inline static RawData* make(const char (*&_data)[S]) { return new RawValue<std::string>(*_data); }
 };
 
-struct __counter_t
+// RawValue whose object lives right behind it, in the allocation of the control block (see make_ref)
+template<typename T>
+struct RawInline final : public RawValue<T>
 {
-    std::atomic<size_t> s_counter;
-    std::atomic<size_t> w_counter;
-    RawData*            data = nullptr;
-    
-    __counter_t(RawData* data) : data(data) {  
-        s_counter = 1; 
-        w_counter = 0;
-        printf("--> create   0x%llX\n", this); 
+    template<typename... ARGS>
+    RawInline(ARGS&&... args)
+    {
+        this->data = nullptr;
+        this->data = new(storage) T(std::forward<ARGS>(args)...);
+    }
+    ~RawInline()
+    {
+        this->data->~T();
+        this->data = nullptr;
     }
 
+    alignas(T) unsigned char storage[sizeof(T)];
+};
+
+// Control block shared by all pointers of one object.
+// w_counter holds the weak pointers plus one for all strong ones together, the block goes with the last of them.
+// Local blocks (make_local_ref) count without atomic operations, their pointers must stay on one thread.
+struct __counter_t
+{
+    std::atomic<size_t>         s_counter{1};
+    std::atomic<size_t>         w_counter{1};
+    RawData*                    data         = nullptr;
+    std::function<bool(void*)>* deallocator  = nullptr; // returns false when the object must not be deleted
+    bool                        atomic       = true;
+    uint32_t                    inline_align = 0; // data and the object share the block allocated with this alignment, 0 when they do not
+
+    __counter_t(RawData* data, bool atomic = true) : data(data), atomic(atomic) {}
+
+    ~__counter_t() { delete deallocator; }
+
     __counter_t* inc()
     {
-        ++s_counter;
+        if(atomic)
+            s_counter.fetch_add(1, std::memory_order_relaxed);
+        else
+            s_counter.store(s_counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
         return this;
     }
-    
+
+    // strong reference from a weak one, nullptr when the object is gone already
+    __counter_t* lock()
+    {
+        size_t c = s_counter.load(std::memory_order_relaxed);
+        if(!atomic)
+        {
+            if(c)
+                s_counter.store(c + 1, std::memory_order_relaxed);
+        }
+        else
+        {
+            while(c && !s_counter.compare_exchange_weak(c, c + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {}
+        }
+        return c ? this : nullptr;
+    }
+
     bool dec()
     {
-        return (--s_counter) == 0;
+        if(atomic)
+            return s_counter.fetch_sub(1, std::memory_order_acq_rel) == 1;
+        const size_t c = s_counter.load(std::memory_order_relaxed) - 1;
+        s_counter.store(c, std::memory_order_relaxed);
+        return c == 0;
     }
 
     __counter_t* winc()
     {
-        ++w_counter;
+        if(atomic)
+            w_counter.fetch_add(1, std::memory_order_relaxed);
+        else
+            w_counter.store(w_counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
         return this;
     }
-    
+
     bool wdec()
     {
-        return (--w_counter) == 0;
+        if(atomic)
+            return w_counter.fetch_sub(1, std::memory_order_acq_rel) == 1;
+        const size_t c = w_counter.load(std::memory_order_relaxed) - 1;
+        w_counter.store(c, std::memory_order_relaxed);
+        return c == 0;
+    }
+
+    // last strong reference gone. An inline object is always destroyed, its memory goes with the block,
+    // the deallocator only decides about objects allocated on their own.
+    void destroy()
+    {
+        RawData* d = data;
+        data       = nullptr;
+        if(!d)
+            return;
+        const bool free_value = !deallocator || (*deallocator)(d->ptr());
+        if(inline_align)
+            d->~RawData();
+        else
+        {
+            if(!free_value)
+                d->detach();
+            delete d;
+        }
+    }
+
+    static void* allocate(size_t size, size_t align)
+    {
+        if(align > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+            return ::operator new(size, std::align_val_t(align));
+        return ::operator new(size);
+    }
+
+    static void deallocate(void* mem, size_t align)
+    {
+        if(align > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+            ::operator delete(mem, std::align_val_t(align));
+        else
+            ::operator delete(mem);
+    }
+
+    static void release(__counter_t* c)
+    {
+        if(const size_t align = c->inline_align)
+        {
+            c->~__counter_t();
+            deallocate(c, align);
+        }
+        else
+            delete c;
     }
 
-    ~__counter_t() { printf("--> ~destroy 0x%llX\n", this); }
+    // control block, type header and object in one allocation
+    template<typename T, typename... ARGS>
+    static __counter_t* make_inline(bool atomic, ARGS&&... args)
+    {
+        constexpr size_t align  = std::max(alignof(RawInline<T>), alignof(__counter_t));
+        constexpr size_t offset = (sizeof(__counter_t) + align - 1) & ~(align - 1);
+
+        void* mem = allocate(offset + sizeof(RawInline<T>), align);
+        auto  c   = new(mem) __counter_t(nullptr, atomic);
+        try
+        {
+            c->data = new((char*)mem + offset) RawInline<T>(std::forward<ARGS>(args)...);
+        }
+        catch(...)
+        {
+            c->~__counter_t();
+            deallocate(mem, align);
+            throw;
+        }
+        c->inline_align = uint32_t(align);
+        return c;
+    }
 };
 
 template<bool weak = false>
 struct _smart_pointer
 {
     __counter_t* counter = nullptr;
-    std::function<bool(void*)> deallocator = nullptr;
+
+    static __counter_t* acquire(__counter_t* c, bool from_weak)
+    {
+        if(!c)
+            return nullptr;
+        if constexpr (weak)
+            return c->winc();
+        else
+            return from_weak ? c->lock() : c->inc();
+    }
 
     void dec_impl()
     {
         if (!counter) return;
-        
+
         if constexpr (weak)
         {
             if (counter->wdec())
-            {
-                if (counter->s_counter.load() == 0)
-                {
-                    delete counter;
-                }
-            }
+                __counter_t::release(counter);
         }
         else
         {
             if (counter->dec())
             {
-                printf("--> delete   0x%llX->0x%llX\n", counter->data, counter->data->ptr());
-                if (deallocator)
-                {
-                    if (deallocator(counter->data->ptr()))
-                        delete counter->data;
-                }
-                else
-                {
-                    delete counter->data;
-                }
-                counter->data = nullptr;
-                
-                if (counter->w_counter.load() == 0)
-                {
-                    delete counter;
-                }
+                counter->destroy();
+                if (counter->wdec())
+                    __counter_t::release(counter);
             }
         }
     }
@@ -397,65 +696,57 @@ struct _smart_pointer
     template<typename T, typename check = std::enable_if_t<!weak>>
     static _smart_pointer make_from_ptr(T* value)
     {
+        if (!value)
+            return _smart_pointer();
         return _smart_pointer(RawValue<T>::make_from_ptr(value));
     }
 
-    _smart_pointer(std::nullptr_t) : counter(nullptr) {}
-
-    _smart_pointer(const _smart_pointer<false>& other)
+    template<typename T, typename... ARGS>
+    static _smart_pointer make_inline(bool atomic, ARGS&&... args)
     {
-        if (other.counter)
-        {
-            if constexpr (weak)
-                counter = other.counter->winc();
-            else
-                counter = other.counter->inc();
-        }
-        deallocator = other.deallocator;
+        static_assert(!weak, "weak pointers do not own an object");
+        _smart_pointer ret;
+        ret.counter = __counter_t::make_inline<T>(atomic, std::forward<ARGS>(args)...);
+        return ret;
     }
 
-    _smart_pointer(const _smart_pointer<true>& other)
+    _smart_pointer(std::nullptr_t) : counter(nullptr) {}
+
+    _smart_pointer(const _smart_pointer<false>& other) : counter(acquire(other.counter, false)) {}
+
+    _smart_pointer(const _smart_pointer<true>& other) : counter(acquire(other.counter, true)) {}
+
+    _smart_pointer(_smart_pointer&& other) noexcept : counter(other.counter) { other.counter = nullptr; }
+
+    _smart_pointer& operator=(const _smart_pointer<false>& other)
     {
-        if (other.counter)
+        if ((void*)this != &other)
         {
-            if constexpr (weak)
-                counter = other.counter->winc();
-            else
-                counter = other.counter->inc();
+            __counter_t* c = acquire(other.counter, false);
+            dec_impl();
+            counter = c;
         }
-        deallocator = other.deallocator;
+        return *this;
     }
 
-    _smart_pointer& operator=(const _smart_pointer<false>& other)
+    _smart_pointer& operator=(const _smart_pointer<true>& other)
     {
         if ((void*)this != &other)
         {
+            __counter_t* c = acquire(other.counter, true);
             dec_impl();
-            if (other.counter)
-            {
-                if constexpr (weak)
-                    counter = other.counter->winc();
-                else
-                    counter = other.counter->inc();
-            }
-            deallocator = other.deallocator;
+            counter = c;
         }
         return *this;
     }
 
-    _smart_pointer& operator=(const _smart_pointer<true>& other)
+    _smart_pointer& operator=(_smart_pointer&& other) noexcept
     {
-        if ((void*)this != &other)
+        if (this != &other)
         {
             dec_impl();
-            if (other.counter)
-            {
-                if constexpr (weak)
-                    counter = other.counter->winc();
-                else
-                    counter = other.counter->inc();
-            }
-            deallocator = other.deallocator;
+            counter       = other.counter;
+            other.counter = nullptr;
         }
         return *this;
     }
@@ -466,6 +757,15 @@ struct _smart_pointer
         counter = nullptr;
     }
 
+    // kept in the control block, one per object instead of one per pointer
+    void set_deallocator(std::function<bool(void*)> deallocator)
+    {
+        if (!counter)
+            return;
+        delete counter->deallocator;
+        counter->deallocator = deallocator ? new std::function<bool(void*)>(std::move(deallocator)) : nullptr;
+    }
+
     RawData*       data() { return counter ? counter->data : nullptr; }
     const RawData* data() const { return counter ? counter->data : nullptr; }
 
@@ -504,6 +804,7 @@ public:
 
     BasePointer(const _smart_pointer<false>& _) { imp = _; }
     BasePointer(const _smart_pointer<true>& _) { imp = _; }
+    BasePointer(_smart_pointer<false>&& _) { imp = std::move(_); }
 
     BasePointer(const IBasePointer* _) { _->__to(this); }
     BasePointer& operator=(const IBasePointer* _)
@@ -531,7 +832,7 @@ public:
     virtual void*       __ptr()       { auto t = imp.data(); return t ? t->ptr() : nullptr; }
     virtual const void* __ptr() const { auto t = imp.data(); return t ? t->ptr() : nullptr; }
 
-    virtual void __setDeallocator(std::function<bool(void*)> deallocator) { imp.deallocator = deallocator; }
+    virtual void __setDeallocator(std::function<bool(void*)> deallocator) { imp.set_deallocator(std::move(deallocator)); }
 };
 
 struct WeakBasePointer : public IBasePointer
@@ -603,6 +904,9 @@ struct Pointer : public BasePointer
         this->__setDeallocator(DEALLOCATOR());
     }
 
+    // takes the pointer over, see make_ref
+    explicit Pointer(_smart_pointer<false>&& _) : BasePointer(std::move(_)) {}
+
     void reset(T* value)
     {
         this->__from(_smart_pointer<false>::make_from_ptr(value));
@@ -918,15 +1222,16 @@ struct Data : public BasePointer
      * @note Equivalent to operator bool() but more explicit
      */
     bool        has() const { return __data() != nullptr; }
-    size_t      Serialize(ser::data_t& ret) const { return __data()->Serialize(ret); }
+    size_t      Serialize(ser::data_t& ret) const { return __data()->Serialize(ser::Writer(ret)); }
+    size_t      Serialize(ser::Writer ret) const { return __data()->Serialize(ret); }
     ser::data_t Serialize() const
     {
         ser::data_t ret;
-        __data()->Serialize(ret);
-        return std::move(ret);
+        __data()->Serialize(ser::Writer(ret));
+        return ret;
     }
 
-    size_t Deserialize(const ser::data_t& var)
+    size_t Deserialize(ser::view_t var)
     {
         if (!__data())
         {
@@ -947,23 +1252,66 @@ static constexpr size_t ID()
 
 namespace ser
 {
+// types without DECLARE_DATA_SERIALIZABLE write and read nothing
 template<class T>
-static size_t Serialize(data_t& ret, const T* var)
+static size_t Serialize(Writer ret, const T* var)
 {
-    return 0;
+    if constexpr (SerHelper<T>::val)
+        return imp_t<T>::Serialize(ret, var);
+    else
+        return 0;
 }
 
 template<class T>
-static size_t Deserialize(const data_t& var, T* ret)
+static size_t Deserialize(view_t var, T* ret)
 {
-    return 0;
+    if constexpr (SerHelper<T>::val)
+        return imp_t<T>::Deserialize(var, ret);
+    else
+        return 0;
 }
 
 template<class T>
-static size_t SerializeImp(data_t& ret, const T* var);
+static size_t SerializeImp(Writer ret, const T* var);
 
 template<class T>
-static size_t DeserializeImp(const data_t& var, T* ret);
+static size_t DeserializeImp(view_t var, T* ret);
+
+// count elements as one block: pad length (one byte), pad, the elements.
+// The pad aligns the block to SerBulk<T>::align from the start of the whole buffer.
+template<class T>
+static void WriteBulk(size_t& offset, const Writer& ret, const T* var, size_t count)
+{
+    constexpr size_t align = SerBulk<T>::align;
+    const uint8_t    pad   = uint8_t((align - (ret.base + offset + 1) % align) % align);
+    ret.Reserve(offset + 1 + pad + sizeof(T) * count);
+    Write(offset, ret, pad);
+    memset(ret.Grow(offset, pad), 0, pad);
+    offset += pad;
+    Write(offset, ret, var, sizeof(T) * count);
+}
+
+// skips the pad of a block written by WriteBulk and checks that count elements follow it, returns their first byte
+template<class T>
+static const uint8_t* ReadBulk(size_t& offset, view_t var, size_t count)
+{
+    offset += Read<uint8_t>(offset, var);
+    if (var.size() < offset || (var.size() - offset) / sizeof(T) < count)
+        throw(std::runtime_error("ReadBulk: buffer to small"));
+    const uint8_t* ret = var.data() + offset;
+    offset += sizeof(T) * count;
+    return ret;
+}
+
+// the block written by WriteBulk in place, valid while the buffer is. The buffer itself must be aligned to SerBulk<T>::align.
+template<class T>
+static const T* ReadBulkInPlace(size_t& offset, view_t var, size_t count)
+{
+    const T* ret = reinterpret_cast<const T*>(ReadBulk<T>(offset, var, count));
+    if (reinterpret_cast<uintptr_t>(ret) % alignof(T) != 0)
+        throw(std::runtime_error("ReadBulk: unaligned buffer"));
+    return ret;
+}
 
 template<typename... VALS>
 static auto __make_tuple_helper__(VALS&... vals)
@@ -1000,6 +1348,7 @@ struct Helper<Ret(Vars...)>
 {
     static constexpr size_t      ID() { return data_core::TGETID<Ret, Vars...>(); };
     static constexpr const char* NAME() { return Helper<Ret>::NAME(); }
+    static constexpr bool        STABLE() { return data_core::StableIDs<Ret, Vars...>(); }
 };
 
 #define DECLARE_DATA_TYPE(T)                                 \
@@ -1016,32 +1365,36 @@ struct Helper<Ret(Vars...)>
         static constexpr const char* NAME() { return #T; }   \
     };
 
-#define DECLARE_DATA_TEMPLATE_TYPE(T, tf, ts)                           \
-    template<tf>                                                        \
-    struct data_core::Helper<T<ts>>                                     \
-    {                                                                   \
-        static constexpr size_t      ID() { return GID(T) ^ TGID(ts); } \
-        static constexpr const char* NAME() { return #T; }              \
-    };                                                                  \
-    template<tf>                                                        \
-    struct data_core::Helper<const T<ts>>                               \
-    {                                                                   \
-        static constexpr size_t      ID() { return GID(T) ^ TGID(ts); } \
-        static constexpr const char* NAME() { return #T; }              \
+#define DECLARE_DATA_TEMPLATE_TYPE(T, tf, ts)                                        \
+    template<tf>                                                                     \
+    struct data_core::Helper<T<ts>>                                                  \
+    {                                                                                \
+        static constexpr size_t      ID() { return GID(T) ^ TGID(ts); }              \
+        static constexpr const char* NAME() { return #T; }                           \
+        static constexpr bool        STABLE() { return data_core::StableIDs<ts>(); } \
+    };                                                                               \
+    template<tf>                                                                     \
+    struct data_core::Helper<const T<ts>>                                            \
+    {                                                                                \
+        static constexpr size_t      ID() { return GID(T) ^ TGID(ts); }              \
+        static constexpr const char* NAME() { return #T; }                           \
+        static constexpr bool        STABLE() { return data_core::StableIDs<ts>(); } \
     };
 
-#define DECLARE_DATA_AUTO_TEMPLATE_TYPE(T)                                 \
-    template<typename... Ts>                                               \
-    struct data_core::Helper<T<Ts...>>                                     \
-    {                                                                      \
-        static constexpr size_t      ID() { return GID(T) ^ TGID(Ts...); } \
-        static constexpr const char* NAME() { return #T; }                 \
-    };                                                                     \
-    template<typename... Ts>                                               \
-    struct data_core::Helper<const T<Ts...>>                               \
-    {                                                                      \
-        static constexpr size_t      ID() { return GID(T) ^ TGID(Ts...); } \
-        static constexpr const char* NAME() { return #T; }                 \
+#define DECLARE_DATA_AUTO_TEMPLATE_TYPE(T)                                              \
+    template<typename... Ts>                                                            \
+    struct data_core::Helper<T<Ts...>>                                                  \
+    {                                                                                   \
+        static constexpr size_t      ID() { return GID(T) ^ TGID(Ts...); }              \
+        static constexpr const char* NAME() { return #T; }                              \
+        static constexpr bool        STABLE() { return data_core::StableIDs<Ts...>(); } \
+    };                                                                                  \
+    template<typename... Ts>                                                            \
+    struct data_core::Helper<const T<Ts...>>                                            \
+    {                                                                                   \
+        static constexpr size_t      ID() { return GID(T) ^ TGID(Ts...); }              \
+        static constexpr const char* NAME() { return #T; }                              \
+        static constexpr bool        STABLE() { return data_core::StableIDs<Ts...>(); } \
     };
 
 // WARNING use this in global scope (without namespace) and AFTER DECLARE_DATA_SERIALIZER_FUNC and DECLARE_DATA_DESERIALIZER_FUNC
@@ -1054,8 +1407,8 @@ struct Helper<Ret(Vars...)>
     template<>                                                                                                                \
     struct data_core::ser::imp_t<T>                                                                                           \
     {                                                                                                                         \
-        static size_t Serialize(data_t& ret, const void* var) { return data_core::ser::SerializeImp<T>(ret, (const T*)var); } \
-        static size_t Deserialize(const data_t& var, void* ret) { return data_core::ser::DeserializeImp<T>(var, (T*)ret); }   \
+        static size_t Serialize(Writer ret, const void* var) { return data_core::ser::SerializeImp<T>(ret, (const T*)var); }  \
+        static size_t Deserialize(view_t var, void* ret) { return data_core::ser::DeserializeImp<T>(var, (T*)ret); }        \
     };
 // WARNING use this in global scope (without namespace)
 #define DECLARE_DATA_SERIALIZABLE_TEMPLATE(T, tf, ts)            \
@@ -1067,28 +1420,28 @@ struct Helper<Ret(Vars...)>
     template<tf>                                                 \
     struct data_core::ser::imp_t<T<ts>>                          \
     {                                                            \
-        static size_t Serialize(data_t& ret, const void* var);   \
-        static size_t Deserialize(const data_t& var, void* ret); \
+        static size_t Serialize(Writer ret, const void* var);    \
+        static size_t Deserialize(view_t var, void* ret);        \
     };
 
 // WARNING use this in global scope (without namespace)
 #define DECLARE_DATA_SERIALIZER_FUNC(T) \
     template<>                          \
-    size_t data_core::ser::SerializeImp<T>(data_t & serealized, const T* void_deserealized)
+    size_t data_core::ser::SerializeImp<T>(Writer serealized, const T* void_deserealized)
 // WARNING use this in global scope (without namespace)
 #define DECLARE_DATA_DESERIALIZER_FUNC(T) \
     template<>                            \
-    size_t data_core::ser::DeserializeImp<T>(const data_t& serealized, T* void_deserealized)
+    size_t data_core::ser::DeserializeImp<T>(view_t serealized, T* void_deserealized)
 
 // WARNING use this in global scope (without namespace)
 #define DECLARE_DATA_SERIALIZER_TEMPLATE_FUNC(T, tf, ts)    \
     DECLARE_DATA_SERIALIZABLE_TEMPLATE(T, __I(tf), __I(ts)) \
     template<tf>                                            \
-    size_t data_core::ser::imp_t<T<ts>>::Serialize(data_t& serealized, const void* void_deserealized)
+    size_t data_core::ser::imp_t<T<ts>>::Serialize(Writer serealized, const void* void_deserealized)
 // WARNING use this in global scope (without namespace)
 #define DECLARE_DATA_DESERIALIZER_TEMPLATE_FUNC(T, tf, ts) \
     template<tf>                                           \
-    size_t data_core::ser::imp_t<T<ts>>::Deserialize(const data_t& serealized, void* void_deserealized)
+    size_t data_core::ser::imp_t<T<ts>>::Deserialize(view_t serealized, void* void_deserealized)
 
 #define DECLARE_DATA_SERIALIZER_DEFAULT_HEADER(T)        \
     const T* deserealized = (const T*)void_deserealized; \
@@ -1154,6 +1507,12 @@ struct Helper<Ret(Vars...)>
     DECLARE_DATA_TYPE(T);                           \
     DECLARE_DATA_SERIALIZER_DESERIALIZER_DEFAULT(T);
 
+// containers of T are written as one block copy, see SerBulk
+#define DECLARE_DATA_SER_BULK(T)                              \
+    template<>                                                \
+    struct data_core::SerBulk<T> : data_core::SerBulkBlock<T> \
+    {};
+
 
 #define REGISTER_CONVERSION_CONCAT_INNER(a, b) a##b
 #define REGISTER_CONVERSION_CONCAT(a, b) REGISTER_CONVERSION_CONCAT_INNER(a, b)
@@ -1196,6 +1555,20 @@ using Ref = data_core::Pointer<ARGS...>;
 template<typename... ARGS>
 using WeakRef = data_core::WeakPointer<ARGS...>;
 
+// Control block, type header and object in one allocation, instead of three for Ref<T>(new T(...)).
+template<typename T, typename... ARGS>
+Ref<T> make_ref(ARGS&&... args)
+{
+    return Ref<T>(data_core::_smart_pointer<false>::make_inline<T>(true, std::forward<ARGS>(args)...));
+}
+
+// make_ref with non-atomic reference counts. The object, its Refs and WeakRefs must never leave the creating thread.
+template<typename T, typename... ARGS>
+Ref<T> make_local_ref(ARGS&&... args)
+{
+    return Ref<T>(data_core::_smart_pointer<false>::make_inline<T>(false, std::forward<ARGS>(args)...));
+}
+
 template<typename To, typename From, typename... ARGS>
 constexpr static To* RefCast(Ref<From, ARGS...>& v)
 {
@@ -1257,16 +1630,13 @@ DECLARE_DATA_TEMPLATE_TYPE(std::weak_ptr, __I(typename T), __I(T));
 DECLARE_DATA_SERIALIZER_FUNC(data_core::Data)
 {
     DECLARE_DATA_SERIALIZER_DEFAULT_HEADER(data_core::Data);
-    data_t temp;
-    deserealized->Serialize(temp);
-    Write(offset, serealized, temp.data(), temp.size());
+    offset += deserealized->Serialize(serealized.At(offset));
     return offset;
 }
 DECLARE_DATA_DESERIALIZER_FUNC(data_core::Data)
 {
     DECLARE_DATA_DESERIALIZER_DEFAULT_HEADER(data_core::Data);
-    data_t temp = data_t(serealized.begin() + offset, serealized.end());
-    offset += deserealized->Deserialize(temp);
+    offset += deserealized->Deserialize(serealized.subspan(offset));
     return offset;
 }
 
@@ -1431,17 +1801,52 @@ DECLARE_DATA_SERIALIZER_TEMPLATE_FUNC(std::vector, __I(typename T), __I(T))
 {
     DECLARE_DATA_SERIALIZER_DEFAULT_HEADER(std::vector<T>);
     Write(offset, serealized, (int)deserealized->size());
-    for (int i = 0; i < deserealized->size(); ++i) SerWrite(offset, serealized, deserealized->data() + i);
+    if constexpr (SerBulk<T>::val)
+        WriteBulk(offset, serealized, deserealized->data(), deserealized->size());
+    else
+        for (size_t i = 0; i < deserealized->size(); ++i) SerWrite(offset, serealized, deserealized->data() + i);
     return offset;
 }
 DECLARE_DATA_DESERIALIZER_TEMPLATE_FUNC(std::vector, __I(typename T), __I(T))
 {
     DECLARE_DATA_DESERIALIZER_DEFAULT_HEADER(std::vector<T>);
-    deserealized->resize(Read<int>(offset, serealized));
-    for (int i = 0; i < deserealized->size(); ++i) DserRead(offset, serealized, deserealized->data() + i);
+    // the size is checked against the bytes left before anything is allocated
+    const int count = Read<int>(offset, serealized);
+    if (count < 0)
+        throw(std::runtime_error("vector: negative size"));
+    if constexpr (SerBulk<T>::val)
+    {
+        const uint8_t* block = ReadBulk<T>(offset, serealized, count);
+        deserealized->resize(count);
+        if (count)
+            memcpy(deserealized->data(), block, sizeof(T) * count);
+    }
+    else
+    {
+        // a serialized element takes at least one byte
+        if (SerHelper<T>::val && serealized.size() - offset < (size_t)count)
+            throw(std::runtime_error("vector: buffer to small"));
+        deserealized->resize(count);
+        for (size_t i = 0; i < deserealized->size(); ++i) DserRead(offset, serealized, deserealized->data() + i);
+    }
     return offset;
 }
 
+namespace data_core::ser
+{
+// elements of a serialized std::vector<T> with bulk elements, read in place without a copy
+template<class T>
+static std::span<const T> VectorView(view_t var)
+{
+    static_assert(SerBulk<T>::val, "only vectors of bulk elements are stored as one block");
+    size_t offset = 0;
+    if (Read<size_t>(offset, var) != Helper<std::vector<T>>::ID())
+        throw std::invalid_argument("uncorrect uid");
+    const size_t count = (size_t)Read<int>(offset, var);
+    return std::span<const T>(ReadBulkInPlace<T>(offset, var, count), count);
+}
+} // namespace data_core::ser
+
 // std::list
 
 DECLARE_DATA_TEMPLATE_TYPE(std::list, __I(typename T), __I(T))
@@ -1539,4 +1944,5 @@ DECLARE_DATA_DESERIALIZER_TEMPLATE_FUNC(std::tuple, __I(typename... ARGS), __I(A
         auto tpl = ((__HELPER__*)deserealized)->make_tuple();                                    \
         std::apply([&](auto&&... args) { (DserRead(offset, serealized, args), ...); }, tpl);     \
         return offset;                                                                           \
-    }
+    }                                                                                            \
+    DECLARE_DATA_SERIALIZABLE(name);
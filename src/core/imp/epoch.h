@@ -0,0 +1,264 @@
+#pragma once
+
+
+#ifndef EPOCH_H
+#define EPOCH_H
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "locks.h"
+
+// Epoch based memory reclamation for concurrent containers.
+// Reader:  Epoch::Guard g; ... load and use nodes ...
+// Writer:  unlink the node so no new reader can reach it; Epoch::Retire(node);
+// A retired node is freed once every thread that was inside a guard when it was retired has left it.
+// Entering and leaving a guard is wait-free, it never waits for other threads.
+// Every thread collects its own garbage every COLLECT_EVERY retires, garbage of exited threads
+// is collected by the others. A thread that stays inside a guard holds back all reclamation.
+// Guards must be left on the thread that entered them.
+class Epoch
+{
+public:
+    static constexpr uint32_t COLLECT_EVERY = 64;
+
+    struct Guard
+    {
+        Guard() { Enter(); }
+        Guard(const Guard&) { Enter(); }
+        Guard& operator=(const Guard&) { return *this; }
+        ~Guard() { Exit(); }
+    };
+
+    // guards nest, only the outermost one is announced
+    static void Enter()
+    {
+        if(tl_dead)
+            return;
+        Local& l = GetLocal();
+        if(l.nesting++ == 0)
+        {
+            const uint64_t e = global.load(std::memory_order_relaxed);
+            l.record->state.store((e << 1) | 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    static void Exit()
+    {
+        if(tl_dead)
+            return;
+        Local& l = GetLocal();
+        if(--l.nesting == 0)
+            l.record->state.store(0, std::memory_order_release);
+    }
+
+    template<typename T>
+    static void Retire(T* p)
+    {
+        Retire(p, [](void* p) { delete static_cast<T*>(p); });
+    }
+
+    static void Retire(void* p, void (*deleter)(void*))
+    {
+        const uint64_t e = global.load(std::memory_order_seq_cst);
+        if(tl_dead)
+        {
+            Bag bag;
+            bag.epoch = e;
+            bag.items.push_back({p, deleter});
+            Orphan(bag);
+            return;
+        }
+        Local& l = GetLocal();
+        Bag& bag = l.bags[e % 3];
+        // a bag is reused three epochs later, everything in it is safe by then
+        if(bag.epoch != e)
+        {
+            l.record->pending.fetch_sub(bag.Free(), std::memory_order_relaxed);
+            bag.epoch = e;
+        }
+        bag.items.push_back({p, deleter});
+        l.record->pending.fetch_add(1, std::memory_order_relaxed);
+        if(++l.retired % COLLECT_EVERY == 0)
+            Collect();
+    }
+
+    // tries to advance the epoch and frees what is safe, never blocks
+    static void Collect()
+    {
+        TryAdvance();
+        const uint64_t e = global.load(std::memory_order_acquire);
+        if(tl_dead)
+        {
+            CollectOrphans(e);
+            return;
+        }
+        Local& l = GetLocal();
+        for(auto& bag : l.bags)
+            if(bag.epoch + 2 <= e)
+                l.record->pending.fetch_sub(bag.Free(), std::memory_order_relaxed);
+        CollectOrphans(e);
+    }
+
+    // frees everything retired by this thread before the call, waits for the guards of other threads.
+    // Must not be called inside a guard.
+    static void Synchronize()
+    {
+        const uint64_t target = global.load(std::memory_order_seq_cst) + 2;
+        for(SpinBackoff backoff; global.load(std::memory_order_acquire) < target; backoff.Pause())
+            TryAdvance();
+        Collect();
+    }
+
+    // retired and not freed yet, over all threads
+    static size_t Pending()
+    {
+        size_t ret = orphan_count.load(std::memory_order_relaxed);
+        for(Record* r = records.load(std::memory_order_acquire); r; r = r->next)
+            ret += r->pending.load(std::memory_order_relaxed);
+        return ret;
+    }
+
+private:
+    struct Retired
+    {
+        void* ptr;
+        void (*deleter)(void*);
+    };
+
+    struct Bag
+    {
+        uint64_t             epoch = 0;
+        std::vector<Retired> items;
+
+        // deleters may retire again, even into this bag
+        size_t Free()
+        {
+            std::vector<Retired> list;
+            list.swap(items);
+            for(auto& r : list)
+                r.deleter(r.ptr);
+            const size_t ret = list.size();
+            list.clear();
+            if(items.empty())
+                items.swap(list);
+            return ret;
+        }
+    };
+
+    // one per thread, reused after the thread exits, never freed
+    struct alignas(64) Record
+    {
+        std::atomic<uint64_t> state{0}; // epoch << 1 | active
+        std::atomic<bool>     used{true};
+        std::atomic<size_t>   pending{0};
+        Record*               next = nullptr;
+    };
+
+    struct Local
+    {
+        Record*  record;
+        uint32_t nesting = 0;
+        uint32_t retired = 0;
+        Bag      bags[3];
+
+        Local() : record(Acquire()) {}
+
+        ~Local()
+        {
+            for(auto& bag : bags)
+                if(!bag.items.empty())
+                    Orphan(bag);
+            record->pending.store(0, std::memory_order_relaxed);
+            record->state.store(0, std::memory_order_release);
+            record->used.store(false, std::memory_order_release);
+            tl_dead = true;
+        }
+    };
+
+    static Local& GetLocal()
+    {
+        static thread_local Local local;
+        return local;
+    }
+
+    static Record* Acquire()
+    {
+        for(Record* r = records.load(std::memory_order_acquire); r; r = r->next)
+        {
+            bool expected = false;
+            if(!r->used.load(std::memory_order_relaxed) && r->used.compare_exchange_strong(expected, true))
+                return r;
+        }
+        Record* r = new Record();
+        r->next = records.load(std::memory_order_relaxed);
+        while(!records.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed));
+        return r;
+    }
+
+    // the epoch moves on when every thread inside a guard has seen the current one
+    static bool TryAdvance()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t e = global.load(std::memory_order_relaxed);
+        for(Record* r = records.load(std::memory_order_acquire); r; r = r->next)
+        {
+            const uint64_t s = r->state.load(std::memory_order_relaxed);
+            if((s & 1) && (s >> 1) != e)
+                return false;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return global.compare_exchange_strong(e, e + 1, std::memory_order_acq_rel);
+    }
+
+    static void Orphan(Bag& bag)
+    {
+        orphan_locker.lock();
+        orphan_count.fetch_add(bag.items.size(), std::memory_order_relaxed);
+        Orphans().push_back(std::move(bag));
+        orphan_locker.unlock();
+        bag = Bag{};
+    }
+
+    static void CollectOrphans(uint64_t e)
+    {
+        if(orphan_count.load(std::memory_order_relaxed) == 0 || !orphan_locker.try_lock())
+            return;
+        std::vector<Bag> ready;
+        auto& orphans = Orphans();
+        for(size_t i = 0; i < orphans.size();)
+        {
+            if(orphans[i].epoch + 2 <= e)
+            {
+                ready.push_back(std::move(orphans[i]));
+                if(i + 1 != orphans.size())
+                    orphans[i] = std::move(orphans.back());
+                orphans.pop_back();
+            }
+            else
+                ++i;
+        }
+        orphan_locker.unlock();
+        // deleters run unlocked, they may retire more
+        for(auto& bag : ready)
+            orphan_count.fetch_sub(bag.Free(), std::memory_order_relaxed);
+    }
+
+    // threads may still retire during exit, the list is never destroyed
+    static std::vector<Bag>& Orphans()
+    {
+        static std::vector<Bag>* orphans = new std::vector<Bag>();
+        return *orphans;
+    }
+
+    static inline thread_local bool tl_dead = false;
+
+    static inline std::atomic<uint64_t> global{1};
+    static inline std::atomic<Record*>  records{nullptr};
+    static inline std::atomic<size_t>   orphan_count{0};
+    static inline TTASLock              orphan_locker;
+};
+
+
+#endif // EPOCH_H
@@ -0,0 +1,203 @@
+#pragma once
+
+
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <memory_resource>
+
+// Bump allocator for temporaries that live at most one frame.
+// Allocation moves a pointer, deallocation does nothing, Reset() at the end of the frame takes everything back.
+// When a frame needed more than one block, Reset() replaces them by one block of the total size,
+// so a steady frame loop runs in a single block and does not touch the system allocator.
+// Not thread safe, every thread uses its own arena through Local().
+// Whoever drives a thread's frame resets its arena: CoreSystem::Process() and RenderSystem::Process() at their end,
+// ThredaPool workers after every message. Temporaries do not survive the message or the Process() call that made them,
+// a coroutine must not keep one across co_await.
+class FrameArena
+{
+    struct Block
+    {
+        Block* next;
+        size_t size;
+
+        uintptr_t Begin() { return uintptr_t(this + 1); }
+        uintptr_t End() { return Begin() + size; }
+    };
+
+public:
+    static constexpr size_t DEFAULT_BLOCK = 64 * 1024;
+
+    // position to Rewind() to, for scopes shorter than a frame
+    struct Marker
+    {
+        Block*    block;
+        uintptr_t cur;
+    };
+
+    explicit FrameArena(size_t block_size = DEFAULT_BLOCK) : block_size(block_size) {}
+
+    FrameArena(const FrameArena&)            = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    ~FrameArena() { FreeBlocks(); }
+
+    void* Allocate(size_t size, size_t align = alignof(std::max_align_t))
+    {
+        const uintptr_t p = (cur + align - 1) & ~uintptr_t(align - 1);
+        if(!current || p + size > end)
+            return AllocateSlow(size, align);
+        cur = p + size;
+        return (void*)p;
+    }
+
+    template<typename T>
+    T* AllocateArray(size_t count) { return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T))); }
+
+    Marker Mark() const { return { current, cur }; }
+
+    // gives back everything allocated after the marker was taken
+    void Rewind(Marker marker)
+    {
+        if(!marker.block)
+        {
+            Reset();
+            return;
+        }
+        current = marker.block;
+        cur     = marker.cur;
+        end     = current->End();
+    }
+
+    void Reset()
+    {
+        const size_t used = Used();
+        if(used > high_water)
+            high_water = used;
+        if(first && first->next)
+        {
+            size_t total = 0;
+            for(Block* b = first; b; b = b->next)
+                total += b->size;
+            FreeBlocks();
+            first = NewBlock(total);
+        }
+        current = first;
+        cur     = first ? first->Begin() : 0;
+        end     = first ? first->End() : 0;
+    }
+
+    // bytes handed out since the last Reset(), alignment padding included
+    size_t Used() const
+    {
+        size_t ret = 0;
+        for(Block* b = first; b && current; b = b->next)
+        {
+            if(b == current)
+                return ret + (cur - b->Begin());
+            ret += b->size;
+        }
+        return ret;
+    }
+
+    size_t HighWater() const { return high_water; }
+
+    // blocks taken from the system so far
+    size_t BlockAllocations() const { return block_allocations; }
+
+    static FrameArena& Local()
+    {
+        static thread_local FrameArena arena;
+        return arena;
+    }
+
+private:
+    Block* NewBlock(size_t size)
+    {
+        Block* b = (Block*)::operator new(sizeof(Block) + size);
+        b->next  = nullptr;
+        b->size  = size;
+        ++block_allocations;
+        return b;
+    }
+
+    void FreeBlocks()
+    {
+        while(first)
+        {
+            Block* next = first->next;
+            ::operator delete(first);
+            first = next;
+        }
+        current = nullptr;
+    }
+
+    void* AllocateSlow(size_t size, size_t align)
+    {
+        // blocks after the current one are left from a Rewind()
+        for(Block* b = current ? current->next : first; b; b = b->next)
+        {
+            const uintptr_t p = (b->Begin() + align - 1) & ~uintptr_t(align - 1);
+            if(p + size <= b->End())
+            {
+                current = b;
+                cur     = p + size;
+                end     = b->End();
+                return (void*)p;
+            }
+        }
+
+        const size_t need = size + align;
+        Block* b = NewBlock(need > block_size ? need : block_size);
+        if(current)
+        {
+            b->next       = current->next;
+            current->next = b;
+        }
+        else
+        {
+            b->next = first;
+            first   = b;
+        }
+        current = b;
+        end     = b->End();
+        cur     = b->Begin();
+        return Allocate(size, align);
+    }
+
+    size_t    block_size;
+    Block*    first   = nullptr;
+    Block*    current = nullptr;
+    uintptr_t cur     = 0;
+    uintptr_t end     = 0;
+    size_t    high_water        = 0;
+    size_t    block_allocations = 0;
+};
+
+// std::pmr adapter, containers built on it allocate from the arena and must not outlive the frame.
+// std::pmr::vector<Ref<WObject>> found = world.FindObjectsByTag("enemy", &FrameResource::Local());
+class FrameResource : public std::pmr::memory_resource
+{
+    FrameArena& arena;
+
+public:
+    explicit FrameResource(FrameArena& arena) : arena(arena) {}
+
+    FrameArena& Arena() { return arena; }
+
+    static FrameResource& Local()
+    {
+        static thread_local FrameResource resource(FrameArena::Local());
+        return resource;
+    }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override { return arena.Allocate(bytes, alignment); }
+    void  do_deallocate(void*, size_t, size_t) override {}
+    bool  do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+
+#endif // FRAME_ARENA_H
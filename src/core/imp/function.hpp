@@ -1,9 +1,31 @@
 #pragma once
 
 #include <type_traits>
+#include <utility>
+#include <functional>
+#include <cstddef>
+#include <new>
+#include "object_pool.h"
 template<typename... _Signature>
 struct srv_function;
 
+// tag of the move-only variant
+struct srv_move_only {};
+
+// Same as srv_function but never copied, so it also takes move-only callables.
+// The pool, TaskJobSystem and TaskGraph keep the callables of their messages in it.
+template<typename _Signature>
+using srv_unique_function = srv_function<_Signature, srv_move_only>;
+
+template<typename Ret, typename... Vars>
+struct srv_function_vtable
+{
+    Ret  (*invoke)(void*, Vars&&...);
+    void (*copy)(void* dst, const void* src); // null for callables that can not be copied
+    void (*move)(void* dst, void* src) noexcept; // leaves src destroyed
+    void (*destroy)(void*) noexcept;
+};
+
 constexpr static size_t srv_function_GETID(const void* v, int size = 0)
 {
     unsigned int hash = 0x811c9dc5;
@@ -32,92 +54,215 @@ constexpr static size_t srv_function_GETID(const void* v, int size = 0)
     return (hash | (size_t(h1) << 32)) & 0xFFFFFFFFFFFFFFFEULL | 0x1ULL;
 }
 
-template<typename Ret, typename... Vars> 
-struct srv_function<Ret(Vars...)>
+template<typename Ret, typename... Vars, typename... Opt> 
+struct srv_function<Ret(Vars...), Opt...>
 {
-    template<typename T, typename... ARGS>
-    struct Callable{
-        virtual size_t gid() = 0;
-        virtual T doit(ARGS...) = 0;
-        virtual Callable<T, ARGS...>* copy() const = 0;
-    };
+    // Callables up to INLINE_SIZE bytes that move without throwing are stored in place,
+    // bigger ones in a box from ObjectPool. The whole object is one cache line.
+    static constexpr size_t INLINE_SIZE = 48;
 
-    template<typename Call, typename T, typename... ARGS>
-    struct ImplCallable : public Callable<T, ARGS...> {
-        static_assert(std::is_invocable_r<T, std::decay_t<Call>&, ARGS...>::value, "Uncorrect Caller");
-
-        ImplCallable(Call _val) : val(_val) {}
-        ~ImplCallable() {if(callable) delete callable; }
-        Call val;
-        virtual size_t gid()
-        {
-            if constexpr (std::is_pointer_v<std::decay_t<Call>>)
-            {
-                return srv_function_GETID(&val, sizeof(val)) | 0x1ULL;
-            }
-            else
-            {
-                static size_t stat = (size_t)(&stat);
-                return srv_function_GETID(&stat, sizeof(stat)) | 0x1ULL;
-            }
-        };
-        virtual T doit(ARGS... args) override { 
-            if constexpr (sizeof...(ARGS))
-            {
-                if constexpr (std::is_same_v<T, void>)
-                    val(args...); 
-                else
-                    return val(args...); 
-            }
-            else
-            {
-                if constexpr (std::is_same_v<T, void>)
-                    val(); 
-                else
-                    return val(); 
-            }
-        }
-
-        virtual Callable<T, ARGS...>* copy() const override { 
-            return new ImplCallable<Call, T, ARGS...>(val);
-        }
-    };
-    Callable<Ret, Vars...>* callable = nullptr;
+    // srv_function copies, srv_unique_function does not
+    static constexpr bool COPYABLE = sizeof...(Opt) == 0;
 
     template<typename Call>
     using check_callable = std::enable_if_t<std::conjunction<
         std::is_invocable_r<Ret, std::decay_t<Call>&, Vars...>
     >::value>;
 
-    srv_function() {
-        callable = nullptr;
+    // both variants of the signature are taken by the copy and move constructors, never wrapped as callables
+    template<typename C>
+    static constexpr bool IsSelf = std::is_same_v<C, srv_function<Ret(Vars...)>> || std::is_same_v<C, srv_function<Ret(Vars...), srv_move_only>>;
+
+    srv_function() {}
+
+    srv_function(std::nullptr_t) {}
+
+    template<typename Call, typename Check = check_callable<Call>, typename = std::enable_if_t<!IsSelf<std::decay_t<Call>>>>
+    srv_function(Call&& val) {
+        using C = std::decay_t<Call>;
+        static_assert(!COPYABLE || std::is_copy_constructible_v<C>, "srv_function copies its callable, use srv_unique_function for move-only ones");
+        if constexpr (std::is_pointer_v<C> || std::is_member_pointer_v<C>)
+        {
+            C ptr = val;
+            if(ptr == nullptr)
+                return;
+        }
+        if constexpr (Inline<C>)
+            new(storage) C(std::forward<Call>(val));
+        else
+            *reinterpret_cast<Box<C>**>(storage) = new Box<C>(std::forward<Call>(val));
+        vtable = &Table<C>::table;
+        id = TypeId<C>(val);
+    }
+
+    srv_function(const srv_function& val) requires COPYABLE {
+        Copy(val);
+    }
+
+    srv_function(srv_function&& val) noexcept {
+        Take(val);
+    }
+
+    // a copyable function is taken over by a move-only one without wrapping it again
+    srv_function(const srv_function<Ret(Vars...)>& val) requires (!COPYABLE) {
+        Copy(val);
+    }
+
+    srv_function(srv_function<Ret(Vars...)>&& val) noexcept requires (!COPYABLE) {
+        Take(val);
+    }
+
+    ~srv_function() {
+        if(vtable)
+            vtable->destroy(storage);
     }
 
-    template<typename Call, typename Check = check_callable<Call>>
-    srv_function(Call val) {
-        callable = new ImplCallable<Call, Ret, Vars...>(val);
+    srv_function& operator=(const srv_function& val) requires COPYABLE {
+        if(this != &val)
+            *this = srv_function(val);
+        return *this;
     }
 
-    srv_function(nullptr_t) {
-        callable = nullptr;
+    srv_function& operator=(srv_function&& val) noexcept {
+        if(this != &val)
+        {
+            if(vtable)
+                vtable->destroy(storage);
+            vtable = nullptr;
+            id = 0;
+            Take(val);
+        }
+        return *this;
     }
 
-    srv_function(const srv_function<Ret(Vars...)>& val) {
-        callable = val.callable->copy();
+    // cached at construction, 0 when empty
+    size_t tid() const { return id; }
+
+    Ret operator()(Vars... args) const { 
+        return vtable->invoke(storage, std::forward<Vars>(args)...); 
     }
 
-    size_t tid() const { return callable ? callable->gid() : 0; }
+    operator bool() const { return vtable; }
+    template<typename... _Fty2>
+    bool operator ==(const srv_function<_Fty2...>& other) const { return tid() == other.tid(); }
+    template<typename... _Fty2>
+    bool operator !=(const srv_function<_Fty2...>& other) const { return tid() != other.tid(); }
 
-    Ret operator()(Vars... args) { 
-        if constexpr (std::is_same_v<Ret, void>)
-            callable->doit(args...); 
+private:
+    template<typename... _Fty2>
+    friend struct srv_function;
+
+    using VTable = srv_function_vtable<Ret, Vars...>;
+
+    template<typename C>
+    struct Box : public PoolObject
+    {
+        template<typename U>
+        Box(U&& val) : val(std::forward<U>(val)) {}
+
+        C val;
+    };
+
+    template<typename C>
+    static constexpr bool Inline = sizeof(C) <= INLINE_SIZE && alignof(C) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<C>;
+
+    template<typename C>
+    struct Table
+    {
+        static C* Get(void* s)
+        {
+            if constexpr (Inline<C>)
+                return std::launder(reinterpret_cast<C*>(s));
+            else
+                return &(*reinterpret_cast<Box<C>**>(s))->val;
+        }
+
+        static Ret Invoke(void* s, Vars&&... args)
+        {
+            if constexpr (std::is_same_v<Ret, void>)
+                std::invoke(*Get(s), std::forward<Vars>(args)...);
+            else
+                return std::invoke(*Get(s), std::forward<Vars>(args)...);
+        }
+
+        static void Copy(void* dst, const void* src)
+        {
+            if constexpr (Inline<C>)
+                new(dst) C(*Get(const_cast<void*>(src)));
+            else
+                *reinterpret_cast<Box<C>**>(dst) = new Box<C>(*Get(const_cast<void*>(src)));
+        }
+
+        static constexpr auto CopyEntry()
+        {
+            if constexpr (std::is_copy_constructible_v<C>)
+                return &Copy;
+            else
+                return decltype(&Copy)(nullptr);
+        }
+
+        static void Move(void* dst, void* src) noexcept
+        {
+            if constexpr (Inline<C>)
+            {
+                new(dst) C(std::move(*Get(src)));
+                Get(src)->~C();
+            }
+            else
+                *reinterpret_cast<Box<C>**>(dst) = *reinterpret_cast<Box<C>**>(src);
+        }
+
+        static void Destroy(void* s) noexcept
+        {
+            if constexpr (Inline<C>)
+                Get(s)->~C();
+            else
+                delete *reinterpret_cast<Box<C>**>(s);
+        }
+
+        static constexpr VTable table = { &Invoke, CopyEntry(), &Move, &Destroy };
+    };
+
+    // function pointers are told apart by value, everything else by type
+    template<typename C>
+    static size_t TypeId(const C& val)
+    {
+        if constexpr (std::is_pointer_v<C>)
+        {
+            return srv_function_GETID(&val, sizeof(val)) | 0x1ULL;
+        }
         else
-            return callable->doit(args...); 
+        {
+            static size_t stat = (size_t)(&stat);
+            static const size_t id = srv_function_GETID(&stat, sizeof(stat)) | 0x1ULL;
+            return id;
+        }
+    }
+
+    template<typename... _Fty2>
+    void Copy(const srv_function<_Fty2...>& val)
+    {
+        if(val.vtable)
+        {
+            val.vtable->copy(storage, val.storage);
+            vtable = val.vtable;
+            id = val.id;
+        }
+    }
+
+    template<typename... _Fty2>
+    void Take(srv_function<_Fty2...>& val) noexcept
+    {
+        if(!val.vtable)
+            return;
+        val.vtable->move(storage, val.storage);
+        vtable = val.vtable;
+        id = val.id;
+        val.vtable = nullptr;
+        val.id = 0;
     }
 
-    operator bool() { return callable; }
-    template<typename _Fty2>
-    bool operator ==(const srv_function<_Fty2>& other) { return tid() == other.tid(); }
-    template<typename _Fty2>
-    bool operator !=(const srv_function<_Fty2>& other) { return tid() != other.tid(); }
+    const VTable* vtable = nullptr;
+    size_t id = 0;
+    alignas(std::max_align_t) mutable unsigned char storage[INLINE_SIZE];
 };
\ No newline at end of file
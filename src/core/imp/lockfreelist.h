@@ -4,161 +4,94 @@
 #ifndef LOCKFREELIST_H
 #define LOCKFREELIST_H
 #include <vector>
-#include <mutex>
+#include <atomic>
 #include "spinlocker.h"
+#include "locks.h"
+#include "epoch.h"
+#include "object_pool.h"
 
 
+// Doubly linked list with lock-free iteration. Writers are serialized by list_locker,
+// iterators walk the list inside an Epoch guard and never block.
+// A removed node is unlinked at once and freed through Epoch once no iterator can stand on it.
+// The iterator locks the node it stands on and skips nodes locked by other threads.
 template<typename T>
-// typedef int T;
 class LockFreeList
 {
 public:
 
-    struct ListItem : public SpinLocker {
+    struct ListItem final : public SpinLocker, public PoolObject {
     private:
-        bool need_delete = false;
-        bool need_remove = false;
-        bool ready_remove = false;
+        friend class LockFreeList;
 
-        SpinLocker edit_lock;
+        std::atomic<ListItem*> m_next{nullptr};
+        std::atomic<ListItem*> m_prew{nullptr};
+        std::atomic<bool>      removed{false};
 
-        ListItem* m_next;
-        ListItem* m_next_del;
-        ListItem* m_prew;
+        ~ListItem() { }
 
-        virtual void onUnlock() override 
-        {
-            if(need_delete)
-                delete this;
-        }
-        
     public:
-        ListItem(T val) : SpinLocker(), val(val), m_next(nullptr), m_prew(nullptr), m_next_del(nullptr) {}
+        ListItem(T val) : SpinLocker(), val(val) {}
 
         T val;
 
-        void SetNext(ListItem* val)
-        {
-            edit_lock.lock();
-            m_next = val;
-            edit_lock.unlock();
-        }
-
-        void SetPrew(ListItem* val)
-        {
-            edit_lock.lock();
-            m_prew = val;
-            edit_lock.unlock();
-        }
-
-        void SetNextDel(ListItem* val)
-        {
-            edit_lock.lock();
-            m_next_del = val;
-            edit_lock.unlock();
-        }
-
         ListItem* Next()
         {
-            return m_next;
+            return m_next.load(std::memory_order_acquire);
         }
 
         ListItem* Prew()
         {
-            return m_prew;
-        }
-
-        ListItem* NextDel()
-        {
-            return m_next_del;
+            return m_prew.load(std::memory_order_acquire);
         }
 
         operator T&()  { return val; }
         operator const T&() const { return val; }
 
-        void SetDeleted()
+        bool Removed()
         {
-            edit_lock.lock();
-            need_delete = true;
-            edit_lock.unlock();
-        }
-
-        void SetNeedRemove()
-        {
-            edit_lock.lock();
-            need_remove = true;
-            edit_lock.unlock();
-        }
-
-        void SetReadyRemove()
-        {
-            edit_lock.lock();
-            ready_remove = true;
-            edit_lock.unlock();
-        }
-
-        bool ReadyRemove()
-        {
-            return ready_remove;
-        }
-
-        bool NeedRemove()
-        {
-            return need_remove;
-        }
-
-        bool Deleted()
-        {
-            return need_delete;
+            return removed.load(std::memory_order_acquire);
         }
 
         bool Valid()
         {
-            return !ready_remove && !need_remove && !need_delete;
+            return !Removed();
         }
-
-        
-    private:
-        ~ListItem() { }
     };
 
-    struct Iterator { 
+    struct Iterator {
 
         void __upd__()
         {
-            while(val) { 
-                while(val && (val->Deleted() || val->ReadyRemove()))
-                    val = val->Next();
-                if(!val)
-                    return;
-                if(val->try_lock()) 
+            while(val)
+            {
+                if(!val->Removed() && val->try_lock())
                 {
-                    if(val->NeedRemove())
-                    {
-                        val->SetReadyRemove();
-                        val->unlock();
-                    }
-                    else
-                        return; 
+                    if(!val->Removed())
+                        return;
+                    val->unlock();
                 }
-                val = val->Next(); 
+                val = val->Next();
             }
         }
 
-        Iterator(LockFreeList* p, ListItem* _) : val(_), p(p) { 
+        // the guard is entered before the first node is loaded
+        Iterator(LockFreeList* p) : p(p), val(p->m_first.load(std::memory_order_acquire)) {
+            __upd__();
+        };
+        Iterator(LockFreeList* p, ListItem* _) : p(p), val(_) {
             __upd__();
         };
+        Epoch::Guard guard;
         LockFreeList* p;
         ~Iterator() { }
         ListItem* val;
         Iterator& operator++() {
             auto old = val;
             val = val->Next();
-            if(old->NeedRemove())
-                old->SetReadyRemove();
             old->unlock();
             __upd__();
-            return *this; 
+            return *this;
         }
         bool operator!=(const Iterator & other) const { return val != other.val;  }
         bool operator==(const Iterator & other) const { return val == other.val;  }
@@ -174,7 +107,7 @@ public:
         if(first)
             AddNode(first);
     }
-    
+
     LockFreeList(std::initializer_list<T> in) {
         for(auto& i: in)
             AddNode(i);
@@ -187,16 +120,9 @@ public:
 
     ListItem* AddNode(T n) {
         ListItem* node = new ListItem(n);
-        if(m_last)
-        {
-            node->SetPrew(m_last);
-            m_last->SetNext(node);
-            m_last = node;
-        }
-        else
-        {
-            m_last = m_first = node;
-        }
+        list_locker.lock();
+        Link(node);
+        list_locker.unlock();
         return node;
     }
 
@@ -205,111 +131,93 @@ public:
         nodes.reserve(ns.size());
         for(const auto& n : ns)
             nodes.push_back(new ListItem(n));
-        list_locker.lock(1);
+        list_locker.lock();
         for(auto node : nodes)
-        {
-            if(m_last)
-            {
-                node->SetPrew(m_last);
-                m_last->SetNext(node);
-                m_last = node;
-            }
-            else
-            {
-                m_last = m_first = node;
-            }
-        }
+            Link(node);
         list_locker.unlock();
         return nodes;
     }
 
     bool RemoveNode(T n) {
-        ListItem* c = m_first;
-        list_locker.lock(1);
-        while(c)
-        {
-            if(n == c->val)
-            {
-                list_locker.unlock();
-                return RemoveNode(c);
-            }
-            c = c->Next();
-        }
-
+        list_locker.lock();
+        ListItem* c = m_first.load(std::memory_order_relaxed);
+        while(c && !(n == c->val))
+            c = c->m_next.load(std::memory_order_relaxed);
+        const bool ret = c && Unlink(c);
         list_locker.unlock();
-        return false;
+        if(ret)
+            Epoch::Retire(c, &DeleteNode);
+        return ret;
     };
 
+    // false when the node was removed already
     bool RemoveNode(ListItem* n) {
         if(!n)
             return false;
-        list_locker.lock(1);
-        n->lock();
-        
-        auto prew = n->Prew();
-        auto next = n->Next();
-
-        if(prew)
-            prew->SetNext(next);
-        if(next)
-            next->SetPrew(prew);
-
-        if(m_first == n)
-            m_first = next;
-        if(m_last == n)
-            m_last = prew;
-        n->SetNextDel(m_delete_list);
-        m_delete_list = n;
-
-        n->SetNeedRemove();
-
-        n->unlock();
+        list_locker.lock();
+        const bool ret = Unlink(n);
         list_locker.unlock();
-        return true;
+        if(ret)
+            Epoch::Retire(n, &DeleteNode);
+        return ret;
     };
 
     bool Clear() {
-        list_locker.lock(1);
-        ListItem* c = m_first;
-        while(c)
-        {
-            auto o = c;
-            c = c->Next();
-            RemoveNode(o);
-        }
-
+        std::vector<ListItem*> removed;
+        list_locker.lock();
+        for(ListItem* c = m_first.load(std::memory_order_relaxed); c; c = c->m_next.load(std::memory_order_relaxed))
+            removed.push_back(c);
+        for(auto c : removed)
+            Unlink(c);
         list_locker.unlock();
 
-        CearDeleted();
+        for(auto c : removed)
+            Epoch::Retire(c, &DeleteNode);
         return true;
     };
 
-    Iterator begin() { CearDeleted(); return Iterator(this, m_first); }
+    Iterator begin() { return Iterator(this); }
     Iterator end()   { return Iterator(this, nullptr); }
 
-    // ListItemIteratorHelper ii = ListItemIteratorHelper(this);
-
 private:
 
-    void CearDeleted() {
-        if(list_locker.try_lock())
-        {
-            while(m_delete_list && m_delete_list->ReadyRemove() && m_delete_list->try_lock())
-            {
-                ListItem* s = m_delete_list;
-                m_delete_list = m_delete_list->NextDel();
-                s->SetDeleted();
-                s->unlock();
-            }
-            list_locker.unlock();
-        }
+    static void DeleteNode(void* p) { delete static_cast<ListItem*>(p); }
+
+    // list_locker held
+    void Link(ListItem* node)
+    {
+        node->m_prew.store(m_last, std::memory_order_relaxed);
+        if(m_last)
+            m_last->m_next.store(node, std::memory_order_release);
+        else
+            m_first.store(node, std::memory_order_release);
+        m_last = node;
     }
 
-    ListItem* m_delete_list = nullptr;
+    // list_locker held. The node keeps its next pointer, an iterator standing on it can still move on.
+    bool Unlink(ListItem* n)
+    {
+        if(n->removed.load(std::memory_order_relaxed))
+            return false;
+        n->removed.store(true, std::memory_order_release);
+
+        auto prew = n->m_prew.load(std::memory_order_relaxed);
+        auto next = n->m_next.load(std::memory_order_relaxed);
+
+        if(prew)
+            prew->m_next.store(next, std::memory_order_release);
+        else
+            m_first.store(next, std::memory_order_release);
+        if(next)
+            next->m_prew.store(prew, std::memory_order_release);
+        else
+            m_last = prew;
+        return true;
+    }
 
-    ListItem* m_first = nullptr;
-    ListItem* m_last = nullptr;
-    SpinLocker list_locker;
+    std::atomic<ListItem*> m_first{nullptr};
+    ListItem*              m_last = nullptr;
+    TTASLock               list_locker;
 };
 
 
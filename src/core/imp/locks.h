@@ -0,0 +1,174 @@
+#pragma once
+
+
+#ifndef LOCKS_H
+#define LOCKS_H
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include "parking.h"
+
+// Spin locks for short critical sections. Every lock fills a whole cache line, so arrays of locks
+// and locks placed next to hot data do not false share. None of them is re-entrant.
+// TTASLock and TicketLock are Lockable (std::lock_guard, std::unique_lock, std::scoped_lock),
+// RWSpinLock is also SharedLockable (std::shared_lock).
+// SpinLocker stays for code that needs re-entrancy or the onLock/onUnlock hooks.
+
+// exponential backoff: pause 1, 2, 4 ... 64 times, then give the core away
+struct SpinBackoff
+{
+    uint32_t spins = 1;
+
+    void Pause()
+    {
+        if(spins <= 64)
+        {
+            for(uint32_t i = 0; i < spins; ++i)
+                CpuRelax();
+            spins <<= 1;
+        }
+        else
+            std::this_thread::yield();
+    }
+};
+
+// test and test-and-set, waiters spin on a plain load and only try the exchange when the lock looks free
+class alignas(64) TTASLock
+{
+    std::atomic<bool> locked{false};
+
+public:
+    TTASLock() = default;
+    TTASLock(const TTASLock&)            = delete;
+    TTASLock& operator=(const TTASLock&) = delete;
+
+    bool try_lock()
+    {
+        return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void lock()
+    {
+        for(SpinBackoff backoff;;)
+        {
+            if(!locked.exchange(true, std::memory_order_acquire))
+                return;
+            while(locked.load(std::memory_order_relaxed))
+                backoff.Pause();
+        }
+    }
+
+    void unlock() { locked.store(false, std::memory_order_release); }
+
+    bool is_locked() const { return locked.load(std::memory_order_relaxed); }
+};
+
+// FIFO lock, threads enter in the order they called lock(). A waiter yields while more than two threads
+// are ahead of it and backs off otherwise, a preempted thread ahead in the line stalls everybody behind it.
+// When threads outnumber cores every handoff costs a context switch, TTASLock is the better choice there.
+class alignas(64) TicketLock
+{
+    std::atomic<uint32_t> next{0};
+    std::atomic<uint32_t> serving{0};
+
+public:
+    TicketLock() = default;
+    TicketLock(const TicketLock&)            = delete;
+    TicketLock& operator=(const TicketLock&) = delete;
+
+    bool try_lock()
+    {
+        uint32_t s = serving.load(std::memory_order_acquire);
+        uint32_t expected = s;
+        return next.compare_exchange_strong(expected, s + 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void lock()
+    {
+        const uint32_t ticket = next.fetch_add(1, std::memory_order_relaxed);
+        for(SpinBackoff backoff;;)
+        {
+            const uint32_t s = serving.load(std::memory_order_acquire);
+            if(s == ticket)
+                return;
+            if(ticket - s > 2)
+                std::this_thread::yield();
+            else
+                backoff.Pause();
+        }
+    }
+
+    // only the owner writes serving
+    void unlock() { serving.store(serving.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    bool is_locked() const { return next.load(std::memory_order_relaxed) != serving.load(std::memory_order_relaxed); }
+};
+
+// Reader writer spin lock. A waiting writer sets PENDING, new readers hold back until it got the lock,
+// so a steady stream of readers does not starve writers.
+class alignas(64) RWSpinLock
+{
+    static constexpr uint32_t WRITER  = 1u << 31;
+    static constexpr uint32_t PENDING = 1u << 30;
+
+    std::atomic<uint32_t> state{0}; // WRITER, PENDING and the reader count
+
+public:
+    RWSpinLock() = default;
+    RWSpinLock(const RWSpinLock&)            = delete;
+    RWSpinLock& operator=(const RWSpinLock&) = delete;
+
+    bool try_lock()
+    {
+        uint32_t s = state.load(std::memory_order_relaxed);
+        return (s & ~PENDING) == 0 && state.compare_exchange_strong(s, WRITER, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void lock()
+    {
+        for(SpinBackoff backoff;;)
+        {
+            uint32_t s = state.load(std::memory_order_relaxed);
+            if((s & ~PENDING) == 0)
+            {
+                // taking the lock clears PENDING, other waiting writers set it again
+                if(state.compare_exchange_weak(s, WRITER, std::memory_order_acquire, std::memory_order_relaxed))
+                    return;
+                continue;
+            }
+            if(!(s & PENDING))
+                state.fetch_or(PENDING, std::memory_order_relaxed);
+            backoff.Pause();
+        }
+    }
+
+    void unlock() { state.fetch_and(~WRITER, std::memory_order_release); }
+
+    bool try_lock_shared()
+    {
+        uint32_t s = state.load(std::memory_order_relaxed);
+        return !(s & (WRITER | PENDING)) && state.compare_exchange_strong(s, s + 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void lock_shared()
+    {
+        for(SpinBackoff backoff;;)
+        {
+            uint32_t s = state.load(std::memory_order_relaxed);
+            if(!(s & (WRITER | PENDING)))
+            {
+                if(state.compare_exchange_weak(s, s + 1, std::memory_order_acquire, std::memory_order_relaxed))
+                    return;
+                continue;
+            }
+            backoff.Pause();
+        }
+    }
+
+    void unlock_shared() { state.fetch_sub(1, std::memory_order_release); }
+
+    bool is_locked() const { return state.load(std::memory_order_relaxed) & ~PENDING; }
+};
+
+
+#endif // LOCKS_H
@@ -0,0 +1,101 @@
+#include "mapped_file.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(!mapping)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!view)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    data            = (const uint8_t*)view;
+    size            = size_t(file_size.QuadPart);
+    handles.file    = file;
+    handles.mapping = mapping;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if(data)
+        UnmapViewOfFile(data);
+    if(handles.mapping)
+        CloseHandle(handles.mapping);
+    if(handles.file)
+        CloseHandle(handles.file);
+    data    = nullptr;
+    size    = 0;
+    handles = {};
+}
+
+#else
+
+bool MappedFile::Open(const std::string& path)
+{
+    Close();
+    const int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file alive
+    close(fd);
+    if(view == MAP_FAILED)
+        return false;
+
+    data = (const uint8_t*)view;
+    size = size_t(st.st_size);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if(data)
+        munmap((void*)data, size);
+    data    = nullptr;
+    size    = 0;
+    handles = {};
+}
+
+#endif
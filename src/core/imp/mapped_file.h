@@ -0,0 +1,60 @@
+#pragma once
+
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Read-only mapping of a whole file. Nothing is read up front, pages come from the page cache on first touch.
+// The mapping starts on a page boundary, data at 64 byte aligned offsets in the file is 64 byte aligned in memory.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& path) { Open(path); }
+
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept { *this = static_cast<MappedFile&&>(other); }
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        if(this != &other)
+        {
+            Close();
+            data    = other.data;
+            size    = other.size;
+            handles = other.handles;
+            other.data    = nullptr;
+            other.size    = 0;
+            other.handles = {};
+        }
+        return *this;
+    }
+
+    ~MappedFile() { Close(); }
+
+    // false when the file can not be opened or is empty
+    bool Open(const std::string& path);
+    void Close();
+
+    bool           IsOpen() const { return data != nullptr; }
+    const uint8_t* Data() const { return data; }
+    size_t         Size() const { return size; }
+
+private:
+    struct Handles
+    {
+        void* file    = nullptr; // HANDLE of the file and of the mapping object, unused on posix
+        void* mapping = nullptr;
+    };
+
+    const uint8_t* data = nullptr;
+    size_t         size = 0;
+    Handles        handles;
+};
+
+
+#endif // MAPPED_FILE_H
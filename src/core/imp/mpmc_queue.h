@@ -0,0 +1,315 @@
+#pragma once
+
+
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include "locks.h"
+
+// Bounded multi producer multi consumer ring (D. Vyukov).
+// Every cell carries a sequence number, producers and consumers claim cells with one CAS
+// on their own position and never write the position of the other side.
+template<typename T>
+class MPMCQueue
+{
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* Ptr() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
+
+    // set in enqueue_pos by Close(), pushes fail from then on
+    static constexpr size_t CLOSED = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+    Cell*  cells;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+
+public:
+    MPMCQueue(size_t capacity = 1024)
+    {
+        size_t c = 2;
+        while(c < capacity) c <<= 1;
+        cells = new Cell[c];
+        mask  = c - 1;
+        Reset();
+    }
+
+    MPMCQueue(const MPMCQueue&)            = delete;
+    MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+    ~MPMCQueue()
+    {
+        Clear();
+        delete[] cells;
+    }
+
+    template<typename U>
+    bool TryPush(U&& val)
+    {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            if(pos & CLOSED)
+                return false;
+            Cell&          cell = cells[pos & mask];
+            const size_t   seq  = cell.seq.load(std::memory_order_acquire);
+            const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+            if(diff == 0)
+            {
+                if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    new(cell.storage) T(std::forward<U>(val));
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(diff < 0)
+                return false; // full
+            else
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // false when empty or when the next value is claimed but not written yet
+    bool TryPop(T& out)
+    {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            Cell&          cell = cells[pos & mask];
+            const size_t   seq  = cell.seq.load(std::memory_order_acquire);
+            const intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+            if(diff == 0)
+            {
+                if(dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    T* p = cell.Ptr();
+                    out  = std::move(*p);
+                    p->~T();
+                    cell.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if(diff < 0)
+                return false;
+            else
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    size_t Capacity() const { return mask + 1; }
+
+    size_t SizeApprox() const
+    {
+        const size_t e = enqueue_pos.load(std::memory_order_relaxed) & ~CLOSED;
+        const size_t d = dequeue_pos.load(std::memory_order_relaxed);
+        return e > d ? e - d : 0;
+    }
+
+    bool EmptyApprox() const { return SizeApprox() == 0; }
+
+    // no more pushes, used by SegmentedMPMCQueue to seal a full segment
+    void Close() { enqueue_pos.fetch_or(CLOSED); }
+
+    // closed and every claimed cell taken by a consumer
+    bool Drained() const
+    {
+        const size_t e = enqueue_pos.load(std::memory_order_acquire);
+        return (e & CLOSED) && dequeue_pos.load(std::memory_order_acquire) == (e & ~CLOSED);
+    }
+
+    // not thread safe
+    void Clear()
+    {
+        const size_t e = enqueue_pos.load() & ~CLOSED;
+        for(size_t pos = dequeue_pos.load(); pos < e; ++pos)
+            cells[pos & mask].Ptr()->~T();
+        dequeue_pos.store(e);
+    }
+
+    // not thread safe, the queue must be empty
+    void Reset()
+    {
+        for(size_t i = 0; i <= mask; ++i)
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        enqueue_pos.store(0, std::memory_order_relaxed);
+        dequeue_pos.store(0, std::memory_order_release);
+    }
+};
+
+// Unbounded MPMC queue, a linked list of MPMCQueue segments.
+// A full segment is closed and producers continue in a new one, consumers move on once a closed segment is drained.
+// Threads hold a reference while they work on a segment. A drained segment returns to the free list
+// of the queue when its last reference is dropped, memory is given back only when the queue dies.
+template<typename T>
+class SegmentedMPMCQueue
+{
+    struct Segment
+    {
+        Segment(size_t capacity) : ring(capacity) {}
+
+        MPMCQueue<T>          ring;
+        std::atomic<Segment*> next{nullptr};
+        std::atomic<uint32_t> state{0}; // references and RETIRED
+        Segment*              free_next = nullptr;
+    };
+
+    static constexpr uint32_t RETIRED = 1u << 31;
+
+    alignas(64) std::atomic<Segment*> head;
+    alignas(64) std::atomic<Segment*> tail;
+
+    size_t     segment_size;
+    TTASLock   free_locker;
+    Segment*   free_list = nullptr;
+
+    // segments are never freed while the queue lives, so a stale reference count bump is harmless
+    // and the second load tells whether the segment is still where we found it
+    Segment* Acquire(std::atomic<Segment*>& at)
+    {
+        for(;;)
+        {
+            Segment* s = at.load();
+            s->state.fetch_add(1);
+            if(at.load() == s)
+                return s;
+            Drop(s);
+        }
+    }
+
+    void Drop(Segment* s)
+    {
+        if(s->state.fetch_sub(1) - 1 != RETIRED)
+            return;
+        // only one thread wins the segment, even if a stale reference came and went meanwhile
+        uint32_t expected = RETIRED;
+        if(!s->state.compare_exchange_strong(expected, 0))
+            return;
+        s->ring.Reset();
+        s->next.store(nullptr);
+        free_locker.lock();
+        s->free_next = free_list;
+        free_list    = s;
+        free_locker.unlock();
+    }
+
+    Segment* NewSegment()
+    {
+        free_locker.lock();
+        Segment* s = free_list;
+        if(s)
+            free_list = s->free_next;
+        free_locker.unlock();
+        return s ? s : new Segment(segment_size);
+    }
+
+    void FreeSegment(Segment* s)
+    {
+        free_locker.lock();
+        s->free_next = free_list;
+        free_list    = s;
+        free_locker.unlock();
+    }
+
+public:
+    SegmentedMPMCQueue(size_t segment_size = 1024) : segment_size(segment_size)
+    {
+        Segment* s = new Segment(segment_size);
+        head.store(s);
+        tail.store(s);
+    }
+
+    SegmentedMPMCQueue(const SegmentedMPMCQueue&)            = delete;
+    SegmentedMPMCQueue& operator=(const SegmentedMPMCQueue&) = delete;
+
+    ~SegmentedMPMCQueue()
+    {
+        Segment* s = head.load();
+        while(s)
+        {
+            Segment* next = s->next.load();
+            delete s;
+            s = next;
+        }
+        while(free_list)
+        {
+            Segment* next = free_list->free_next;
+            delete free_list;
+            free_list = next;
+        }
+    }
+
+    template<typename U>
+    void Push(U&& val)
+    {
+        for(;;)
+        {
+            Segment* t = Acquire(tail);
+            // TryPush moves from val only on success
+            if(t->ring.TryPush(std::forward<U>(val)))
+            {
+                Drop(t);
+                return;
+            }
+            t->ring.Close();
+            Segment* next = t->next.load();
+            if(!next)
+            {
+                Segment* fresh = NewSegment();
+                if(t->next.compare_exchange_strong(next, fresh))
+                    next = fresh;
+                else
+                    FreeSegment(fresh);
+            }
+            Segment* expected = t;
+            tail.compare_exchange_strong(expected, next);
+            Drop(t);
+        }
+    }
+
+    bool TryPop(T& out)
+    {
+        for(;;)
+        {
+            Segment* h = Acquire(head);
+            if(h->ring.TryPop(out))
+            {
+                Drop(h);
+                return true;
+            }
+            Segment* next = h->next.load();
+            if(!next || !h->ring.Drained())
+            {
+                Drop(h);
+                return false;
+            }
+            // tail must never stay behind head
+            Segment* expected = h;
+            tail.compare_exchange_strong(expected, next);
+            expected = h;
+            if(head.compare_exchange_strong(expected, next))
+                h->state.fetch_or(RETIRED);
+            Drop(h);
+        }
+    }
+
+    bool EmptyApprox()
+    {
+        Segment* h     = Acquire(head);
+        const bool ret = h->ring.EmptyApprox() && !h->next.load();
+        Drop(h);
+        return ret;
+    }
+};
+
+
+#endif // MPMC_QUEUE_H
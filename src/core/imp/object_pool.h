@@ -0,0 +1,257 @@
+#pragma once
+
+
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include "locks.h"
+
+// Size class allocator for small short lived objects (messages, response data, list nodes, callables).
+// Every thread keeps a free list per size class. Overfull lists go to a shared depot in batches,
+// so blocks freed by a worker come back to the thread that sends the next message.
+// Blocks are carved from slabs, slabs are never returned to the system.
+class ObjectPool
+{
+public:
+    static constexpr size_t GRANULE   = 16;
+    static constexpr size_t MAX_SIZE  = 512;
+    static constexpr size_t CLASSES   = MAX_SIZE / GRANULE;
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+    static constexpr uint32_t BATCH   = 64;
+
+    struct Stats
+    {
+        size_t heap_allocs; // slabs and oversized blocks taken from the system
+        size_t heap_frees;  // oversized blocks given back
+        size_t slab_bytes;
+    };
+
+    static Stats GetStats()
+    {
+        return { heap_allocs.load(std::memory_order_relaxed), heap_frees.load(std::memory_order_relaxed), slab_bytes.load(std::memory_order_relaxed) };
+    }
+
+    static void* Allocate(size_t size)
+    {
+        if (size == 0)
+            size = 1;
+        if (size > MAX_SIZE)
+        {
+            heap_allocs.fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(size);
+        }
+        const size_t c = Class(size);
+        if (tl_dead)
+            return GetDepot().Take(c);
+
+        Cache& cache = LocalCache();
+        if (!cache.head[c])
+            cache.Refill(c);
+        FreeNode* n   = cache.head[c];
+        cache.head[c] = n->next;
+        --cache.count[c];
+        return n;
+    }
+
+    static void Deallocate(void* p, size_t size)
+    {
+        if (!p)
+            return;
+        if (size == 0)
+            size = 1;
+        if (size > MAX_SIZE)
+        {
+            heap_frees.fetch_add(1, std::memory_order_relaxed);
+            ::operator delete(p);
+            return;
+        }
+        const size_t c = Class(size);
+        FreeNode*    n = (FreeNode*)p;
+        if (tl_dead)
+        {
+            n->next = nullptr;
+            GetDepot().Put(c, n, n, 1);
+            return;
+        }
+
+        Cache& cache = LocalCache();
+        n->next      = cache.head[c];
+        cache.head[c] = n;
+        if (++cache.count[c] >= 2 * BATCH)
+            cache.Flush(c, BATCH);
+    }
+
+private:
+    struct FreeNode
+    {
+        FreeNode* next;
+    };
+
+    static size_t Class(size_t size) { return (size + GRANULE - 1) / GRANULE - 1; }
+
+    struct Depot
+    {
+        struct Batch
+        {
+            FreeNode* head  = nullptr;
+            FreeNode* tail  = nullptr;
+            uint32_t  count = 0;
+        };
+
+        // full batches are chained through the tail node of the previous batch
+        TTASLock   locker[CLASSES]; // a cache line each
+        FreeNode*  full[CLASSES]       = {};
+        uint32_t   full_count[CLASSES] = {};
+        Batch      loose[CLASSES];
+
+        void Put(size_t c, FreeNode* head, FreeNode* tail, uint32_t count)
+        {
+            locker[c].lock();
+            Batch& l = loose[c];
+            tail->next = l.head;
+            if (!l.head)
+                l.tail = tail;
+            l.head = head;
+            l.count += count;
+            if (l.count >= BATCH)
+            {
+                l.tail->next = full[c];
+                full[c]      = l.head;
+                full_count[c] += l.count;
+                l = Batch{};
+            }
+            locker[c].unlock();
+        }
+
+        // returns a chain of blocks, nullptr when the depot is empty
+        FreeNode* TakeChain(size_t c, uint32_t& count)
+        {
+            locker[c].lock();
+            FreeNode* ret = nullptr;
+            count         = 0;
+            if (full[c])
+            {
+                ret = full[c];
+                FreeNode* n = ret;
+                for (count = 1; count < BATCH && n->next; ++count)
+                    n = n->next;
+                full[c]       = n->next;
+                full_count[c] -= count;
+                n->next       = nullptr;
+            }
+            else if (loose[c].head)
+            {
+                ret   = loose[c].head;
+                count = loose[c].count;
+                loose[c] = Batch{};
+            }
+            locker[c].unlock();
+            return ret;
+        }
+
+        void* Take(size_t c)
+        {
+            uint32_t  count = 0;
+            FreeNode* chain = TakeChain(c, count);
+            if (!chain)
+            {
+                FreeNode* tail = nullptr;
+                chain          = Carve(c, count, tail);
+            }
+            if (chain->next)
+            {
+                FreeNode* tail = chain->next;
+                while (tail->next)
+                    tail = tail->next;
+                Put(c, chain->next, tail, count - 1);
+            }
+            return chain;
+        }
+    };
+
+    static FreeNode* Carve(size_t c, uint32_t& count, FreeNode*& tail)
+    {
+        const size_t block = (c + 1) * GRANULE;
+        uint8_t*     slab  = (uint8_t*)::operator new(SLAB_SIZE);
+        heap_allocs.fetch_add(1, std::memory_order_relaxed);
+        slab_bytes.fetch_add(SLAB_SIZE, std::memory_order_relaxed);
+
+        count = uint32_t(SLAB_SIZE / block);
+        for (uint32_t i = 0; i + 1 < count; ++i)
+            ((FreeNode*)(slab + i * block))->next = (FreeNode*)(slab + (i + 1) * block);
+        tail       = (FreeNode*)(slab + (count - 1) * block);
+        tail->next = nullptr;
+        return (FreeNode*)slab;
+    }
+
+    // the depot outlives every thread, including detached workers still running at exit
+    static Depot& GetDepot()
+    {
+        static Depot* depot = new Depot();
+        return *depot;
+    }
+
+    struct Cache
+    {
+        FreeNode* head[CLASSES]  = {};
+        uint32_t  count[CLASSES] = {};
+
+        void Refill(size_t c)
+        {
+            FreeNode* tail = nullptr;
+            head[c]        = GetDepot().TakeChain(c, count[c]);
+            if (!head[c])
+                head[c] = Carve(c, count[c], tail);
+        }
+
+        void Flush(size_t c, uint32_t n)
+        {
+            FreeNode* first = head[c];
+            FreeNode* last  = first;
+            for (uint32_t i = 1; i < n; ++i)
+                last = last->next;
+            head[c]    = last->next;
+            count[c]  -= n;
+            last->next = nullptr;
+            GetDepot().Put(c, first, last, n);
+        }
+
+        ~Cache()
+        {
+            for (size_t c = 0; c < CLASSES; ++c)
+                if (count[c])
+                    Flush(c, count[c]);
+            tl_dead = true;
+        }
+    };
+
+    static Cache& LocalCache()
+    {
+        static thread_local Cache cache;
+        return cache;
+    }
+
+    static inline thread_local bool tl_dead = false;
+
+    static inline std::atomic<size_t> heap_allocs{0};
+    static inline std::atomic<size_t> heap_frees{0};
+    static inline std::atomic<size_t> slab_bytes{0};
+};
+
+// Base for types allocated through ObjectPool. Deleting through a base pointer needs a virtual destructor,
+// so the sized delete gets the size of the most derived type.
+struct PoolObject
+{
+    static void* operator new(size_t size) { return ObjectPool::Allocate(size); }
+    static void  operator delete(void* p, size_t size) { ObjectPool::Deallocate(p, size); }
+
+    // over aligned types bypass the pool
+    static void* operator new(size_t size, std::align_val_t al) { return ::operator new(size, al); }
+    static void  operator delete(void* p, size_t, std::align_val_t al) { ::operator delete(p, al); }
+};
+
+
+#endif // OBJECT_POOL_H
@@ -0,0 +1,184 @@
+#pragma once
+
+
+#ifndef PARKING_H
+#define PARKING_H
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+inline void CpuRelax()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// Event count for idle workers.
+// Worker:   key = PrepareWait(); if(has work) CancelWait(); else CommitWait(key, timeout);
+// Producer: publish work; NotifyOne();
+// A notify between PrepareWait and CommitWait changes the epoch, so the wakeup is never lost.
+class WorkerParker
+{
+    alignas(64) std::atomic<uint32_t> epoch{0};
+    alignas(64) std::atomic<int32_t> sleepers{0};
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+public:
+    uint32_t PrepareWait()
+    {
+        sleepers.fetch_add(1, std::memory_order_seq_cst);
+        return epoch.load(std::memory_order_seq_cst);
+    }
+
+    void CancelWait()
+    {
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // timeout == 0 waits until notified, returns false when the timeout expired
+    bool CommitWait(uint32_t key, std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0))
+    {
+        bool notified = true;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (timeout.count() > 0)
+                notified = cv.wait_for(lock, timeout, [&] { return epoch.load(std::memory_order_relaxed) != key; });
+            else
+                cv.wait(lock, [&] { return epoch.load(std::memory_order_relaxed) != key; });
+        }
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+        return notified;
+    }
+
+    // wakes at most one parked worker, cheap when nobody sleeps
+    void NotifyOne()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_relaxed) == 0)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            epoch.fetch_add(1, std::memory_order_relaxed);
+        }
+        cv.notify_one();
+    }
+
+    void NotifyAll()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            epoch.fetch_add(1, std::memory_order_relaxed);
+        }
+        cv.notify_all();
+    }
+
+    int32_t Sleepers() const { return sleepers.load(std::memory_order_relaxed); }
+};
+
+// Waiting on arbitrary addresses without a mutex per object, waiters are hashed into a fixed bucket table.
+// Waiter:   ParkingLot::Wait(addr, [&] { return ready; }, timeout);
+// Notifier: publish ready (seq_cst); ParkingLot::NotifyAll(addr);
+class ParkingLot
+{
+    struct alignas(64) Bucket
+    {
+        std::mutex              mutex;
+        std::condition_variable cv;
+        std::atomic<int32_t>    waiters{0};
+    };
+
+    static constexpr size_t BUCKETS = 64;
+
+    static Bucket& For(const void* addr)
+    {
+        // never destroyed, detached threads may still wait during exit
+        static Bucket* buckets = new Bucket[BUCKETS];
+        uint64_t h = uint64_t(uintptr_t(addr)) * 0x9E3779B97F4A7C15ull;
+        return buckets[(h >> 32) % BUCKETS];
+    }
+
+public:
+    // returns false when the timeout expired, timeout == 0 waits until ready
+    template<typename Pred>
+    static bool Wait(const void* addr, Pred ready, std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0))
+    {
+        if (ready())
+            return true;
+        Bucket& b = For(addr);
+        std::unique_lock<std::mutex> lock(b.mutex);
+        b.waiters.fetch_add(1, std::memory_order_seq_cst);
+        bool ret = true;
+        if (timeout.count() > 0)
+            ret = b.cv.wait_for(lock, timeout, ready);
+        else
+            b.cv.wait(lock, ready);
+        b.waiters.fetch_sub(1, std::memory_order_relaxed);
+        return ret;
+    }
+
+    static void NotifyAll(const void* addr)
+    {
+        Bucket& b = For(addr);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (b.waiters.load(std::memory_order_relaxed) == 0)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(b.mutex);
+        }
+        b.cv.notify_all();
+    }
+};
+
+// Bounded spin before parking. The spin budget grows when a park ends quickly
+// (work arrives in bursts) and shrinks when the worker sleeps for long.
+struct AdaptiveSpin
+{
+    AdaptiveSpin(uint32_t min_spin = 64, uint32_t max_spin = 4096) : min_spin(min_spin), max_spin(max_spin), limit(min_spin) {}
+
+    uint32_t min_spin;
+    uint32_t max_spin;
+    uint32_t limit;
+    uint32_t count = 0;
+
+    // true while the worker should keep spinning
+    bool Spin()
+    {
+        if (count >= limit)
+            return false;
+        if (++count < 32)
+            CpuRelax();
+        else
+            std::this_thread::yield();
+        return true;
+    }
+
+    void Reset() { count = 0; }
+
+    void Parked(std::chrono::nanoseconds slept)
+    {
+        if (slept < std::chrono::microseconds(50))
+            limit = (limit * 2 < max_spin) ? limit * 2 : max_spin;
+        else
+            limit = (limit / 2 > min_spin) ? limit / 2 : min_spin;
+        count = 0;
+    }
+};
+
+
+#endif // PARKING_H
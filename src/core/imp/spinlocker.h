@@ -21,13 +21,13 @@ struct SpinLocker {
         SpinLocker* parent;
     };
 
-    SpinLocker() : tid({}) { hSpin = 0; hCount = 0; tid.ptr = 0; }
+    SpinLocker() { hSpin = 0; hCount = 0; }
     
-    bool lockedThisThread() { return tid.t_id == std::this_thread::get_id(); }
+    bool lockedThisThread() { return owner.load(std::memory_order_relaxed) == std::this_thread::get_id(); }
 
     bool try_lock() 
     {
-        if(tid.t_id == std::this_thread::get_id())
+        if(lockedThisThread())
         {
             ++hCount;
             onLock();
@@ -38,7 +38,7 @@ struct SpinLocker {
         int Del = 1;
         if (hSpin.compare_exchange_weak(Ex, Del) == false)
             return false;
-        tid.t_id = std::this_thread::get_id();
+        owner.store(std::this_thread::get_id(), std::memory_order_relaxed);
         hCount = 1;
         onLock();
         return true;
@@ -51,7 +51,7 @@ struct SpinLocker {
             LOCKER_LOG("warning : unlock not locked item\n");
             return;
         }
-        else if(tid.t_id != std::this_thread::get_id())
+        else if(!lockedThisThread())
         {
             LOCKER_LOG("warning : unlock from other thread\n");
         }
@@ -61,7 +61,7 @@ struct SpinLocker {
             onUnlock();
             return;
         }
-        tid.ptr = 0;
+        owner.store(std::thread::id(), std::memory_order_relaxed);
         hSpin = 0;
         hCount = 0;
         onUnlock();
@@ -74,11 +74,11 @@ struct SpinLocker {
             LOCKER_LOG("warning : forse_unlock not locked item\n");
             return;
         }
-        if(tid.t_id != std::this_thread::get_id() && tid.ptr != 0)
+        if(!lockedThisThread() && owner.load(std::memory_order_relaxed) != std::thread::id())
         {
             LOCKER_LOG("warning : forse_unlock from other thread\n");
         }
-        tid.ptr = 0;
+        owner.store(std::thread::id(), std::memory_order_relaxed);
         hSpin = 0;
         hCount = 0;
         onUnlock();
@@ -86,7 +86,7 @@ struct SpinLocker {
 
     void lock(int Ms = 0) 
     {
-        if(tid.t_id == std::this_thread::get_id())
+        if(lockedThisThread())
         {
             ++hCount;
             onLock();
@@ -106,7 +106,7 @@ struct SpinLocker {
             }
             break;
         }
-        tid.t_id = std::this_thread::get_id();
+        owner.store(std::this_thread::get_id(), std::memory_order_relaxed);
         hCount = 1;
         onLock();
     }
@@ -121,12 +121,8 @@ protected:
 
 private:
     
-    union tid_t
-    {
-        std::thread::id t_id;
-        void* ptr = 0;
-    } tid;
-    
+    // other threads only compare it with their own id, they can never see it equal
+    std::atomic<std::thread::id> owner;
     std::atomic<int>     hSpin;
     std::atomic<int>     hCount;
     
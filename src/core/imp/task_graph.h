@@ -0,0 +1,217 @@
+#pragma once
+
+
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "thread_pool.h"
+
+// Dependency graph of one-shot jobs, built once and run as often as needed (every frame):
+//   TaskGraph g; auto a = g.AddNode(fa); auto b = g.AddNode(fb); g.Precede(a, b); g.Compile();
+//   g.Run(pool).wait();
+// Every run has its own dependency counters. A node goes to the pool the moment its last predecessor
+// finished, the worker that finished it keeps one of the ready successors and runs it right away.
+// The graph must not be changed while a run is in flight.
+class TaskGraph
+{
+public:
+    using NodeId = uint32_t;
+    static constexpr NodeId NONE = ~NodeId(0);
+
+    template<typename C, typename Check = srv_function<void()>::template check_callable<C>>
+    NodeId AddNode(C f, std::string name = {})
+    {
+        nodes.push_back({ srv_unique_function<void()>(std::move(f)), std::move(name) });
+        compiled = false;
+        return NodeId(nodes.size() - 1);
+    }
+
+    // after starts once before finished
+    void Precede(NodeId before, NodeId after)
+    {
+        edges.push_back({ before, after });
+        compiled = false;
+    }
+
+    size_t size() const { return nodes.size(); }
+    const std::string& name(NodeId node) const { return nodes[node].name; }
+
+    // builds the successor lists and counts, false when the graph has a cycle
+    bool Compile()
+    {
+        const size_t n = nodes.size();
+        succ_begin.assign(n + 1, 0);
+        preds.assign(n, 0);
+        for(auto& e : edges)
+        {
+            if(e.before >= n || e.after >= n)
+                throw std::out_of_range("TaskGraph: edge to an unknown node");
+            ++succ_begin[e.before + 1];
+            ++preds[e.after];
+        }
+        for(size_t i = 0; i < n; ++i)
+            succ_begin[i + 1] += succ_begin[i];
+        succ.resize(edges.size());
+        std::vector<uint32_t> fill(succ_begin.begin(), succ_begin.end() - 1);
+        for(auto& e : edges)
+            succ[fill[e.before]++] = e.after;
+
+        roots.clear();
+        for(NodeId i = 0; i < n; ++i)
+            if(preds[i] == 0)
+                roots.push_back(i);
+
+        // Kahn's walk, every node is reached only when there is no cycle
+        std::vector<int32_t> count(preds);
+        std::vector<NodeId>  stack(roots);
+        size_t reached = 0;
+        while(!stack.empty())
+        {
+            const NodeId node = stack.back();
+            stack.pop_back();
+            ++reached;
+            for(uint32_t i = succ_begin[node]; i < succ_begin[node + 1]; ++i)
+                if(--count[succ[i]] == 0)
+                    stack.push_back(succ[i]);
+        }
+        compiled = reached == n;
+        return compiled;
+    }
+
+    // throws std::logic_error when the graph has a cycle
+    ThredaPool::Response<void> Run(ThredaPool& pool, int prio = 0)
+    {
+        if(!compiled && !Compile())
+            throw std::logic_error("TaskGraph: the graph has a cycle");
+
+        const size_t n = nodes.size();
+        auto run = new GraphRun();
+        run->graph = this;
+        run->pool  = &pool;
+        run->prio  = prio;
+        run->counters = std::make_unique<std::atomic<int32_t>[]>(n);
+        for(size_t i = 0; i < n; ++i)
+            run->counters[i].store(preds[i], std::memory_order_relaxed);
+        run->remaining.store(uint32_t(n));
+        ThredaPool::Response<void> ret{run};
+        if(n == 0)
+        {
+            run->completed();
+            return ret;
+        }
+        for(NodeId root : roots)
+            pool.Enqueue(prio, new NodeMessage(run, root));
+        return ret;
+    }
+
+private:
+    struct Node
+    {
+        srv_unique_function<void()> f;
+        std::string name;
+    };
+
+    struct Edge
+    {
+        NodeId before;
+        NodeId after;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Edge> edges;
+
+    // compiled form, successors of node i are succ[succ_begin[i] .. succ_begin[i + 1])
+    std::vector<uint32_t> succ_begin;
+    std::vector<NodeId>   succ;
+    std::vector<int32_t>  preds;
+    std::vector<NodeId>   roots;
+    bool compiled = false;
+
+    struct GraphRun : public ThredaPool::ResponseData
+    {
+        TaskGraph* graph = nullptr;
+        std::unique_ptr<std::atomic<int32_t>[]> counters;
+        std::atomic<uint32_t> remaining{0};
+
+        void Finish()
+        {
+            if(remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                completed();
+        }
+
+        // counts down the successors of node, sends every ready one but the first to the pool and returns it
+        NodeId Done(NodeId node)
+        {
+            NodeId keep = NONE;
+            for(uint32_t i = graph->succ_begin[node]; i < graph->succ_begin[node + 1]; ++i)
+            {
+                const NodeId s = graph->succ[i];
+                if(counters[s].fetch_sub(1, std::memory_order_acq_rel) != 1)
+                    continue;
+                if(keep == NONE)
+                    keep = s;
+                else
+                    pool->Enqueue(prio, new NodeMessage(this, s));
+            }
+            Finish();
+            return keep;
+        }
+
+        void Execute(NodeId node)
+        {
+            while(node != NONE)
+            {
+                if(cancelled.load())
+                {
+                    Skip(node);
+                    return;
+                }
+                if(graph->nodes[node].f)
+                    graph->nodes[node].f();
+                node = Done(node);
+            }
+        }
+
+        // node and everything that depends on it will not run
+        void Skip(NodeId node)
+        {
+            cancelled.store(true);
+            std::vector<NodeId> stack{ node };
+            while(!stack.empty())
+            {
+                const NodeId n = stack.back();
+                stack.pop_back();
+                for(uint32_t i = graph->succ_begin[n]; i < graph->succ_begin[n + 1]; ++i)
+                    if(counters[graph->succ[i]].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                        stack.push_back(graph->succ[i]);
+                Finish();
+            }
+        }
+    };
+
+    struct NodeMessage : public ThredaPool::IMessage
+    {
+        GraphRun* run;
+        NodeId node;
+
+        NodeMessage(GraphRun* run, NodeId node) : run(run), node(node) { run->AddRef(); }
+        ~NodeMessage() { run->Release(); }
+
+        virtual void callimp(ThredaPool::ResponseData*) override { run->Execute(node); }
+        virtual void cancel() override { run->Skip(node); }
+
+        virtual const char* name() override
+        {
+            const std::string& n = run->graph->nodes[node].name;
+            return n.empty() ? "graph node" : n.c_str();
+        }
+    };
+};
+
+
+#endif // TASK_GRAPH_H
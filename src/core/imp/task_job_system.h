@@ -1,8 +1,20 @@
 #pragma once
 
-#include "lockfreelist.h"
+#include "mpmc_queue.h"
+#include "parking.h"
+#include "timer_wheel.h"
 #include "function.hpp"
-
+#include "thread_trace.h"
+#include <vector>
+#include <thread>
+#include <tuple>
+#include <chrono>
+#include <coroutine>
+
+// Repeating tasks and one-shot jobs served by one set of workers.
+// Ready tasks and jobs share one FIFO queue. A task that has to wait (delay, sleep, can_call() == false)
+// goes to a timing wheel and returns to the queue when it is due.
+// The system owns everything added to it: a task is deleted after stopped(), a job after after_call().
 class TaskJobSystem
 {
 public:
@@ -91,15 +103,28 @@ public:
         REMPTY             // UNDEFINED BEHAVIOR
     };
 
-    struct ITask
+    // what the ready queue holds
+    struct IWork
     {
-        Rational delay = {0, 0};
-        size_t delay_ts = 0;
-        Rational sleep = {1, 1000};
-        size_t sleep_ts = 0;
+        IWork(bool task) : task(task) {}
+        virtual ~IWork() = default;
 
-        void ToStop() { to_stop = true; }
-        bool Stopped() { return to_stop; }
+    private:
+        friend class TaskJobSystem;
+        const bool task;
+        int64_t    due = 0; // steady clock ns, while waiting on the timer
+    };
+
+    struct ITask : public IWork
+    {
+        ITask() : IWork(true) {}
+
+        Rational delay = {0, 0};    // period of RAGAIN, counted from the previous turn, late turns are skipped
+        Rational sleep = {1, 1000}; // wait after RSLEEP or can_call() == false, counted from now
+
+        // the task stops at its next turn
+        void ToStop() { to_stop.store(true); }
+        bool Stopped() { return to_stop.load(); }
 
         virtual bool can_call() = 0;
         virtual void after_call() = 0;
@@ -107,22 +132,25 @@ public:
 
         virtual void stopped() = 0;
     private:
-        bool to_stop = false;
+        friend class TaskJobSystem;
+        std::atomic<bool> to_stop{false};
+        int64_t delay_due = 0;
+        int64_t sleep_due = 0;
     };
 
     template<typename... ARGS>
     struct Task : public ITask
     {
         template<typename C, typename Check = srv_function<int(ARGS...)>::template check_callable<C>>
-        Task(C f, ARGS... vars) : f(f), vars({vars...}) {}
+        Task(C f, ARGS... vars) : vars(vars...), f(std::move(f)) {}
 
         std::tuple<ARGS...> vars;
-        srv_function<int(ARGS...)> f;
+        srv_unique_function<int(ARGS...)> f;
         
         virtual int call()
         {
             if(f)
-                return std::apply([this](ARGS... args){ return (f)(args...); }, vars);
+                return std::apply(f, vars);
             return REMPTY;
         };
 
@@ -132,9 +160,9 @@ public:
     };
 
     template<typename O, typename... ARGS>
-    struct Task : public ITask
+    struct OTask : public ITask
     {
-        Task(O* o, int (O::*f)(ARGS...), ARGS... vars) : o(o), f(f), vars({vars...}) {}
+        OTask(O* o, int (O::*f)(ARGS...), ARGS... vars) : vars(vars...), o(o), f(f) {}
 
         std::tuple<ARGS...> vars;
         O* o;
@@ -152,27 +180,30 @@ public:
         virtual void stopped() {};
     };
 
-    struct IJob
+    struct IJob : public IWork
     {
-        Rational delay = {0, 1};
+        IJob() : IWork(false) {}
+
+        Rational delay = {0, 1}; // the job runs this long after it was added
 
+        // polled again after one timer tick while false
         virtual bool can_call() = 0;
         virtual void after_call() = 0;
-        virtual int call() = 0;
+        virtual void call() = 0;
     };
 
     template<typename... ARGS>
     struct Job : public IJob
     {
-        template<typename C, typename Check = srv_function<int(ARGS...)>::template check_callable<C>>
-        Job(C f, ARGS... vars) : f(f), vars({vars...}) {}
+        template<typename C, typename Check = srv_function<void(ARGS...)>::template check_callable<C>>
+        Job(C f, ARGS... vars) : vars(vars...), f(std::move(f)) {}
 
         std::tuple<ARGS...> vars;
-        srv_function<void(ARGS...)> f;
+        srv_unique_function<void(ARGS...)> f;
         
         virtual void call()
         {
-            if(f) std::apply([this](ARGS... args){ (f)(args...); }, vars);
+            if(f) std::apply(f, vars);
         };
 
         virtual bool can_call() { return true; };
@@ -180,9 +211,9 @@ public:
     };
 
     template<typename O, typename... ARGS>
-    struct Job : public IJob
+    struct OJob : public IJob
     {
-        Job(O* o, void (O::*f)(ARGS...), ARGS... vars) : o(o), f(f), vars({vars...}) {}
+        OJob(O* o, void (O::*f)(ARGS...), ARGS... vars) : vars(vars...), o(o), f(f) {}
 
         std::tuple<ARGS...> vars;
         O* o;
@@ -198,184 +229,476 @@ public:
     };
 
 private:
-    std::vector<std::thread> taskpool;
-    std::vector<std::thread> jobpool;
-    std::vector<std::thread> anypool;
+    std::vector<std::thread> pool;
     std::atomic_bool run{true};
 
-    LockFreeList<ITask*> tasks;
-    LockFreeList<IJob*> jobs;
+    SegmentedMPMCQueue<IWork*> ready{256};
+
+    static inline int64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // waiting tasks and jobs, one worker at a time moves the due ones to the ready queue
+    static constexpr int64_t timer_tick_ns = 100000;
+    TTASLock               timer_locker;
+    TimerWheel<IWork*>     timers{uint64_t(Now() / timer_tick_ns)};
+    std::atomic<size_t>    timer_count{0};
+    // deadline a parked worker will wake up for, INT64_MAX when nobody waits for the timers
+    std::atomic<int64_t>   timer_deadline{INT64_MAX};
+
+    // tasks not stopped yet and jobs not finished yet, quiesce() and drain() wait on these
+    std::atomic<int64_t> task_count{0};
+    std::atomic<int64_t> job_count{0};
+
+    // tasks stop at their next turn while set
+    std::atomic<bool> draining{false};
 
-    SpinLocker rm_locker;
+    WorkerParker parker;
     
     bool greedy;
 
-    unsigned char TASKTHCOUNT = 0;
-    unsigned char JOBTHCOUNT = 0;
-    unsigned char ANYTHCOUNT = 1;
-public:
+    unsigned char THCOUNT = 0;
+
+    static int64_t Period(const Rational& r)
+    {
+        return (r.num && r.den) ? r.num * int64_t(1e9) / r.den : 0;
+    }
+
+    void Push(IWork* w)
+    {
+        THREAD_TRACE(Enqueue, uintptr_t(w), 0, uint32_t(job_count.load(std::memory_order_relaxed)));
+        ready.Push(w);
+        parker.NotifyOne();
+    }
+
+    void Schedule(IWork* w, int64_t due)
+    {
+        if(due <= Now())
+        {
+            Push(w);
+            return;
+        }
+        w->due = due;
+        timer_locker.lock();
+        timers.Schedule(w, uint64_t((due + timer_tick_ns - 1) / timer_tick_ns));
+        ++timer_count;
+        timer_locker.unlock();
+        // nobody waits for a deadline that early, a woken worker takes over
+        if(due < timer_deadline.load())
+            parker.NotifyOne();
+    }
+
+    void AdvanceTimers()
+    {
+        if(timer_count.load(std::memory_order_relaxed) == 0 || !timer_locker.try_lock())
+            return;
+
+        size_t fired = 0;
+        const uint64_t tick = uint64_t(Now() / timer_tick_ns);
+        if(tick > timers.Current())
+            fired = timers.Advance(tick, [this](IWork* w) { ready.Push(w); });
+        timer_count -= fired;
+        timer_locker.unlock();
+
+        // this worker takes one, wake somebody for the rest
+        if(fired > 1)
+            parker.NotifyOne();
+    }
+
+    // how long an idle worker may park before the next timer is due, 0 when no timers
+    std::chrono::nanoseconds TimerTimeout()
+    {
+        if(timer_count.load() == 0)
+            return std::chrono::nanoseconds(0);
+        if(!timer_locker.try_lock())
+            return std::chrono::nanoseconds(timer_tick_ns);
+        int64_t wait = 0;
+        const uint64_t next = timers.NextDue();
+        if(next != UINT64_MAX)
+            wait = int64_t(next) * timer_tick_ns - Now();
+        timer_locker.unlock();
+        if(next == UINT64_MAX)
+            return std::chrono::nanoseconds(0);
+        return std::chrono::nanoseconds(wait > 1000 ? wait : 1000);
+    }
+
+    bool ClaimTimerWait(int64_t deadline)
+    {
+        int64_t cur = timer_deadline.load();
+        while(deadline < cur)
+        {
+            if(timer_deadline.compare_exchange_weak(cur, deadline))
+                return true;
+        }
+        return false;
+    }
+
+    void StopTask(ITask* task)
+    {
+        task->ToStop();
+        task->stopped();
+        delete task;
+        // drain() parks on job_count for both
+        if(task_count.fetch_sub(1) == 1)
+            ParkingLot::NotifyAll(&job_count);
+    }
+
+    void FinishJob(IJob* job)
+    {
+        delete job;
+        if(job_count.fetch_sub(1) == 1)
+            ParkingLot::NotifyAll(&job_count);
+    }
+
+    void RunTask(ITask* task)
+    {
+        if(task->Stopped() || draining.load())
+        {
+            StopTask(task);
+            return;
+        }
+        if(!task->can_call())
+        {
+            const int64_t sleep = Period(task->sleep);
+            Schedule(task, Now() + (sleep ? sleep : timer_tick_ns));
+            return;
+        }
+
+        THREAD_TRACE(Start, uintptr_t(task), 0, 0, "task");
+        const auto ret = TaskReturnCode(task->call());
+        task->after_call();
+        THREAD_TRACE(End, uintptr_t(task));
+        const int64_t now = Now();
+        switch (ret)
+        {
+        case TaskReturnCode::RAGAIN:
+        case TaskReturnCode::RSLEEP:
+        case TaskReturnCode::RSLEEP_OR_DELAY:
+            break;
+        case TaskReturnCode::RIMMEDIATELY:
+            ready.Push(task);
+            return;
+        // RERROR, REMPTY and unknown codes would spin forever
+        default:
+            StopTask(task);
+            return;
+        }
+
+        if(ret != TaskReturnCode::RSLEEP)
+        {
+            const int64_t delay = Period(task->delay);
+            task->delay_due += delay;
+            // skip the missed periods when falling far behind
+            if(now - task->delay_due > 3 * delay)
+                task->delay_due = now + delay;
+        }
+        if(ret != TaskReturnCode::RAGAIN)
+            task->sleep_due = now + Period(task->sleep);
+
+        if(draining.load())
+            StopTask(task);
+        else
+            Schedule(task, task->delay_due > task->sleep_due ? task->delay_due : task->sleep_due);
+    }
+
+    void RunJob(IJob* job)
+    {
+        if(!job->can_call())
+        {
+            Schedule(job, Now() + timer_tick_ns);
+            return;
+        }
+        THREAD_TRACE(Start, uintptr_t(job), 0, 0, "job");
+        job->call();
+        job->after_call();
+        THREAD_TRACE(End, uintptr_t(job));
+        FinishJob(job);
+    }
+
+    // the work will not run
+    void Discard(IWork* w)
+    {
+        if(w->task)
+            StopTask(static_cast<ITask*>(w));
+        else
+            FinishJob(static_cast<IJob*>(w));
+    }
 
-    bool JobProcess() 
+    size_t DiscardQueued(bool jobs)
     {
-        auto cts = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-        for(auto mess : jobs)
+        std::vector<IWork*> dropped;
+        timer_locker.lock();
+        timers.Clear([&](IWork* w) { dropped.push_back(w); });
+        timer_count.store(0);
+        timer_locker.unlock();
+
+        size_t ret = 0;
+        for(auto w : dropped)
         {
-            if(mess->can_call())
+            // jobs keep waiting for their turn unless they are discarded too
+            if(!jobs && !w->task)
+                Schedule(w, w->due);
+            else
             {
-                jobs.RemoveNode(mess);
-                mess->call();
-                mess->after_call();
+                Discard(w);
+                ++ret;
             }
-            return true;
         }
-        return false;
+        if(jobs)
+        {
+            IWork* w;
+            while(ready.TryPop(w))
+            {
+                Discard(w);
+                ++ret;
+            }
+        }
+        return ret;
+    }
+
+    // waits until pred() holds, a system without threads runs the work meanwhile
+    template<typename Pred>
+    bool WaitFor(const void* addr, Pred pred, std::chrono::nanoseconds timeout)
+    {
+        const auto until = std::chrono::steady_clock::now() + timeout;
+        while(!pred())
+        {
+            auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(until - std::chrono::steady_clock::now());
+            if(timeout.count() > 0 && left.count() <= 0)
+                return false;
+            if(THCOUNT == 0)
+            {
+                if(!Process())
+                    CpuRelax();
+                continue;
+            }
+            if(timeout.count() == 0 || left > std::chrono::milliseconds(1))
+                left = std::chrono::milliseconds(1);
+            ParkingLot::Wait(addr, pred, left);
+        }
+        return true;
+    }
+
+public:
+
+    // runs one ready task or job, false when there was nothing to do
+    bool Process()
+    {
+        AdvanceTimers();
+        IWork* w;
+        if(!ready.TryPop(w))
+            return false;
+        if(w->task)
+            RunTask(static_cast<ITask*>(w));
+        else
+            RunJob(static_cast<IJob*>(w));
+        return true;
     }
 
-    bool TaskProcess()
+private:
+    static void TaskJobSystemThread(TaskJobSystem* self, int id)
     {
-        int i = 0;
-        auto cts = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-        for(auto mess : tasks)
+        THREAD_TRACE_THREAD_NAME("TaskJobSystem#" + std::to_string(id));
+
+        // greedy thread spins longer before it parks
+        AdaptiveSpin spin = (id == 0 && self->greedy) ? AdaptiveSpin(1024, 65536) : AdaptiveSpin();
+        while(self->run.load())
         {
-            if(mess->Stopped())
+            if(self->Process())
+            {
+                spin.Reset();
                 continue;
-            const auto del = mess->delay;
-            const size_t del_ts = Rational::rescale(cts, { std::chrono::high_resolution_clock::period::num, std::chrono::high_resolution_clock::period::den}, del);
-            const size_t del_tts = mess->delay_ts + 1;
-            if(del.den && del.num && (del_tts > del_ts))
-                continue;            
-            const auto sle = mess->sleep;
-            const size_t sle_ts = Rational::rescale(cts, { std::chrono::high_resolution_clock::period::num, std::chrono::high_resolution_clock::period::den}, del);
-            const size_t sle_tts = mess->sleep_ts + 1;
-            if(sle.den && sle.num && (sle_tts > sle_ts))
+            }
+            if(spin.count == 0)
+                THREAD_TRACE(Spin, 0);
+            if(spin.Spin())
                 continue;
-            if(mess->can_call())
+
+            auto key = self->parker.PrepareWait();
+            if(!self->run.load() || self->Process())
             {
-                auto ret = (TaskReturnCode)(mess->call());
-                switch (ret)
-                {
-                case TaskReturnCode::RAGAIN: {
-                    if(del.den && del.num)
-                    {
-                        if(del_ts - del_tts > 3)
-                            mess->delay_ts = del_ts;
-                        else
-                            mess->delay_ts = del_tts;
-                    }
-                    break;
-                }
-                case TaskReturnCode::RSLEEP: {
-                    if(sle.den && sle.num)
-                    {
-                        if(sle_ts - sle_tts > 3)
-                            mess->sleep_ts = sle_ts;
-                        else
-                            mess->sleep_ts = sle_tts;
-                    }
-                    break;
-                }
-                case TaskReturnCode::RSLEEP_OR_DELAY: {
-                    if(del.den && del.num)
-                    {
-                        if(del_ts - del_tts > 3)
-                            mess->delay_ts = del_ts;
-                        else
-                            mess->delay_ts = del_tts;
-                    }
-                    if(sle.den && sle.num)
-                    {
-                        if(sle_ts - sle_tts > 3)
-                            mess->sleep_ts = sle_ts;
-                        else
-                            mess->sleep_ts = sle_tts;
-                    }
-                    break;
-                }
-                case TaskReturnCode::RSTOP : {
-                    mess->ToStop();
-                    mess->stopped();
-                    tasks.RemoveNode(mess);
-                    break;
-                }
-                default:
-                    break;
-                }
-
-                ++i;
-                mess->after_call();
+                self->parker.CancelWait();
+                spin.Reset();
+                continue;
             }
+            auto start    = std::chrono::steady_clock::now();
+            auto timeout  = self->TimerTimeout();
+            auto deadline = Now() + timeout.count();
+            if(timeout.count() > 0 && !self->ClaimTimerWait(deadline))
+                timeout = std::chrono::nanoseconds(0);
+
+            THREAD_TRACE(Park, 0);
+            const bool notified = self->parker.CommitWait(key, timeout);
+            THREAD_TRACE(Wake, 0);
+            if(timeout.count() > 0)
+                self->timer_deadline.compare_exchange_strong(deadline, INT64_MAX);
+
+            // a timer wakeup says nothing about how bursty the work is
+            if(notified)
+                spin.Parked(std::chrono::steady_clock::now() - start);
+            else
+                spin.Reset();
         }
-        return i > 0;
     }
 
-    bool AnyProcess()
+public:
+    // threads == 0 makes a system that runs only inside Process()
+    TaskJobSystem(unsigned char threads = 8, bool greedy = true) 
+        : greedy(greedy)
+        , THCOUNT(threads)
+    {
+        pool.resize(THCOUNT);
+        for(int i = 0; i < THCOUNT; i++)
+            pool[i] = std::thread(TaskJobSystemThread, this, i);
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+    // add functions
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+
+    // the task runs right away, the pointer stays valid until stopped() ran
+    ITask* add_task(ITask* task)
     {
-        if(!JobProcess())
-            TaskProcess();
+        task_count.fetch_add(1);
+        task->delay_due = task->sleep_due = Now();
+        Push(task);
+        return task;
     }
-private:
-    static void JobThredaPoolThread(TaskJobSystem* self, int id)
+
+    template<typename C, typename... ARGS, typename Check = srv_function<int(ARGS...)>::template check_callable<C>>
+    ITask* add_task(Rational delay, C f, ARGS... vars)
     {
-        while(self->run.load()) if(self->JobProcess() == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        auto task = new Task<ARGS...>(std::move(f), vars...);
+        task->delay = delay;
+        return add_task(task);
     }
 
-    static void TaskThredaPoolThread(TaskJobSystem* self, int id)
+    template<typename O, typename... ARGS>
+    ITask* add_task(Rational delay, O* o, int (O::*f)(ARGS...), ARGS... vars)
     {
-        while(self->run.load()) if(self->TaskProcess() == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        auto task = new OTask<O, ARGS...>(o, f, vars...);
+        task->delay = delay;
+        return add_task(task);
     }
 
-    static void AnyTaskThredaPoolThread(TaskJobSystem* self, int id)
+    void add_job(IJob* job)
     {
-        if(id != 0 || !self->greedy)
-            while(self->run.load()) if(self->AnyProcess() == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        else
-            while(self->run.load()) if(self->AnyProcess() == 0) std::this_thread::yield();
+        job_count.fetch_add(1);
+        Schedule(job, Now() + Period(job->delay));
     }
 
-public:
-    TaskJobSystem(unsigned char any = 8, unsigned char task = 2, unsigned char job = 2, bool greedy = true) 
-        : TASKTHCOUNT(task)
-        , JOBTHCOUNT(job)
-        , ANYTHCOUNT(any)
-        , greedy(greedy)
-    {
-        taskpool.resize(TASKTHCOUNT);
-        jobpool.resize(JOBTHCOUNT);
-        anypool.resize(ANYTHCOUNT);
-        for(int i = 0; i < TASKTHCOUNT; i++)
+    template<typename C, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>>
+    void add_job(C f, ARGS... vars) { add_job(new Job<ARGS...>(std::move(f), vars...)); }
+
+    template<typename O, typename... ARGS>
+    void add_job(O* o, void (O::*f)(ARGS...), ARGS... vars) { add_job(new OJob<O, ARGS...>(o, f, vars...)); }
+
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+    // add functions
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+    // coroutine functions
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+
+private:
+    // resumes a coroutine, one that was never resumed is destroyed with the job
+    struct ResumeJob : public IJob
+    {
+        std::coroutine_handle<> h;
+
+        ResumeJob(std::coroutine_handle<> h) : h(h) {}
+        ~ResumeJob() { if(h) h.destroy(); }
+
+        virtual bool can_call() { return true; }
+        virtual void after_call() {}
+        virtual void call()
         {
-            taskpool[i] = std::thread(TaskThredaPoolThread, this, i);
-            taskpool[i].detach();
+            auto c = h;
+            h = nullptr;
+            c.resume();
         }
-        for(int i = 0; i < JOBTHCOUNT; i++)
+    };
+
+public:
+    // co_await system.schedule() continues the coroutine as a job, co_await system.sleep_for(d) once d passed.
+    // The coroutine holds no worker while it waits, instead of a task that returns RSLEEP until it is done.
+    struct ScheduleAwaiter
+    {
+        TaskJobSystem* system;
+        int64_t        delay_ns;
+
+        bool await_ready() const { return false; }
+
+        void await_suspend(std::coroutine_handle<> h)
         {
-            jobpool[i] = std::thread(JobThredaPoolThread, this, i);
-            jobpool[i].detach();
+            system->job_count.fetch_add(1);
+            system->Schedule(new ResumeJob(h), Now() + delay_ns);
         }
-        for(int i = 0; i < ANYTHCOUNT; i++)
+
+        void await_resume() const {}
+    };
+
+    ScheduleAwaiter schedule() { return { this, 0 }; }
+
+    template<typename Rep, typename Per>
+    ScheduleAwaiter sleep_for(std::chrono::duration<Rep, Per> d)
+    {
+        return { this, int64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()) };
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+    // coroutine functions
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+    // shutdown functions
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+
+    // Waits until every job added so far, and every job they add in turn, has finished. Tasks keep running.
+    // Must not be called from a task or a job of this system.
+    void quiesce()
+    {
+        WaitFor(&job_count, [this] { return job_count.load() <= 0; }, std::chrono::nanoseconds(0));
+    }
+
+    // Stops every task and lets the jobs finish, the jobs still queued after the timeout are dropped without running.
+    // Returns true when everything finished in time, timeout 0 waits without limit.
+    bool drain(std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0))
+    {
+        draining.store(true);
+        DiscardQueued(false);
+        parker.NotifyAll();
+        auto idle = [this] { return job_count.load() <= 0 && task_count.load() <= 0; };
+        bool ret = WaitFor(&job_count, idle, timeout);
+        // running jobs may still add more
+        while(!ret && !idle())
         {
-            anypool[i] = std::thread(AnyTaskThredaPoolThread, this, i);
-            anypool[i].detach();
+            DiscardQueued(true);
+            WaitFor(&job_count, idle, std::chrono::milliseconds(1));
         }
+        draining.store(false);
+        return ret;
     }
 
-private:
+    size_t task_count_approx() const { return size_t(task_count.load()); }
+    size_t job_count_approx() const { return size_t(job_count.load()); }
 
-public:
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+    // shutdown functions
+    //------------------------------------------------------------------------------------------------------------------------------------------------
 
-   
+    // Workers finish what they run and exit, tasks get stopped(), queued jobs are dropped.
     ~TaskJobSystem()
     {
         run.store(false);
-        for(int i = 0; i < THCOUNT; i++)
-        {
-            try
-            {
-                if(pool[i].joinable())
-                    pool[i].join();
-            }
-            catch(const std::exception& e){}
-        }
+        parker.NotifyAll();
+        for(auto& th : pool)
+            if(th.joinable())
+                th.join();
+        while(DiscardQueued(true))
+            ;
     }
 
 };
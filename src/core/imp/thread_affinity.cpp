@@ -0,0 +1,175 @@
+#include "thread_affinity.h"
+
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <fstream>
+#include <sstream>
+#endif
+
+#if defined(_WIN32)
+
+// cpu numbers are assigned group after group
+static bool CpuToGroup(int cpu, WORD& group, BYTE& bit)
+{
+    const WORD groups = GetActiveProcessorGroupCount();
+    for(WORD g = 0; g < groups; ++g)
+    {
+        const int n = int(GetActiveProcessorCount(g));
+        if(cpu < n)
+        {
+            group = g;
+            bit   = BYTE(cpu);
+            return true;
+        }
+        cpu -= n;
+    }
+    return false;
+}
+
+static int GroupFirstCpu(WORD group)
+{
+    int ret = 0;
+    for(WORD g = 0; g < group; ++g)
+        ret += int(GetActiveProcessorCount(g));
+    return ret;
+}
+
+CpuTopology::CpuTopology()
+{
+    cpus = int(GetActiveProcessorCount(ALL_PROCESSOR_GROUPS));
+    if(cpus > CpuMask::MAX_CPUS)
+        cpus = CpuMask::MAX_CPUS;
+
+    ULONG highest = 0;
+    if(GetNumaHighestNodeNumber(&highest))
+    {
+        for(ULONG node = 0; node <= highest; ++node)
+        {
+            GROUP_AFFINITY affinity = {};
+            if(!GetNumaNodeProcessorMaskEx(USHORT(node), &affinity) || !affinity.Mask)
+                continue;
+            CpuMask mask;
+            const int first = GroupFirstCpu(affinity.Group);
+            for(int i = 0; i < 64; ++i)
+                if((affinity.Mask >> i) & 1)
+                    mask.Set(first + i);
+            nodes.push_back(mask);
+        }
+    }
+    if(nodes.empty())
+        nodes.push_back(All());
+}
+
+bool SetCurrentThreadAffinity(const CpuMask& mask)
+{
+    // a thread belongs to one processor group, take the group holding most of the mask
+    const WORD groups = GetActiveProcessorGroupCount();
+    GROUP_AFFINITY best = {};
+    int best_count = 0;
+    for(WORD g = 0; g < groups; ++g)
+    {
+        GROUP_AFFINITY a = {};
+        a.Group = g;
+        const int first = GroupFirstCpu(g);
+        const int n     = int(GetActiveProcessorCount(g));
+        for(int i = 0; i < n && i < 64; ++i)
+            if(mask.Test(first + i))
+                a.Mask |= KAFFINITY(1) << i;
+        const int count = std::popcount(uint64_t(a.Mask));
+        if(count > best_count)
+        {
+            best       = a;
+            best_count = count;
+        }
+    }
+    if(!best_count)
+        return false;
+    return SetThreadGroupAffinity(GetCurrentThread(), &best, nullptr) != 0;
+}
+
+bool SetCurrentThreadName(const std::string& name)
+{
+    // SetThreadDescription is Windows 10 1607+, look it up so older systems still start
+    using SetThreadDescriptionFn = HRESULT (WINAPI*)(HANDLE, PCWSTR);
+    static auto fn = (SetThreadDescriptionFn)(void*)GetProcAddress(GetModuleHandleA("kernel32.dll"), "SetThreadDescription");
+    if(!fn)
+        return false;
+    std::wstring wname(name.begin(), name.end());
+    return SUCCEEDED(fn(GetCurrentThread(), wname.c_str()));
+}
+
+#elif defined(__linux__)
+
+CpuTopology::CpuTopology()
+{
+    cpus = int(std::thread::hardware_concurrency());
+    if(cpus < 1)
+        cpus = 1;
+    if(cpus > CpuMask::MAX_CPUS)
+        cpus = CpuMask::MAX_CPUS;
+
+    // nodeN/cpulist holds ranges like "0-7,16-23"
+    for(int node = 0; node < CpuMask::MAX_CPUS; ++node)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if(!file)
+            break;
+        CpuMask mask;
+        std::string part;
+        while(std::getline(file, part, ','))
+        {
+            int first = 0, last = -1;
+            char dash = 0;
+            std::istringstream range(part);
+            range >> first;
+            if(range >> dash >> last)
+                mask = mask | CpuMask::Range(first, last - first + 1);
+            else
+                mask.Set(first);
+        }
+        if(!mask.Empty())
+            nodes.push_back(mask);
+    }
+    if(nodes.empty())
+        nodes.push_back(All());
+}
+
+bool SetCurrentThreadAffinity(const CpuMask& mask)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int i = 0; i < CpuMask::MAX_CPUS && i < CPU_SETSIZE; ++i)
+        if(mask.Test(i))
+            CPU_SET(i, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool SetCurrentThreadName(const std::string& name)
+{
+    // the kernel keeps 15 characters
+    return pthread_setname_np(pthread_self(), name.substr(0, 15).c_str()) == 0;
+}
+
+#else
+
+CpuTopology::CpuTopology()
+{
+    cpus = int(std::thread::hardware_concurrency());
+    if(cpus < 1)
+        cpus = 1;
+    if(cpus > CpuMask::MAX_CPUS)
+        cpus = CpuMask::MAX_CPUS;
+    nodes.push_back(All());
+}
+
+bool SetCurrentThreadAffinity(const CpuMask&) { return false; }
+bool SetCurrentThreadName(const std::string&) { return false; }
+
+#endif
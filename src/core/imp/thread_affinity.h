@@ -0,0 +1,150 @@
+#pragma once
+
+
+#ifndef THREAD_AFFINITY_H
+#define THREAD_AFFINITY_H
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <bit>
+
+// Set of logical cpus, cpus are numbered 0..Cpus()-1 across all processor groups.
+struct CpuMask
+{
+    static constexpr int MAX_CPUS = 256;
+
+    uint64_t bits[MAX_CPUS / 64] = {};
+
+    static CpuMask Range(int first, int count)
+    {
+        CpuMask ret;
+        for(int i = first; i < first + count; ++i)
+            ret.Set(i);
+        return ret;
+    }
+
+    void Set(int cpu)
+    {
+        if(cpu >= 0 && cpu < MAX_CPUS)
+            bits[cpu / 64] |= uint64_t(1) << (cpu % 64);
+    }
+
+    bool Test(int cpu) const
+    {
+        return cpu >= 0 && cpu < MAX_CPUS && (bits[cpu / 64] >> (cpu % 64)) & 1;
+    }
+
+    int Count() const
+    {
+        int ret = 0;
+        for(auto b : bits)
+            ret += std::popcount(b);
+        return ret;
+    }
+
+    bool Empty() const { return Count() == 0; }
+
+    // index of the n-th set cpu, -1 if there are fewer
+    int Nth(int n) const
+    {
+        for(int i = 0; i < MAX_CPUS; ++i)
+            if(Test(i) && n-- == 0)
+                return i;
+        return -1;
+    }
+
+    CpuMask operator&(const CpuMask& o) const
+    {
+        CpuMask ret;
+        for(int i = 0; i < MAX_CPUS / 64; ++i)
+            ret.bits[i] = bits[i] & o.bits[i];
+        return ret;
+    }
+
+    CpuMask operator|(const CpuMask& o) const
+    {
+        CpuMask ret;
+        for(int i = 0; i < MAX_CPUS / 64; ++i)
+            ret.bits[i] = bits[i] | o.bits[i];
+        return ret;
+    }
+};
+
+// Logical cpus and NUMA nodes of the machine, read once.
+class CpuTopology
+{
+public:
+    static const CpuTopology& Get()
+    {
+        static CpuTopology topology;
+        return topology;
+    }
+
+    int Cpus() const { return cpus; }
+    int Nodes() const { return int(nodes.size()); }
+
+    const CpuMask& NodeMask(int node) const { return nodes[node]; }
+
+    CpuMask All() const { return CpuMask::Range(0, cpus); }
+
+    int NodeOf(int cpu) const
+    {
+        for(int i = 0; i < Nodes(); ++i)
+            if(nodes[i].Test(cpu))
+                return i;
+        return 0;
+    }
+
+private:
+    CpuTopology(); // thread_affinity.cpp
+
+    int                  cpus = 1;
+    std::vector<CpuMask> nodes;
+};
+
+// Both return false when the platform does not support it, the thread keeps running either way.
+bool SetCurrentThreadAffinity(const CpuMask& mask);
+bool SetCurrentThreadName(const std::string& name);
+
+// Worker threads of all pools in the process share one budget, so pools do not oversubscribe the machine.
+class WorkerBudget
+{
+    std::atomic<int> limit;
+    std::atomic<int> used{0};
+
+public:
+    WorkerBudget(int limit) : limit(limit) {}
+
+    static WorkerBudget& Global()
+    {
+        static WorkerBudget budget(CpuTopology::Get().Cpus());
+        return budget;
+    }
+
+    void SetLimit(int n) { limit.store(n); }
+    int  Limit() const { return limit.load(); }
+    int  Used() const { return used.load(); }
+
+    // takes up to wanted workers, at least at_least even when that goes over the limit
+    int Acquire(int wanted, int at_least = 0)
+    {
+        int cur = used.load();
+        while(true)
+        {
+            int free    = limit.load() - cur;
+            int granted = wanted < free ? wanted : free;
+            if(granted < at_least)
+                granted = at_least;
+            if(granted <= 0)
+                return 0;
+            if(used.compare_exchange_weak(cur, cur + granted))
+                return granted;
+        }
+    }
+
+    void Release(int n) { used.fetch_sub(n); }
+};
+
+
+#endif // THREAD_AFFINITY_H
@@ -1,11 +1,49 @@
 #pragma once
 
 #include "lockfreelist.h"
+#include "mpmc_queue.h"
+#include "work_stealing_deque.h"
+#include "parking.h"
+#include "timer_wheel.h"
+#include "object_pool.h"
 #include "function.hpp"
+#include "thread_affinity.h"
+#include "thread_trace.h"
+#include "frame_arena.h"
 #include <chrono>
+#include <memory>
+#include <deque>
+#include <bit>
+#include <iterator>
+#include <string>
+#include <stdexcept>
+#include <coroutine>
+#include <exception>
 
 class ThredaPool
 {
+public:
+    enum class Scheduler : uint8_t
+    {
+        Shared,       // all workers take from the same priority queues
+        WorkStealing, // per worker Chase-Lev deque, idle workers steal (priority is ignored for one-shot messages)
+    };
+
+    struct Config
+    {
+        int         threads     = 16;
+        bool        greedy      = true;
+        Scheduler   scheduler   = Scheduler::Shared;
+        std::string name        = "ThredaPool"; // OS name of the workers is name#index
+        CpuMask     cores       = {};            // cpus the workers may run on, empty allows all
+        bool        pin_workers = false;         // one cpu per worker instead of the whole node
+        bool        numa_local  = true;          // queues per NUMA node, workers serve and steal from their own node first
+        bool        use_budget  = true;          // take the workers from WorkerBudget::Global()
+    };
+
+private:
+    friend class TaskGraph;
+
     unsigned char THCOUNT = 1;
 
     struct Rational
@@ -77,20 +115,164 @@ class ThredaPool
         inline Rational inv() const { return Rational{ den, num }; }
     };
     
-    struct ResponseData
+    struct ResponseData;
+
+    // runs once when a ResponseData completes
+    struct Continuation : public PoolObject
+    {
+        virtual ~Continuation() = default;
+        virtual void run(ResponseData* src) = 0;
+
+        Continuation* next = nullptr;
+    };
+
+    // shared by the message, every Response handle and pending continuations, the last one deletes it
+    struct ResponseData : public PoolObject
     {
-        std::vector<uint8_t> data;
-        size_t tid;
+        virtual ~ResponseData()
+        {
+            Continuation* c = continuations.load();
+            while(c && c != Done())
+            {
+                auto n = c->next;
+                delete c;
+                c = n;
+            }
+        }
+
         std::atomic<bool> not_completed{true};
         std::atomic<bool> repetable{false};
+        std::atomic<bool> cancelled{false}; // completed without running, by drain() or pool shutdown
+        std::atomic<uint32_t> refs{1};
         Rational delay;
-        size_t last_ts = 0;
         void* owner = 0;
 
-        inline void completed() { if(callback) callback(owner, data.data()); not_completed.store(false);}
-        void (*callback)(void*, uint8_t*);
+        // where continuations go
+        ThredaPool* pool = nullptr;
+        int prio = 0;
+
+        // when_all / when_any counter
+        std::atomic<uint32_t> join_pending{0};
+
+        std::atomic<Continuation*> continuations{nullptr};
+
+        static Continuation* Done() { return reinterpret_cast<Continuation*>(uintptr_t(1)); }
+
+        virtual uint8_t* result() { return nullptr; }
+
+        // exception of a coroutine, get() throws it again
+        virtual void rethrow() {}
+
+        inline void completed()
+        {
+            if(callback && !cancelled.load())
+                callback(owner, result());
+
+            // continuations run before waiters wake, like the callback; restore the registration order
+            Continuation* c = continuations.exchange(Done());
+            Continuation* ordered = nullptr;
+            while(c)
+            {
+                auto n = c->next;
+                c->next = ordered;
+                ordered = c;
+                c = n;
+            }
+            while(ordered)
+            {
+                auto n = ordered->next;
+                ordered->run(this);
+                delete ordered;
+                ordered = n;
+            }
+
+            not_completed.store(false);
+            ParkingLot::NotifyAll(this);
+        }
+        void (*callback)(void*, uint8_t*) = nullptr;
+
+        void AddContinuation(Continuation* c)
+        {
+            Continuation* head = continuations.load();
+            while(head != Done())
+            {
+                c->next = head;
+                if(continuations.compare_exchange_weak(head, c))
+                    return;
+            }
+            c->run(this);
+            delete c;
+        }
+
+        bool IsCompleted() const { return !not_completed.load(); }
+
+        // a pool worker (or anyone waiting on a pool without threads, pumped by Process) keeps running messages
+        // while it waits, so fan-in from inside a message can not deadlock the pool
+        bool Wait(std::chrono::nanoseconds timeout)
+        {
+            for(int i = 0; i < 64; ++i)
+            {
+                if(IsCompleted())
+                    return true;
+                CpuRelax();
+            }
+
+            auto ready = [this] { return IsCompleted(); };
+            if(pool && (tl_pool == pool || pool->THCOUNT == 0))
+            {
+                const auto until = std::chrono::steady_clock::now() + timeout;
+                while(!IsCompleted())
+                {
+                    if(timeout.count() > 0 && std::chrono::steady_clock::now() >= until)
+                        return false;
+                    if(!pool->Process())
+                        ParkingLot::Wait(this, ready, std::chrono::microseconds(100));
+                }
+                return true;
+            }
+            return ParkingLot::Wait(this, ready, timeout);
+        }
+
+        void AddRef() { refs.fetch_add(1, std::memory_order_relaxed); }
+        void Release()
+        {
+            if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete this;
+        }
+    };
+
+    // typed result of the last call, stored in the same block as the ResponseData
+    template<typename T>
+    struct ResponseValue : public ResponseData
+    {
+        alignas(T) uint8_t storage[sizeof(T)];
+        bool has_value = false;
+
+        ~ResponseValue() { reset(); }
+
+        template<typename... A>
+        void emplace(A&&... args)
+        {
+            reset();
+            new(storage) T(std::forward<A>(args)...);
+            has_value = true;
+        }
+
+        void reset()
+        {
+            if(has_value)
+                value().~T();
+            has_value = false;
+        }
+
+        T& value() { return *std::launder((T*)storage); }
+
+        virtual uint8_t* result() override { return has_value ? storage : nullptr; }
     };
 
+    template<typename T>
+    using ResponseDataOf = std::conditional_t<std::is_void_v<T>, ResponseData, ResponseValue<T>>;
+
     template<typename context_type, typename T>
     static void ResponseDataCallabc(void* context, uint8_t* data)
     {
@@ -105,78 +287,94 @@ class ThredaPool
     }
     
 
-    struct IMessage
+    struct IMessage : public PoolObject
     {
-        ResponseData* resp_data;
+        virtual ~IMessage() { if(resp_data) resp_data->Release(); }
+
+        ResponseData* resp_data = nullptr;
         size_t callaed = 0;
+        bool counted = false; // one-shot, counted in pending
+
+        // timer state, used only by messages with a non zero delay
+        int     prio   = 0;
+        int64_t due    = 0; // steady clock, ns
+        int64_t period = 0; // ns
 
         bool repetable() { return (resp_data && resp_data->repetable.load()); }
         Rational delay() { return (resp_data) ? resp_data->delay : Rational{0, 1}; }
-        size_t ts() { return (resp_data) ? resp_data->last_ts : 0; }
-        void set_ts(size_t ts) { if(resp_data) resp_data->last_ts = ts; }
-        virtual void callimp(std::vector<uint8_t>* data, size_t* tid) = 0;
+        bool timed() { auto d = delay(); return d.num != 0 && d.den != 0; }
+        virtual void callimp(ResponseData* data) = 0;
+
+        // trace tag and name, see thread_trace.h
+        virtual size_t tid() { return 0; }
+        virtual const char* name() { return nullptr; }
 
         void call()
         {
-            callimp(&(resp_data->data), &(resp_data->tid));
-            if(!repetable())
+            callimp(resp_data);
+            if(resp_data && !repetable())
             {
                 resp_data->completed();
             }
         }
+
+        // the message will not run, completes its response as cancelled
+        virtual void cancel()
+        {
+            if(!resp_data)
+                return;
+            resp_data->repetable.store(false);
+            resp_data->cancelled.store(true);
+            resp_data->completed();
+        }
     };
 
     template<typename T, typename... ARGS>
     struct Message : public IMessage
     {
         std::tuple<ARGS...> vars;
-        srv_function<T(ARGS...)> f;
+        srv_unique_function<T(ARGS...)> f;
 
-        srv_function<void(T&)> callback = nullptr;
+        srv_unique_function<void(T&)> callback = nullptr;
 
-        void SetCallback(srv_function<void(T&)> callback)
+        void SetCallback(srv_unique_function<void(T&)> callback)
         {
-            this->callback = callback;
+            this->callback = std::move(callback);
             resp_data->owner = this;
             resp_data->callback = ResponseDataCallabc<Message<T, ARGS...>, T>;
         }
 
-        virtual void callimp(std::vector<uint8_t>* data, size_t* tid) override
+        virtual void callimp(ResponseData* data) override
         {
             if(f)
-            {
-                auto r = std::apply(f, vars);
-                *tid = typeid(T).hash_code();
-                data->resize(sizeof(r));
-                *((T*)(data->data())) = std::move(r);
-            }
+                static_cast<ResponseValue<T>*>(data)->emplace(std::apply(f, vars));
         }
+
+        virtual size_t tid() override { return f.tid(); }
     };
 
     template<typename... ARGS>
     struct Message<void, ARGS...> : public IMessage
     {
         std::tuple<ARGS...> vars;
-        srv_function<void(ARGS...)> f;
+        srv_unique_function<void(ARGS...)> f;
 
-        srv_function<void()> callback = nullptr;
+        srv_unique_function<void()> callback = nullptr;
 
-        void SetCallback(srv_function<void()> callback)
+        void SetCallback(srv_unique_function<void()> callback)
         {
-            this->callback = callback;
+            this->callback = std::move(callback);
             resp_data->owner = this;
             resp_data->callback = ResponseDataCallabc<Message<void, ARGS...>, void>;
         }
 
-        virtual void callimp(std::vector<uint8_t>* data, size_t* tid) override
+        virtual void callimp(ResponseData*) override
         {
             if(f)
-            {
                 std::apply(f, vars);
-                *tid = 0;
-                data->resize(0);
-            }
         }
+
+        virtual size_t tid() override { return f.tid(); }
     };
 
     template<typename O, typename T, typename... ARGS>
@@ -186,327 +384,1360 @@ class ThredaPool
         O* o;
         T (O::*f)(ARGS...);
 
-        srv_function<void(T&)> callback = nullptr;
+        srv_unique_function<void(T&)> callback = nullptr;
 
-        void SetCallback(srv_function<void(T&)> callback)
+        void SetCallback(srv_unique_function<void(T&)> callback)
         {
-            this->callback = callback;
+            this->callback = std::move(callback);
             resp_data->owner = this;
             resp_data->callback = ResponseDataCallabc<OMessage<O, T, ARGS...>, T>;
         }
 
-        virtual void callimp(std::vector<uint8_t>* data, size_t* tid) override
+        virtual void callimp(ResponseData* data) override
         {
             if(o && f)
+                static_cast<ResponseValue<T>*>(data)->emplace(std::apply([this](ARGS... args){ return (o->*f)(args...); }, vars));
+        }
+
+        virtual size_t tid() override { return srv_function_GETID(&f, sizeof(f)); }
+    };
+
+
+    template<typename O, typename... ARGS>
+    struct OMessage<O, void, ARGS...> : public IMessage
+    {
+        std::tuple<ARGS...> vars;
+        O* o;
+        void (O::*f)(ARGS...);
+
+        srv_unique_function<void()> callback = nullptr;
+
+        void SetCallback(srv_unique_function<void()> callback)
+        {
+            this->callback = std::move(callback);
+            resp_data->owner = this;
+            resp_data->callback = ResponseDataCallabc<OMessage<O, void, ARGS...>, void>;
+        }
+
+        virtual void callimp(ResponseData*) override
+        {
+            if(o && f)
+                std::apply([this](ARGS... args){ (o->*f)(args...); }, vars);
+        }
+
+        virtual size_t tid() override { return srv_function_GETID(&f, sizeof(f)); }
+    };
+
+    // Shared state of parallel_for / send_batch. The whole range is submitted as one message,
+    // a worker splits off the upper half only while other workers have nothing to do (lazy binary splitting).
+    struct RangeJob : public ResponseData
+    {
+        size_t grain = 1;
+        std::atomic<size_t> remaining{0};
+
+        virtual void Body(size_t begin, size_t end) = 0;
+        void Run(size_t begin, size_t end);
+    };
+
+    template<typename F>
+    struct RangeJobImpl : public RangeJob
+    {
+        F fn;
+
+        RangeJobImpl(F fn) : fn(std::move(fn)) {}
+
+        virtual void Body(size_t begin, size_t end) override
+        {
+            for(size_t i = begin; i < end; ++i)
+                fn(i);
+        }
+    };
+
+    struct RangeMessage : public IMessage
+    {
+        RangeJob* job;
+        size_t begin;
+        size_t end;
+
+        RangeMessage(RangeJob* job, size_t begin, size_t end) : job(job), begin(begin), end(end) { job->AddRef(); }
+        ~RangeMessage() { job->Release(); }
+
+        virtual void callimp(ResponseData*) override { job->Run(begin, end); }
+        virtual const char* name() override { return "parallel_for"; }
+
+        // the job completes once every index is either run or cancelled
+        virtual void cancel() override
+        {
+            job->cancelled.store(true);
+            if(job->remaining.fetch_sub(end - begin) == end - begin)
+                job->completed();
+        }
+    };
+
+public:
+    template<typename T>
+    struct Response;
+
+private:
+    // resumes a suspended coroutine, a coroutine that is not resumed any more is destroyed with the message
+    struct ResumeMessage : public IMessage
+    {
+        std::coroutine_handle<> h;
+
+        ResumeMessage(std::coroutine_handle<> h) : h(h) {}
+        ~ResumeMessage() { if(h) h.destroy(); }
+
+        virtual void callimp(ResponseData*) override
+        {
+            auto c = h;
+            h = nullptr;
+            c.resume();
+        }
+
+        virtual const char* name() override { return "coroutine"; }
+    };
+
+    // co_await on a response: resumes on the pool the coroutine was suspended on, inline when it was on none
+    struct ResumeContinuation : public Continuation
+    {
+        std::coroutine_handle<> h;
+        ThredaPool* pool = nullptr;
+        int prio = 0;
+
+        virtual void run(ResponseData*) override
+        {
+            if(pool)
+                pool->Enqueue(prio, new ResumeMessage(h));
+            else
+                h.resume();
+        }
+    };
+
+    template<typename T>
+    struct CoroutineData : public ResponseDataOf<T>
+    {
+        std::exception_ptr error;
+
+        virtual void rethrow() override { if(error) std::rethrow_exception(error); }
+    };
+
+    struct PromiseCore
+    {
+        ResponseData* data = nullptr;
+    };
+
+    // promise of a coroutine that returns Response<T>. It starts on the calling thread,
+    // the frame and its response come from ObjectPool like messages do.
+    template<typename T>
+    struct PromiseBase : public PromiseCore
+    {
+        PromiseBase()
+        {
+            data = new CoroutineData<T>();
+            data->pool = tl_pool;
+        }
+
+        // destroyed while suspended: the response completes as cancelled
+        ~PromiseBase()
+        {
+            if(!data)
+                return;
+            data->cancelled.store(true);
+            data->completed();
+            data->Release();
+        }
+
+        static void* operator new(size_t size) { return ObjectPool::Allocate(size); }
+        static void  operator delete(void* p, size_t size) { ObjectPool::Deallocate(p, size); }
+
+        CoroutineData<T>* typed() { return static_cast<CoroutineData<T>*>(data); }
+
+        Response<T> get_return_object()
+        {
+            data->AddRef();
+            return Response<T>{data};
+        }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        void unhandled_exception() { typed()->error = std::current_exception(); }
+
+        // the frame is gone before the waiters wake up
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+
+            template<typename P>
+            void await_suspend(std::coroutine_handle<P> h) noexcept
+            {
+                auto data = h.promise().data;
+                h.promise().data = nullptr;
+                h.destroy();
+                data->completed();
+                data->Release();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept { return {}; }
+    };
+
+    template<typename T, bool = std::is_void_v<T>>
+    struct CoroutinePromise : public PromiseBase<T>
+    {
+        template<typename U>
+        void return_value(U&& v) { this->typed()->emplace(std::forward<U>(v)); }
+    };
+
+    template<typename T>
+    struct CoroutinePromise<T, true> : public PromiseBase<T>
+    {
+        void return_void() {}
+    };
+
+    std::vector<std::thread> pool;
+    std::atomic_bool run{true};
+
+    // one-shot messages sent and not finished yet, quiesce() waits for zero
+    std::atomic<int64_t> pending{0};
+
+    // repeating messages stop at their next turn while set
+    std::atomic<bool> draining{false};
+
+    static constexpr int PRIORITIES = 32;
+
+    struct MessageQueue
+    {
+        SegmentedMPMCQueue<IMessage*> ring{256};
+
+        // raised before the push and dropped after the pop, so it never reads less than the queue holds
+        std::atomic<int32_t> count{0};
+
+        // serve_seq of the last pop, or of the push that made the queue non empty
+        std::atomic<uint64_t> last_served{0};
+    };
+
+    struct QueueSet
+    {
+        MessageQueue queues[PRIORITIES];
+
+        // bit p is set while queues[p].count is above zero. Lock-free: a pusher sets it after its push,
+        // a popper that takes count to zero clears it and sets it again when count rose meanwhile (see Push/Pop).
+        // It may be set for an empty queue for a moment, never clear while a pushed message waits.
+        std::atomic<uint32_t> ready_mask{0};
+        std::atomic<int>      aging_cursor{0};
+    };
+
+    // one queue set per NUMA node the pool runs on, workers serve their own node first
+    std::vector<std::unique_ptr<QueueSet>> nodes;
+
+    // pops so far, the age of a queue is measured in pops of other queues
+    std::atomic<uint64_t> serve_seq{0};
+    uint32_t              starvation_limit = 0;
+
+    std::atomic<uint64_t> stat_inversions{0};
+    std::atomic<uint64_t> stat_promotions{0};
+    std::atomic<uint64_t> stat_max_age{0};
+
+    bool greedy;
+
+    Scheduler scheduler = Scheduler::Shared;
+
+    WorkerParker parker;
+
+    // delayed and repeating messages wait in the wheel and never touch the run queues until they are due
+    static constexpr int64_t timer_tick_ns = 100000;
+
+    TimerWheel<IMessage*>  timers{uint64_t(Now() / timer_tick_ns)};
+    TTASLock               timer_locker;
+    std::atomic<size_t>    timer_count{0}; // messages in the wheel
+
+    // only the worker with the earliest deadline parks with a timeout, the rest sleep until notified
+    std::atomic<int64_t>   timer_deadline{INT64_MAX};
+
+    static inline int64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    struct Worker
+    {
+        WorkStealingDeque<IMessage*> deque;
+
+        // messages sent from threads that are not workers of this pool
+        SegmentedMPMCQueue<IMessage*> inbox{64};
+
+        uint32_t steal_seed;
+        int      node = 0;
+    };
+
+    struct Placement
+    {
+        CpuMask affinity; // empty keeps the OS default
+        int     node = 0;
+    };
+
+    std::vector<Placement> placement;
+    std::string            name;
+    int                    budget_taken = 0;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t>                  inbox_push{0};
+
+    static inline thread_local ThredaPool* tl_pool   = nullptr;
+    static inline thread_local int         tl_worker = -1;
+    static inline thread_local int         tl_node   = -1;
+
+    int HomeNode() const
+    {
+        return (tl_pool == this && tl_node >= 0) ? tl_node : 0;
+    }
+
+    int BufferIndex(int prio) const
+    {
+        prio = PRIORITIES / 2 - prio;
+        if(prio > PRIORITIES - 1)
+            prio = PRIORITIES - 1;
+        if(prio < 0)
+            prio = 0;
+        return prio;
+    }
+
+    // workers push to their own node, other threads spread over the nodes
+    void Push(IMessage* m)
+    {
+        if(nodes.size() == 1 || (tl_pool == this && tl_node >= 0))
+            Push(*nodes[HomeNode()], m);
+        else
+            Push(*nodes[inbox_push.fetch_add(1, std::memory_order_relaxed) % nodes.size()], m);
+    }
+
+    // The ready bit follows count: a pusher raises count before the push and sets the bit after it,
+    // a popper that takes count to zero clears the bit and sets it again if a push came in between.
+    void Push(QueueSet& set, IMessage* m)
+    {
+        auto&          q   = set.queues[m->prio];
+        const uint32_t bit = 1u << m->prio;
+        if(q.count.fetch_add(1) == 0)
+            q.last_served.store(serve_seq.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        q.ring.Push(m);
+        if(!(set.ready_mask.load() & bit))
+            set.ready_mask.fetch_or(bit);
+    }
+
+    IMessage* Pop(QueueSet& set, int prio)
+    {
+        auto&          q   = set.queues[prio];
+        const uint32_t bit = 1u << prio;
+        IMessage*      m   = nullptr;
+        if(!q.ring.TryPop(m))
+        {
+            // a push may be half done, the bit stays for it
+            if(q.count.load() <= 0)
             {
-                auto r = std::apply([this](ARGS... args){ return (o->*f)(args...); }, vars);
-                *tid = typeid(T).hash_code();
-                data->resize(sizeof(r));
-                *((T*)(data->data())) = std::move(r);
+                set.ready_mask.fetch_and(~bit);
+                if(q.count.load() > 0)
+                    set.ready_mask.fetch_or(bit);
+            }
+            return nullptr;
+        }
+
+        const uint64_t seq = serve_seq.fetch_add(1, std::memory_order_relaxed);
+        const uint64_t age = seq - q.last_served.load(std::memory_order_relaxed);
+        if(age > stat_max_age.load(std::memory_order_relaxed))
+            stat_max_age.store(age, std::memory_order_relaxed);
+        q.last_served.store(seq + 1, std::memory_order_relaxed);
+
+        if(q.count.fetch_sub(1) == 1)
+        {
+            set.ready_mask.fetch_and(~bit);
+            if(q.count.load() > 0)
+                set.ready_mask.fetch_or(bit);
+        }
+        return m;
+    }
+
+    void Enqueue(int prio, IMessage* m)
+    {
+        m->prio = BufferIndex(prio);
+        m->counted = !m->repetable();
+        if(m->counted)
+            pending.fetch_add(1);
+        else if(draining.load())
+        {
+            m->cancel();
+            delete m;
+            return;
+        }
+        THREAD_TRACE(Enqueue, uintptr_t(m), 0, uint32_t(pending.load(std::memory_order_relaxed)));
+        if(m->timed())
+        {
+            const auto d = m->delay();
+            m->period = d.num * int64_t(1e9) / d.den;
+            // repeating messages run right away and then once per period, like before
+            m->due    = Now() + (m->repetable() ? 0 : m->period);
+            const int64_t due = m->due;
+            ScheduleTimer(m);
+            // nobody waits for a deadline that early, a woken worker takes over
+            if(due < timer_deadline.load())
+                parker.NotifyOne();
+            return;
+        }
+
+        if(scheduler == Scheduler::WorkStealing && !workers.empty() && m->counted)
+        {
+            if(tl_pool == this && tl_worker >= 0)
+            {
+                workers[tl_worker]->deque.Push(m);
+                parker.NotifyOne();
+                return;
+            }
+            auto& w = *workers[inbox_push.fetch_add(1, std::memory_order_relaxed) % workers.size()];
+            w.inbox.Push(m);
+            parker.NotifyOne();
+            return;
+        }
+
+        Push(m);
+        parker.NotifyOne();
+    }
+
+    // one-shot message that runs once delay_ns passed
+    void EnqueueDelayed(int prio, IMessage* m, int64_t delay_ns)
+    {
+        m->prio    = BufferIndex(prio);
+        m->counted = true;
+        pending.fetch_add(1);
+        m->period  = delay_ns > 0 ? delay_ns : 1;
+        m->due     = Now() + delay_ns;
+        const int64_t due = m->due;
+        ScheduleTimer(m);
+        if(due < timer_deadline.load())
+            parker.NotifyOne();
+    }
+
+    void ScheduleTimer(IMessage* m)
+    {
+        if(m->due <= Now())
+        {
+            Push(m);
+            return;
+        }
+        timer_locker.lock();
+        timers.Schedule(m, uint64_t((m->due + timer_tick_ns - 1) / timer_tick_ns));
+        ++timer_count;
+        timer_locker.unlock();
+    }
+
+    void ExecuteTimed(IMessage* m)
+    {
+        auto data    = m->resp_data;
+        if(draining.load())
+            data->repetable.store(false);
+        bool stopped = !data->repetable.load();
+        if(!stopped)
+        {
+            THREAD_TRACE(Start, uintptr_t(m), m->tid(), 0, m->name());
+            m->callimp(data);
+            THREAD_TRACE(End, uintptr_t(m));
+            ++m->callaed;
+            // read again, stop() may race with the call
+            stopped = !data->repetable.load();
+        }
+        if(stopped)
+        {
+            data->completed();
+            delete m;
+            return;
+        }
+
+        const int64_t now = Now();
+        m->due += m->period;
+        // skip the missed periods when falling far behind
+        if(now - m->due > 3 * m->period)
+            m->due = now + m->period;
+        ScheduleTimer(m);
+    }
+
+    // zero delay repeating messages go back to the tail of their queue after every call
+    void ExecuteRepeating(IMessage* m)
+    {
+        auto data = m->resp_data;
+        if(draining.load())
+            data->repetable.store(false);
+        if(data->repetable.load())
+        {
+            THREAD_TRACE(Start, uintptr_t(m), m->tid(), 0, m->name());
+            m->callimp(data);
+            THREAD_TRACE(End, uintptr_t(m));
+            ++m->callaed;
+        }
+        if(!data->repetable.load())
+        {
+            data->completed();
+            delete m;
+            return;
+        }
+        Push(m);
+    }
+
+    void Dispatch(IMessage* m)
+    {
+        if(m->counted)
+            Execute(m);
+        else if(m->period)
+            ExecuteTimed(m);
+        else
+            ExecuteRepeating(m);
+    }
+
+    // moves due timers to the run queues
+    void AdvanceTimers()
+    {
+        if(timer_count.load(std::memory_order_relaxed) == 0 || !timer_locker.try_lock())
+            return;
+
+        size_t fired = 0;
+        const uint64_t tick = uint64_t(Now() / timer_tick_ns);
+        if(tick > timers.Current())
+            fired = timers.Advance(tick, [this](IMessage* m) { Push(m); });
+        timer_count -= fired;
+        timer_locker.unlock();
+
+        // this worker takes one, wake somebody for the rest
+        if(fired > 1)
+            parker.NotifyOne();
+    }
+
+    // how long an idle worker may park before the next timer is due, 0 when no timers
+    std::chrono::nanoseconds TimerTimeout()
+    {
+        if(timer_count.load() == 0)
+            return std::chrono::nanoseconds(0);
+        if(!timer_locker.try_lock())
+            return std::chrono::nanoseconds(timer_tick_ns);
+        int64_t wait = 0;
+        const uint64_t next = timers.NextDue();
+        if(next != UINT64_MAX)
+            wait = int64_t(next) * timer_tick_ns - Now();
+        timer_locker.unlock();
+        if(next == UINT64_MAX)
+            return std::chrono::nanoseconds(0);
+        return std::chrono::nanoseconds(wait > 1000 ? wait : 1000);
+    }
+
+    bool ClaimTimerWait(int64_t deadline)
+    {
+        int64_t cur = timer_deadline.load();
+        while(deadline < cur)
+        {
+            if(timer_deadline.compare_exchange_weak(cur, deadline))
+                return true;
+        }
+        return false;
+    }
+
+    // somebody would take a split off half right now
+    bool ShouldSplit(int prio)
+    {
+        if(THCOUNT == 0)
+            return false;
+        if(scheduler == Scheduler::WorkStealing && !workers.empty() && tl_pool == this && tl_worker >= 0)
+            return workers[tl_worker]->deque.Empty();
+        return parker.Sleepers() > 0 || nodes[HomeNode()]->queues[BufferIndex(prio)].count.load(std::memory_order_relaxed) == 0;
+    }
+
+    // a message of priority prio runs while a more urgent one waits in the queues
+    void CountInversion(int prio)
+    {
+        if(nodes[HomeNode()]->ready_mask.load(std::memory_order_relaxed) & ((1u << prio) - 1))
+            stat_inversions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Execute(IMessage* m)
+    {
+        THREAD_TRACE(Start, uintptr_t(m), m->tid(), 0, m->name());
+        m->call();
+        THREAD_TRACE(End, uintptr_t(m));
+        delete m;
+        Finished();
+    }
+
+    void Finished()
+    {
+        if(pending.fetch_sub(1) == 1)
+            ParkingLot::NotifyAll(&pending);
+    }
+
+    // waits until every one-shot message finished, a pool without threads or a worker runs them meanwhile
+    bool WaitIdle(std::chrono::nanoseconds timeout)
+    {
+        const auto until = std::chrono::steady_clock::now() + timeout;
+        auto       idle  = [this] { return pending.load() <= 0; };
+        while(!idle())
+        {
+            auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(until - std::chrono::steady_clock::now());
+            if(timeout.count() > 0 && left.count() <= 0)
+                return false;
+            if(THCOUNT == 0 || tl_pool == this)
+            {
+                if(!Process())
+                    CpuRelax();
+                continue;
+            }
+            if(timeout.count() == 0 || left > std::chrono::milliseconds(1))
+                left = std::chrono::milliseconds(1);
+            ParkingLot::Wait(&pending, idle, left);
+        }
+        return true;
+    }
+
+    // cancels the repeating timers, the delayed one-shots (sleep_for) only when all is set
+    size_t CancelQueuedTimers(bool all)
+    {
+        std::vector<IMessage*> timed;
+        timer_locker.lock();
+        timers.Clear([&](IMessage* m) { timed.push_back(m); });
+        timer_count.store(0);
+        timer_locker.unlock();
+        size_t ret = 0;
+        for(auto m : timed)
+        {
+            const bool one_shot = m->counted;
+            if(one_shot && !all)
+            {
+                ScheduleTimer(m);
+                continue;
+            }
+            m->cancel();
+            delete m;
+            if(one_shot)
+                Finished();
+            ++ret;
+        }
+        return ret;
+    }
+
+    // cancels everything queued, messages running right now finish normally; returns the count of cancelled ones
+    size_t CancelQueued()
+    {
+        size_t ret = 0;
+        auto cancel = [&](IMessage* m)
+        {
+            const bool one_shot = m->counted;
+            m->cancel();
+            delete m;
+            if(one_shot)
+                Finished();
+            ++ret;
+        };
+
+        ret += CancelQueuedTimers(true);
+
+        IMessage* m = nullptr;
+        for(auto& set : nodes)
+        {
+            for(int prio = 0; prio < PRIORITIES; ++prio)
+                while((m = Pop(*set, prio)))
+                    cancel(m);
+        }
+        for(auto& w : workers)
+        {
+            while(w->deque.Steal(m))
+                cancel(m);
+            while(w->inbox.TryPop(m))
+                cancel(m);
+        }
+        return ret;
+    }
+
+    // moves messages sent from outside to the own deque, where the other workers can steal them
+    bool TakeInbox(Worker& w)
+    {
+        IMessage* m     = nullptr;
+        int       moved = 0;
+        while(moved < 256 && w.inbox.TryPop(m))
+        {
+            w.deque.Push(m);
+            ++moved;
+        }
+        return moved > 0;
+    }
+
+    bool ProcessStealing()
+    {
+        IMessage* m = nullptr;
+        const int self = (tl_pool == this && tl_worker < int(workers.size())) ? tl_worker : -1;
+
+        if(self >= 0)
+        {
+            auto& w = *workers[self];
+            if(w.deque.Pop(m))
+            {
+                CountInversion(m->prio);
+                Execute(m);
+                return true;
+            }
+            if(TakeInbox(w))
+            {
+                if(w.deque.Pop(m))
+                {
+                    CountInversion(m->prio);
+                    Execute(m);
+                    return true;
+                }
             }
         }
-    };
-
-
-    template<typename O, typename... ARGS>
-    struct OMessage<O, void, ARGS...> : public IMessage
-    {
-        std::tuple<ARGS...> vars;
-        O* o;
-        void (O::*f)(ARGS...);
 
-        srv_function<void()> callback = nullptr;
+        const size_t count = workers.size();
+        uint32_t seed = (self >= 0) ? workers[self]->steal_seed : uint32_t(size_t(&m) >> 4);
+        seed = seed * 1664525u + 1013904223u;
+        if(self >= 0)
+            workers[self]->steal_seed = seed;
 
-        void SetCallback(srv_function<void()> callback)
+        // workers of the same NUMA node are robbed first
+        const size_t start = seed % count;
+        const int    node  = (self >= 0 && nodes.size() > 1) ? workers[self]->node : -1;
+        for(int pass = (node >= 0) ? 0 : 1; pass < 2; ++pass)
         {
-            this->callback = callback;
-            resp_data->owner = this;
-            resp_data->callback = ResponseDataCallabc<OMessage<O, void, ARGS...>, void>;
+            for(size_t i = 0; i < count; ++i)
+            {
+                const size_t victim = (start + i) % count;
+                if(int(victim) == self || (pass == 0 && workers[victim]->node != node))
+                    continue;
+                if(workers[victim]->deque.Steal(m))
+                {
+                    THREAD_TRACE(Steal, uintptr_t(m), 0, uint32_t(victim));
+                    CountInversion(m->prio);
+                    Execute(m);
+                    return true;
+                }
+            }
         }
 
-        virtual void callimp(std::vector<uint8_t>* data, size_t* tid) override
+        // a busy worker does not look at its inbox, take one message from it
+        for(size_t i = 0; i < count; ++i)
         {
-            if(o && f)
+            if(int((start + i) % count) == self)
+                continue;
+            if(workers[(start + i) % count]->inbox.TryPop(m))
             {
-                std::apply([this](ARGS... args){ (o->*f)(args...); }, vars);
-                *tid = 0;
-                data->resize(0);
+                CountInversion(m->prio);
+                Execute(m);
+                return true;
             }
         }
+        return false;
+    }
+
+public:
+    bool Process()
+    {
+        AdvanceTimers();
+        if(scheduler == Scheduler::WorkStealing && !workers.empty() && ProcessStealing())
+            return true;
+        return ProcessQueues();
+    }
+
+    struct PriorityStats
+    {
+        uint64_t inversions;            // a message ran while a more urgent one was queued
+        uint64_t starvation_promotions; // a queue was served out of order because it waited too long
+        uint64_t max_age;               // longest wait of a queue head, in pops of other queues
     };
 
-    std::vector<std::thread> pool;
-    std::atomic_bool run{true};
-    
-    size_t buffer_mask = 0xff;
-    
-    LockFreeList<IMessage*> buffers[32];
-    size_t buffer_offset = 0;
-    size_t buffer_offset_push = 0;
+    PriorityStats GetPriorityStats() const
+    {
+        return { stat_inversions.load(), stat_promotions.load(), stat_max_age.load() };
+    }
 
-    SpinLocker rm_locker;
-    
-    bool greedy;
+    void ResetPriorityStats()
+    {
+        stat_inversions.store(0);
+        stat_promotions.store(0);
+        stat_max_age.store(0);
+    }
 
-public:
-    bool Process()
+    // serve a queue out of priority order once its head waited this many pops, 0 keeps strict priorities
+    void SetStarvationLimit(uint32_t pops) { starvation_limit = pops; }
+
+private:
+    bool ProcessQueues()
+    {
+        // own node first, then take work from the other nodes
+        const size_t home = HomeNode();
+        for(size_t i = 0; i < nodes.size(); ++i)
+            if(ProcessQueues(*nodes[(home + i) % nodes.size()]))
+                return true;
+        return false;
+    }
+
+    bool ProcessQueues(QueueSet& set)
     {
-        for(int prio = 0; prio < sizeof(buffers) / sizeof(buffers[0]); ++prio)
+        for(int attempt = 0; attempt < 4; ++attempt)
         {
-            auto& buffer = buffers[prio];
-            int i = 0;
-            if(rm_locker.try_lock())
+            const uint32_t mask = set.ready_mask.load(std::memory_order_acquire);
+            if(!mask)
+                return false;
+            int prio = std::countr_zero(mask);
+
+            // aging: look at one more queue per pop, round robin over the non empty ones
+            if(starvation_limit)
             {
-                i = 1;
-                while(i)
+                const int      cursor = set.aging_cursor.load(std::memory_order_relaxed) & (PRIORITIES - 1);
+                const uint32_t after  = mask & (~0u << cursor);
+                const int      other  = std::countr_zero(after ? after : mask);
+                set.aging_cursor.store(other + 1, std::memory_order_relaxed);
+                if(other != prio && serve_seq.load(std::memory_order_relaxed) - set.queues[other].last_served.load(std::memory_order_relaxed) > starvation_limit)
                 {
-                    i = 0;
-                    for(auto mess : buffer)
-                    {
-                        if(!mess->repetable() && mess->callaed)
-                        {
-                            buffer.RemoveNode(mess);
-                            ++i;
-                            break;
-                        }
-                    }
+                    prio = other;
+                    stat_promotions.fetch_add(1, std::memory_order_relaxed);
                 }
-                rm_locker.unlock();
             }
-            for(auto mess : buffer)
+
+            if(IMessage* m = Pop(set, prio))
             {
-                if(!mess->repetable() && mess->callaed)
-                    continue;
-                if(mess->repetable())
-                {
-                    const auto del = mess->delay();
-                    auto now = std::chrono::high_resolution_clock::now();
-                    const size_t ts = Rational::rescale(
-                        std::chrono::duration_cast<std::chrono::nanoseconds>(
-                            now.time_since_epoch()
-                        ).count(), 
-                        {1, int(1e9)}, 
-                        del
-                    );
-                    const size_t tts = mess->ts() + 1;
-                    if(mess->delay().den && (tts > ts))
-                        continue;
-
-                    if(ts - tts > 3)
-                        mess->set_ts(ts);
-                    else
-                        mess->set_ts(tts);
-                }
-                mess->call();
-                ++mess->callaed;
-                ++i;
+                Dispatch(m);
+                return true;
             }
-            if(i > 0) return true;
         }
         return false;
     }
-private:
+
     static void ThredaPoolThread(ThredaPool* self, int id)
     {
-        if(id != 0 || !self->greedy)
-            while(self->run.load()) if(self->Process() == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        else
-            while(self->run.load()) if(self->Process() == 0) std::this_thread::yield();
+        tl_pool   = self;
+        tl_worker = id;
+        tl_node   = self->placement[id].node;
+
+        if(!self->placement[id].affinity.Empty())
+            SetCurrentThreadAffinity(self->placement[id].affinity);
+        SetCurrentThreadName(self->name + "#" + std::to_string(id));
+        THREAD_TRACE_THREAD_NAME(self->name + "#" + std::to_string(id));
+
+        // greedy thread spins longer before it parks
+        AdaptiveSpin spin = (id == 0 && self->greedy) ? AdaptiveSpin(1024, 65536) : AdaptiveSpin();
+        // a message is the frame of a worker
+        FrameArena& arena = FrameArena::Local();
+        while(self->run.load())
+        {
+            if(self->Process())
+            {
+                arena.Reset();
+                spin.Reset();
+                continue;
+            }
+            if(spin.count == 0)
+                THREAD_TRACE(Spin, 0);
+            if(spin.Spin())
+                continue;
+
+            auto key = self->parker.PrepareWait();
+            if(!self->run.load() || self->Process())
+            {
+                self->parker.CancelWait();
+                arena.Reset();
+                spin.Reset();
+                continue;
+            }
+            auto start    = std::chrono::steady_clock::now();
+            auto timeout  = self->TimerTimeout();
+            auto deadline = Now() + timeout.count();
+            if(timeout.count() > 0 && !self->ClaimTimerWait(deadline))
+                timeout = std::chrono::nanoseconds(0);
+
+            THREAD_TRACE(Park, 0);
+            const bool notified = self->parker.CommitWait(key, timeout);
+            THREAD_TRACE(Wake, 0);
+            if(timeout.count() > 0)
+                self->timer_deadline.compare_exchange_strong(deadline, INT64_MAX);
+
+            // a timer wakeup says nothing about how bursty the work is
+            if(notified)
+                spin.Parked(std::chrono::steady_clock::now() - start);
+            else
+                spin.Reset();
+        }
+    }
+
+    void Place(const Config& config)
+    {
+        const auto& topology = CpuTopology::Get();
+        const bool  restricted = !(config.cores & topology.All()).Empty();
+        const CpuMask allowed  = restricted ? (config.cores & topology.All()) : topology.All();
+
+        std::vector<int> used;
+        for(int n = 0; n < topology.Nodes(); ++n)
+            if(!(topology.NodeMask(n) & allowed).Empty())
+                used.push_back(n);
+        const bool numa = config.numa_local && used.size() > 1;
+
+        nodes.resize(numa ? used.size() : 1);
+        for(auto& n : nodes)
+            n = std::make_unique<QueueSet>();
+
+        // workers take the nodes in turn, so a small pool still spreads over the whole mask
+        std::vector<int> order;
+        for(int k = 0; k < allowed.Count(); ++k)
+            for(int n : used)
+            {
+                const int cpu = (topology.NodeMask(n) & allowed).Nth(k);
+                if(cpu >= 0)
+                    order.push_back(cpu);
+            }
+
+        placement.resize(THCOUNT);
+        for(int i = 0; i < THCOUNT && !order.empty(); ++i)
+        {
+            const int cpu  = order[i % order.size()];
+            const int node = topology.NodeOf(cpu);
+            auto&     p    = placement[i];
+            for(size_t k = 0; numa && k < used.size(); ++k)
+                if(used[k] == node)
+                    p.node = int(k);
+
+            if(config.pin_workers)
+                p.affinity.Set(cpu);
+            else if(numa)
+                p.affinity = topology.NodeMask(node) & allowed;
+            else if(restricted)
+                p.affinity = allowed;
+        }
     }
 
 public:
-    ThredaPool(unsigned char count = 16, bool greedy = true) : THCOUNT(count), greedy(greedy)
+    ThredaPool(unsigned char count = 16, bool greedy = true, Scheduler scheduler = Scheduler::Shared) : ThredaPool(Config{count, greedy, scheduler}) {}
+
+    ThredaPool(const Config& config) : greedy(config.greedy), scheduler(config.scheduler), name(config.name)
     {
+        int count = config.threads < 0 ? 0 : (config.threads > 255 ? 255 : config.threads);
+        if(config.use_budget && count > 0)
+        {
+            // a pool asked for workers keeps at least one, somebody may wait on its messages
+            budget_taken = WorkerBudget::Global().Acquire(count, 1);
+            count        = budget_taken;
+        }
+        THCOUNT = (unsigned char)count;
+
+        Place(config);
+
+        if(scheduler == Scheduler::WorkStealing)
+        {
+            workers.resize(THCOUNT);
+            for(int i = 0; i < THCOUNT; i++)
+            {
+                workers[i] = std::make_unique<Worker>();
+                workers[i]->steal_seed = 0x9E3779B9u * (i + 1);
+                workers[i]->node       = placement[i].node;
+            }
+        }
         pool.resize(THCOUNT);
         for(int i = 0; i < THCOUNT; i++)
         {
             pool[i] = std::thread(ThredaPoolThread, this, i);
-            pool[i].detach();
         }
     }
     
+    // Future of a sent message. Copies share the same state, the value is kept until the last copy dies.
+    // Also the return type of coroutines, see schedule().
     template<typename T>
     struct Response
     {
-        ResponseData* _data;
-        srv_function<void(T&)> callback = nullptr;
+        using promise_type = CoroutinePromise<T>;
 
-        void SetCallback(srv_function<void(T&)> callback)
+        using callback_t = std::conditional_t<std::is_void_v<T>, void(), void(std::conditional_t<std::is_void_v<T>, int, T>&)>;
+
+        ResponseData* _data = nullptr;
+
+        Response() = default;
+        explicit Response(ResponseData* data) : _data(data) {}
+        Response(const Response& o) : _data(o._data) { if(_data) _data->AddRef(); }
+        Response(Response&& o) noexcept : _data(o._data) { o._data = nullptr; }
+        Response& operator=(Response o) noexcept { std::swap(_data, o._data); return *this; }
+        ~Response() { if(_data) _data->Release(); }
+
+        bool valid() const { return _data; }
+
+        // runs on the thread that completes the message
+        void SetCallback(srv_unique_function<callback_t> callback)
         {
-            this->callback = callback;
-            _data->owner = this;
-            _data->callback = ResponseDataCallabc<Response<T>, T>;
-        }
-        
-        inline void wait() 
-        { 
-            auto& not_completed = _data->not_completed;
-            while (true) 
+            struct CallbackContinuation : public Continuation
             {
-                if (!not_completed.load()) return;
+                srv_unique_function<callback_t> callback;
 
-                while (not_completed.load());
-            }
+                virtual void run(ResponseData* src) override
+                {
+                    if(src->cancelled.load() || Error(src) || !HasValue(src))
+                        return;
+                    if constexpr (std::is_void_v<T>)
+                        callback();
+                    else
+                        callback(static_cast<ResponseValue<T>*>(src)->value());
+                }
+            };
+            auto c = new CallbackContinuation();
+            c->callback = std::move(callback);
+            _data->AddContinuation(c);
+        }
+
+        inline void wait()
+        {
+            _data->Wait(std::chrono::nanoseconds(0));
         }
-                
-        inline void stop() 
-        { 
+
+        // false when the timeout expired first
+        template<typename Rep, typename Period>
+        bool wait_for(std::chrono::duration<Rep, Period> timeout)
+        {
+            const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout);
+            return _data->Wait(ns.count() > 0 ? ns : std::chrono::nanoseconds(1));
+        }
+
+        inline void stop()
+        {
             _data->repetable.store(false);
         }
 
         bool completed()
         {
-            return !_data->not_completed.load();
+            return _data->IsCompleted();
+        }
+
+        // true when the message was dropped by drain() or pool shutdown without running
+        bool cancelled()
+        {
+            return _data->cancelled.load();
         }
-        
+
+        // throws std::runtime_error when the message was cancelled, or what the coroutine threw
         T get()
         {
             wait();
-            auto tid = _data->tid;
-            auto data = std::move(_data->data);
-            delete _data;
-            if(tid != typeid(T).hash_code())
+            return take();
+        }
+
+        operator T() requires (!std::is_void_v<T>)
+        {
+            return get();
+        }
+
+        // schedules f(value) on the pool of this response once it completes
+        template<typename F>
+        auto then(F f, int prio = 0)
+        {
+            using U = typename std::conditional_t<std::is_void_v<T>, std::invoke_result<F&>, std::invoke_result<F&, std::add_lvalue_reference_t<T>>>::type;
+
+            struct ThenContinuation : public Continuation
+            {
+                IMessage* m;
+
+                virtual ~ThenContinuation() { delete m; }
+                virtual void run(ResponseData* src) override
+                {
+                    auto msg = m;
+                    m = nullptr;
+                    // what the source threw goes on to the result, get() on it throws the same
+                    if(auto error = Error(src))
+                    {
+                        static_cast<CoroutineData<U>*>(msg->resp_data)->error = error;
+                        msg->resp_data->completed();
+                        delete msg;
+                    }
+                    // cancelled, or an empty function left no value to pass on
+                    else if(src->cancelled.load() || !HasValue(src))
+                    {
+                        msg->cancel();
+                        delete msg;
+                    }
+                    else if(src->pool)
+                        src->pool->Enqueue(msg->resp_data->prio, msg);
+                    else
+                    {
+                        msg->call();
+                        delete msg;
+                    }
+                }
+            };
+
+            Response src = *this;
+            auto m = new Message<U>();
+            m->f = srv_unique_function<U()>([src, f = std::move(f)]() mutable -> U
+            {
+                if constexpr (std::is_void_v<T>)
+                    return f();
+                else
+                    return f(static_cast<ResponseValue<T>*>(src._data)->value());
+            });
+            m->resp_data = new CoroutineData<U>();
+            m->resp_data->pool = _data->pool;
+            m->resp_data->prio = prio;
+            m->resp_data->AddRef();
+            Response<U> ret{m->resp_data};
+
+            auto c = new ThenContinuation();
+            c->m = m;
+            _data->AddContinuation(c);
+            return ret;
+        }
+
+        // co_await in a coroutine: suspends until the response completed and returns get()
+        struct Awaiter
+        {
+            Response src;
+
+            bool await_ready() { return src._data->IsCompleted(); }
+
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                auto c  = new ResumeContinuation();
+                c->h    = h;
+                c->pool = tl_pool;
+                c->prio = src._data->prio;
+                // the coroutine may resume and finish right here, together with this awaiter
+                auto data = src._data;
+                data->AddRef();
+                data->AddContinuation(c);
+                data->Release();
+            }
+
+            // a continuation may resume the coroutine before the response counts as completed
+            T await_resume() { return src.take(); }
+        };
+
+        Awaiter operator co_await() const { return Awaiter{ *this }; }
+
+    private:
+        static std::exception_ptr Error(ResponseData* src)
+        {
+            try
+            {
+                src->rethrow();
+            }
+            catch(...)
             {
-                throw std::runtime_error("incomparable values");
+                return std::current_exception();
             }
-            return std::move(*((T*)(data.data())));
+            return nullptr;
+        }
+
+        static bool HasValue(ResponseData* src)
+        {
+            if constexpr (std::is_void_v<T>)
+                return true;
+            else
+                return static_cast<ResponseValue<T>*>(src)->has_value;
         }
 
-        operator T()
+        T take()
         {
-            return std::move(get());
+            _data->rethrow();
+            if(_data->cancelled.load())
+                throw std::runtime_error("ThredaPool: message was cancelled");
+            if constexpr (!std::is_void_v<T>)
+            {
+                auto& value = static_cast<ResponseValue<T>*>(_data)->value();
+                // other copies and continuations attached later see the value too, it is moved out only
+                // when this copy holds the last reference. A move-only value can be taken once.
+                if constexpr (std::is_copy_constructible_v<T>)
+                {
+                    if(_data->refs.load(std::memory_order_acquire) != 1)
+                        return value;
+                }
+                return std::move(value);
+            }
         }
     };
 
-    template<>
-    struct Response<void>
+private:
+    struct JoinContinuation : public Continuation
     {
-        ResponseData* _data;
-        srv_function<void()> callback = nullptr;
+        ResponseData* out;
+        size_t index;
+        bool any;
 
-        void SetCallback(srv_function<void()> callback)
+        virtual ~JoinContinuation() { out->Release(); }
+        virtual void run(ResponseData*) override
         {
-            this->callback = callback;
-            _data->owner = this;
-            _data->callback = ResponseDataCallabc<Response<void>, void>;
-        }
-        
-        inline void wait() 
-        { 
-            auto& not_completed = _data->not_completed;
-            while (true) 
+            if(any)
             {
-                if (!not_completed.load()) return;
-
-                while (not_completed.load());
+                uint32_t expected = 1;
+                if(out->join_pending.compare_exchange_strong(expected, 0))
+                {
+                    static_cast<ResponseValue<size_t>*>(out)->emplace(index);
+                    out->completed();
+                }
             }
+            else if(out->join_pending.fetch_sub(1) == 1)
+                out->completed();
         }
-                
-        inline void stop() 
+    };
+
+    static void Join(ResponseData* out, ResponseData* const* in, size_t count, bool any)
+    {
+        out->pool = count ? in[0]->pool : nullptr;
+        out->join_pending.store(any ? 1 : uint32_t(count));
+        if(count == 0)
         {
-            _data->repetable.store(false);
+            out->completed();
+            return;
         }
-
-        bool completed()
+        for(size_t i = 0; i < count; ++i)
         {
-            return !_data->not_completed.load();
+            auto c = new JoinContinuation();
+            out->AddRef();
+            c->out = out;
+            c->index = i;
+            c->any = any;
+            in[i]->AddContinuation(c);
         }
-    };
+    }
+
+public:
+    // completes when every response completed
+    template<typename T>
+    static Response<void> when_all(const std::vector<Response<T>>& responses)
+    {
+        std::vector<ResponseData*> in;
+        in.reserve(responses.size());
+        for(auto& r : responses)
+            in.push_back(r._data);
+        auto out = new ResponseData();
+        Join(out, in.data(), in.size(), false);
+        return Response<void>{out};
+    }
+
+    template<typename... T>
+    static Response<void> when_all(const Response<T>&... responses)
+    {
+        ResponseData* in[] = { responses._data..., nullptr };
+        auto out = new ResponseData();
+        Join(out, in, sizeof...(T), false);
+        return Response<void>{out};
+    }
+
+    // completes with the index of the first completed response
+    template<typename T>
+    static Response<size_t> when_any(const std::vector<Response<T>>& responses)
+    {
+        std::vector<ResponseData*> in;
+        in.reserve(responses.size());
+        for(auto& r : responses)
+            in.push_back(r._data);
+        auto out = new ResponseValue<size_t>();
+        Join(out, in.data(), in.size(), true);
+        return Response<size_t>{out};
+    }
+
+    template<typename... T>
+    static Response<size_t> when_any(const Response<T>&... responses)
+    {
+        ResponseData* in[] = { responses._data..., nullptr };
+        auto out = new ResponseValue<size_t>();
+        Join(out, in, sizeof...(T), true);
+        return Response<size_t>{out};
+    }
 
 private:
 
+    template<typename F>
+    Response<void> impParallelFor(int prio, size_t begin, size_t end, size_t grain, F fn)
+    {
+        auto job = new RangeJobImpl<F>(std::move(fn));
+        job->pool = this;
+        job->prio = prio;
+        job->grain = grain ? grain : 1;
+        job->remaining.store(end > begin ? end - begin : 0);
+        Response<void> ret{job};
+        if(end <= begin)
+        {
+            job->completed();
+            return ret;
+        }
+        Enqueue(prio, new RangeMessage(job, begin, end));
+        return ret;
+    }
+
     template<typename T, typename... ARGS>
-    Response<T> impSend(int prio, srv_function<T(ARGS...)> f, srv_function<void(T&)> callback, Rational delay, ARGS... vars) 
+    Response<T> impSend(int prio, srv_unique_function<T(ARGS...)> f, srv_unique_function<void(T&)> callback, Rational delay, ARGS... vars) 
     {
-        prio = (sizeof(buffers) / sizeof(buffers[0])) / 2-prio;
-        if(prio > sizeof(buffers) / sizeof(buffers[0]) - 1)
-            prio = sizeof(buffers) / sizeof(buffers[0]) - 1;
-        if(prio < 0)
-            prio = 0;
-        
-        auto& buffer = buffers[prio];
         auto m = new Message<T, ARGS...>();
         m->vars = {vars...};
-        m->f = f;
-        m->resp_data = new ResponseData();
+        m->f = std::move(f);
+        m->resp_data = new ResponseDataOf<T>();
+        m->resp_data->pool = this;
+        m->resp_data->prio = prio;
         m->resp_data->repetable = delay.den != 0;
         m->resp_data->delay = delay;
         if(callback)
-            m->SetCallback(callback);
-        buffer.AddNode(m);
+            m->SetCallback(std::move(callback));
+        auto resp_data = m->resp_data;
+        resp_data->AddRef();
+        Enqueue(prio, m);
 
-        return Response<T>{m->resp_data};
+        return Response<T>{resp_data};
     }
     
     template<typename O, typename T, typename... ARGS>
-    Response<T> impSend(int prio, O* owner, T (O::*func)(ARGS...), srv_function<void(T&)> callback, Rational delay, ARGS... vars) 
+    Response<T> impSend(int prio, O* owner, T (O::*func)(ARGS...), srv_unique_function<void(T&)> callback, Rational delay, ARGS... vars) 
     {
-        prio = (sizeof(buffers) / sizeof(buffers[0])) / 2-prio;
-        if(prio > sizeof(buffers) / sizeof(buffers[0]) - 1)
-            prio = sizeof(buffers) / sizeof(buffers[0]) - 1;
-        if(prio < 0)
-            prio = 0;
-
-        auto& buffer = buffers[prio];
         auto m = new OMessage<O, T, ARGS...>();
         m->vars = {vars...};
         m->f = func;
         m->o = owner;
-        m->resp_data = new ResponseData();
-        m->resp_data->repetable = delay != 0;
+        m->resp_data = new ResponseDataOf<T>();
+        m->resp_data->pool = this;
+        m->resp_data->prio = prio;
+        m->resp_data->repetable = delay.den != 0;
         m->resp_data->delay = delay;
         if(callback)
-            m->SetCallback(callback);
-        buffer.AddNode(m);
+            m->SetCallback(std::move(callback));
+        auto resp_data = m->resp_data;
+        resp_data->AddRef();
+        Enqueue(prio, m);
 
-        return Response<T>{m->resp_data};
+        return Response<T>{resp_data};
     }
 
     template<typename... ARGS>
-    Response<void> impSend(int prio, srv_function<void(ARGS...)> f, srv_function<void()> callback, Rational delay, ARGS... vars) 
+    Response<void> impSend(int prio, srv_unique_function<void(ARGS...)> f, srv_unique_function<void()> callback, Rational delay, ARGS... vars) 
     {
-        prio = (sizeof(buffers) / sizeof(buffers[0])) / 2-prio;
-        if(prio > sizeof(buffers) / sizeof(buffers[0]) - 1)
-            prio = sizeof(buffers) / sizeof(buffers[0]) - 1;
-        if(prio < 0)
-            prio = 0;
-        
-        auto& buffer = buffers[prio];
         auto m = new Message<void, ARGS...>();
         m->vars = {vars...};
-        m->f = f;
+        m->f = std::move(f);
         m->resp_data = new ResponseData();
+        m->resp_data->pool = this;
+        m->resp_data->prio = prio;
         m->resp_data->repetable = delay.den != 0;
         m->resp_data->delay = delay;
         if(callback)
-            m->SetCallback(callback);
-        buffer.AddNode(m);
+            m->SetCallback(std::move(callback));
+        auto resp_data = m->resp_data;
+        resp_data->AddRef();
+        Enqueue(prio, m);
 
-        return Response<void>{m->resp_data};
+        return Response<void>{resp_data};
     }
     
     template<typename O, typename... ARGS>
-    Response<void> impSend(int prio, O* owner, void (O::*func)(ARGS...), srv_function<void()> callback, Rational delay, ARGS... vars) 
+    Response<void> impSend(int prio, O* owner, void (O::*func)(ARGS...), srv_unique_function<void()> callback, Rational delay, ARGS... vars) 
     {
-        prio = (sizeof(buffers) / sizeof(buffers[0])) / 2-prio;
-        if(prio > sizeof(buffers) / sizeof(buffers[0]) - 1)
-            prio = sizeof(buffers) / sizeof(buffers[0]) - 1;
-        if(prio < 0)
-            prio = 0;
-
-        auto& buffer = buffers[prio];
         auto m = new OMessage<O, void, ARGS...>();
         m->vars = {vars...};
         m->f = func;
         m->o = owner;
         m->resp_data = new ResponseData();
-        m->resp_data->repetable = delay != 0;
+        m->resp_data->pool = this;
+        m->resp_data->prio = prio;
+        m->resp_data->repetable = delay.den != 0;
         m->resp_data->delay = delay;
         if(callback)
-            m->SetCallback(callback);
-        buffer.AddNode(m);
+            m->SetCallback(std::move(callback));
+        auto resp_data = m->resp_data;
+        resp_data->AddRef();
+        Enqueue(prio, m);
 
-        return Response<void>{m->resp_data};
+        return Response<void>{resp_data};
     }
 
 public:
@@ -516,201 +1747,356 @@ public:
     //------------------------------------------------------------------------------------------------------------------------------------------------
 
     template<typename C, typename T, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>>
-    Response<T>     operator()(int prio, C f, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_function<T(ARGS...)>(f), nullptr, {0, 0}, vars...);}
+    Response<T>     operator()(int prio, C f, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_unique_function<T(ARGS...)>(std::move(f)), nullptr, {0, 0}, vars...);}
 
     template<typename C, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>>
-    Response<void>  operator()(int prio, C f, ARGS... vars) { return impSend<ARGS...>(prio, srv_function<void(ARGS...)>(f), nullptr, {0, 0}, vars...);}
+    Response<void>  operator()(int prio, C f, ARGS... vars) { return impSend<ARGS...>(prio, srv_unique_function<void(ARGS...)>(std::move(f)), nullptr, {0, 0}, vars...);}
 
     template<typename O, typename T, typename... ARGS>
     Response<T>     operator()(int prio, O* o, T (O::*f)(ARGS...), ARGS... vars) { return impSend<O, T, ARGS...>(prio, o, f, nullptr, {0, 0}, vars...);}
 
 
     template<typename C, typename T, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>>
-    Response<T>     send(int prio, C f, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_function<T(ARGS...)>(f), nullptr, {0, 0}, vars...);}
+    Response<T>     send(int prio, C f, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_unique_function<T(ARGS...)>(std::move(f)), nullptr, {0, 0}, vars...);}
 
     template<typename C, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>>
-    Response<void>  send(int prio, C f, ARGS... vars) { return impSend<ARGS...>(prio, srv_function<void(ARGS...)>(f), nullptr, {0, 0}, vars...);}
+    Response<void>  send(int prio, C f, ARGS... vars) { return impSend<ARGS...>(prio, srv_unique_function<void(ARGS...)>(std::move(f)), nullptr, {0, 0}, vars...);}
 
     template<typename O, typename T, typename... ARGS>
     Response<T>     send(int prio, O* o, T (O::*f)(ARGS...), ARGS... vars) { return impSend<O, T, ARGS...>(prio, o, f, nullptr, {0, 0}, vars...);}
 
     
     template<typename C, typename T, typename Call, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_with_callback(int prio, C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_function<T(ARGS...)>(f), callback, {0, 0}, vars...);}
+    Response<T>     send_with_callback(int prio, C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_unique_function<T(ARGS...)>(std::move(f)), std::move(callback), {0, 0}, vars...);}
 
     template<typename C, typename Call, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void()>::template check_callable<Call>>
-    Response<void>  send_with_callback(int prio, C f, Call callback, ARGS... vars) { return impSend<ARGS...>(prio, srv_function<void(ARGS...)>(f), callback, {0, 0}, vars...);}
+    Response<void>  send_with_callback(int prio, C f, Call callback, ARGS... vars) { return impSend<ARGS...>(prio, srv_unique_function<void(ARGS...)>(std::move(f)), std::move(callback), {0, 0}, vars...);}
 
     template<typename O, typename T, typename Call, typename... ARGS, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_with_callback(int prio, O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(prio, o, f, callback, {0, 0}, vars...);}
+    Response<T>     send_with_callback(int prio, O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(prio, o, f, std::move(callback), {0, 0}, vars...);}
     
 
     template<typename C, typename T, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>>
-    Response<T>     send_repetable(int prio, C f, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_function<T(ARGS...)>(f), nullptr, {0, 1}, vars...);}
+    Response<T>     send_repetable(int prio, C f, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_unique_function<T(ARGS...)>(std::move(f)), nullptr, {0, 1}, vars...);}
     
     template<typename C, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>>
-    Response<void>  send_repetable(int prio, C f, ARGS... vars) { return impSend<ARGS...>(prio, srv_function<void(ARGS...)>(f), nullptr, {0, 1}, vars...);}
+    Response<void>  send_repetable(int prio, C f, ARGS... vars) { return impSend<ARGS...>(prio, srv_unique_function<void(ARGS...)>(std::move(f)), nullptr, {0, 1}, vars...);}
 
     template<typename O, typename T, typename... ARGS>
     Response<T>     send_repetable(int prio, O* o, T (O::*f)(ARGS...), ARGS... vars) { return impSend<O, T, ARGS...>(prio, o, f, nullptr, {0, 1}, vars...);}
 
 
     template<typename C, typename T, typename Call, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_repetable_with_callback(int prio, C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_function<T(ARGS...)>(f), callback, {0, 1}, vars...);}
+    Response<T>     send_repetable_with_callback(int prio, C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_unique_function<T(ARGS...)>(std::move(f)), std::move(callback), {0, 1}, vars...);}
 
     template<typename C, typename Call, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void()>::template check_callable<Call>>
-    Response<void>  send_repetable_with_callback(int prio, C f, Call callback, ARGS... vars) { return impSend<ARGS...>(prio, srv_function<void(ARGS...)>(f), callback, {0, 1}, vars...);}
+    Response<void>  send_repetable_with_callback(int prio, C f, Call callback, ARGS... vars) { return impSend<ARGS...>(prio, srv_unique_function<void(ARGS...)>(std::move(f)), std::move(callback), {0, 1}, vars...);}
 
     template<typename O, typename T, typename Call, typename... ARGS, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_repetable_with_callback(int prio, O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(prio, o, f, callback, {0, 1}, vars...);}
+    Response<T>     send_repetable_with_callback(int prio, O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(prio, o, f, std::move(callback), {0, 1}, vars...);}
     
 
     template<typename C, typename T, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>>
-    Response<T>     send_delayed_repetable(int prio, unsigned int delay_ms, C f, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_function<T(ARGS...)>(f), nullptr, {delay_ms, 1000}, vars...);}
+    Response<T>     send_delayed_repetable(int prio, unsigned int delay_ms, C f, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_unique_function<T(ARGS...)>(std::move(f)), nullptr, {delay_ms, 1000}, vars...);}
     
     template<typename C, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>>
-    Response<void>  send_delayed_repetable(int prio, unsigned int delay_ms, C f, ARGS... vars) { return impSend<ARGS...>(prio, srv_function<void(ARGS...)>(f), nullptr, {delay_ms, 1000}, vars...);}
+    Response<void>  send_delayed_repetable(int prio, unsigned int delay_ms, C f, ARGS... vars) { return impSend<ARGS...>(prio, srv_unique_function<void(ARGS...)>(std::move(f)), nullptr, {delay_ms, 1000}, vars...);}
 
     template<typename O, typename T, typename... ARGS>
     Response<T>     send_delayed_repetable(int prio, unsigned int delay_ms, O* o, T (O::*f)(ARGS...), ARGS... vars) { return impSend<O, T, ARGS...>(prio, o, f, nullptr, {delay_ms, 1000}, vars...);}
 
     
     template<typename C, typename T, typename Call, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_delayed_repetable_with_callback(int prio, unsigned int delay_ms, C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_function<T(ARGS...)>(f), callback, {delay_ms, 1000}, vars...);}
+    Response<T>     send_delayed_repetable_with_callback(int prio, unsigned int delay_ms, C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_unique_function<T(ARGS...)>(std::move(f)), std::move(callback), {delay_ms, 1000}, vars...);}
 
     template<typename C, typename Call, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void()>::template check_callable<Call>>
-    Response<void>  send_delayed_repetable_with_callback(int prio, unsigned int delay_ms, C f, Call callback, ARGS... vars) { return impSend<ARGS...>(prio, srv_function<void(ARGS...)>(f), callback, {delay_ms, 1000}, vars...);}
+    Response<void>  send_delayed_repetable_with_callback(int prio, unsigned int delay_ms, C f, Call callback, ARGS... vars) { return impSend<ARGS...>(prio, srv_unique_function<void(ARGS...)>(std::move(f)), std::move(callback), {delay_ms, 1000}, vars...);}
 
     template<typename O, typename T, typename Call, typename... ARGS, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_delayed_repetable_with_callback(int prio, unsigned int delay_ms, O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(prio, o, f, callback, {delay_ms, 1000}, vars...);}
+    Response<T>     send_delayed_repetable_with_callback(int prio, unsigned int delay_ms, O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(prio, o, f, std::move(callback), {delay_ms, 1000}, vars...);}
     
 
     template<typename C, typename T, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>>
-    Response<T>     send_delayed_repetable(int prio, Rational delay, C f, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_function<T(ARGS...)>(f), nullptr, delay vars...);}
+    Response<T>     send_delayed_repetable(int prio, Rational delay, C f, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_unique_function<T(ARGS...)>(std::move(f)), nullptr, delay, vars...);}
     
     template<typename C, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>>
-    Response<void>  send_delayed_repetable(int prio, Rational delay, C f, ARGS... vars) { return impSend<ARGS...>(prio, srv_function<void(ARGS...)>(f), nullptr, delay, vars...);}
+    Response<void>  send_delayed_repetable(int prio, Rational delay, C f, ARGS... vars) { return impSend<ARGS...>(prio, srv_unique_function<void(ARGS...)>(std::move(f)), nullptr, delay, vars...);}
 
     template<typename O, typename T, typename... ARGS>
     Response<T>     send_delayed_repetable(int prio, Rational delay, O* o, T (O::*f)(ARGS...), ARGS... vars) { return impSend<O, T, ARGS...>(prio, o, f, nullptr, delay, vars...);}
 
     
     template<typename C, typename T, typename Call, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_delayed_repetable_with_callback(int prio, Rational delay, C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_function<T(ARGS...)>(f), callback, delay, vars...);}
+    Response<T>     send_delayed_repetable_with_callback(int prio, Rational delay, C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(prio, srv_unique_function<T(ARGS...)>(std::move(f)), std::move(callback), delay, vars...);}
 
     template<typename C, typename Call, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void()>::template check_callable<Call>>
-    Response<void>  send_delayed_repetable_with_callback(int prio, Rational delay, C f, Call callback, ARGS... vars) { return impSend<ARGS...>(prio, srv_function<void(ARGS...)>(f), callback, delay, vars...);}
+    Response<void>  send_delayed_repetable_with_callback(int prio, Rational delay, C f, Call callback, ARGS... vars) { return impSend<ARGS...>(prio, srv_unique_function<void(ARGS...)>(std::move(f)), std::move(callback), delay, vars...);}
 
     template<typename O, typename T, typename Call, typename... ARGS, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_delayed_repetable_with_callback(int prio, Rational delay, O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(prio, o, f, callback, delay, vars...);}
+    Response<T>     send_delayed_repetable_with_callback(int prio, Rational delay, O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(prio, o, f, std::move(callback), delay, vars...);}
 
 
 
     template<typename C, typename T, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>>
-    Response<T>     operator()(C f, ARGS... vars) { return impSend<T, ARGS...>(0, srv_function<T(ARGS...)>(f), nullptr, {0, 0}, vars...);}
+    Response<T>     operator()(C f, ARGS... vars) { return impSend<T, ARGS...>(0, srv_unique_function<T(ARGS...)>(std::move(f)), nullptr, {0, 0}, vars...);}
 
     template<typename C, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>>
-    Response<void>  operator()(C f, ARGS... vars) { return impSend<ARGS...>(0, srv_function<void(ARGS...)>(f), nullptr, {0, 0}, vars...);}
+    Response<void>  operator()(C f, ARGS... vars) { return impSend<ARGS...>(0, srv_unique_function<void(ARGS...)>(std::move(f)), nullptr, {0, 0}, vars...);}
 
     template<typename O, typename T, typename... ARGS>
     Response<T>     operator()(O* o, T (O::*f)(ARGS...), ARGS... vars) { return impSend<O, T, ARGS...>(0, o, f, nullptr, {0, 0}, vars...);}
 
 
     template<typename C, typename T, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>>
-    Response<T>     send(C f, ARGS... vars) { return impSend<T, ARGS...>(0, srv_function<T(ARGS...)>(f), nullptr, {0, 0}, vars...);}
+    Response<T>     send(C f, ARGS... vars) { return impSend<T, ARGS...>(0, srv_unique_function<T(ARGS...)>(std::move(f)), nullptr, {0, 0}, vars...);}
 
     template<typename C, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>>
-    Response<void>  send(C f, ARGS... vars) { return impSend<ARGS...>(0, srv_function<void(ARGS...)>(f), nullptr, {0, 0}, vars...);}
+    Response<void>  send(C f, ARGS... vars) { return impSend<ARGS...>(0, srv_unique_function<void(ARGS...)>(std::move(f)), nullptr, {0, 0}, vars...);}
 
     template<typename O, typename T, typename... ARGS>
     Response<T>     send(O* o, T (O::*f)(ARGS...), ARGS... vars) { return impSend<O, T, ARGS...>(0, o, f, nullptr, {0, 0}, vars...);}
 
     
     template<typename C, typename T, typename Call, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_with_callback(C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(0, srv_function<T(ARGS...)>(f), callback, {0, 0}, vars...);}
+    Response<T>     send_with_callback(C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(0, srv_unique_function<T(ARGS...)>(std::move(f)), std::move(callback), {0, 0}, vars...);}
 
     template<typename C, typename Call, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void()>::template check_callable<Call>>
-    Response<void>  send_with_callback(C f, Call callback, ARGS... vars) { return impSend<ARGS...>(0, srv_function<void(ARGS...)>(f), callback, {0, 0}, vars...);}
+    Response<void>  send_with_callback(C f, Call callback, ARGS... vars) { return impSend<ARGS...>(0, srv_unique_function<void(ARGS...)>(std::move(f)), std::move(callback), {0, 0}, vars...);}
 
     template<typename O, typename T, typename Call, typename... ARGS, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_with_callback(O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(0, o, f, callback, {0, 0}, vars...);}
+    Response<T>     send_with_callback(O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(0, o, f, std::move(callback), {0, 0}, vars...);}
     
 
     template<typename C, typename T, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>>
-    Response<T>     send_repetable(C f, ARGS... vars) { return impSend<T, ARGS...>(0, srv_function<T(ARGS...)>(f), nullptr, {0, 1}, vars...);}
+    Response<T>     send_repetable(C f, ARGS... vars) { return impSend<T, ARGS...>(0, srv_unique_function<T(ARGS...)>(std::move(f)), nullptr, {0, 1}, vars...);}
     
     template<typename C, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>>
-    Response<void>  send_repetable(C f, ARGS... vars) { return impSend<ARGS...>(0, srv_function<void(ARGS...)>(f), nullptr, {0, 1}, vars...);}
+    Response<void>  send_repetable(C f, ARGS... vars) { return impSend<ARGS...>(0, srv_unique_function<void(ARGS...)>(std::move(f)), nullptr, {0, 1}, vars...);}
 
     template<typename O, typename T, typename... ARGS>
     Response<T>     send_repetable(O* o, T (O::*f)(ARGS...), ARGS... vars) { return impSend<O, T, ARGS...>(0, o, f, nullptr, {0, 1}, vars...);}
 
 
     template<typename C, typename T, typename Call, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_repetable_with_callback(C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(0, srv_function<T(ARGS...)>(f), callback, {0, 1}, vars...);}
+    Response<T>     send_repetable_with_callback(C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(0, srv_unique_function<T(ARGS...)>(std::move(f)), std::move(callback), {0, 1}, vars...);}
 
     template<typename C, typename Call, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void()>::template check_callable<Call>>
-    Response<void>  send_repetable_with_callback(C f, Call callback, ARGS... vars) { return impSend<ARGS...>(0, srv_function<void(ARGS...)>(f), callback, {0, 1}, vars...);}
+    Response<void>  send_repetable_with_callback(C f, Call callback, ARGS... vars) { return impSend<ARGS...>(0, srv_unique_function<void(ARGS...)>(std::move(f)), std::move(callback), {0, 1}, vars...);}
 
     template<typename O, typename T, typename Call, typename... ARGS, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_repetable_with_callback(O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(0, o, f, callback, {0, 1}, vars...);}
+    Response<T>     send_repetable_with_callback(O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(0, o, f, std::move(callback), {0, 1}, vars...);}
     
 
     template<typename C, typename T, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>>
-    Response<T>     send_delayed_repetable(unsigned int delay_ms, C f, ARGS... vars) { return impSend<T, ARGS...>(0, srv_function<T(ARGS...)>(f), nullptr, {delay_ms, 1000}, vars...);}
+    Response<T>     send_delayed_repetable(unsigned int delay_ms, C f, ARGS... vars) { return impSend<T, ARGS...>(0, srv_unique_function<T(ARGS...)>(std::move(f)), nullptr, {delay_ms, 1000}, vars...);}
     
     template<typename C, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>>
-    Response<void>  send_delayed_repetable(unsigned int delay_ms, C f, ARGS... vars) { return impSend<ARGS...>(0, srv_function<void(ARGS...)>(f), nullptr, {delay_ms, 1000}, vars...);}
+    Response<void>  send_delayed_repetable(unsigned int delay_ms, C f, ARGS... vars) { return impSend<ARGS...>(0, srv_unique_function<void(ARGS...)>(std::move(f)), nullptr, {delay_ms, 1000}, vars...);}
 
     template<typename O, typename T, typename... ARGS>
     Response<T>     send_delayed_repetable(unsigned int delay_ms, O* o, T (O::*f)(ARGS...), ARGS... vars) { return impSend<O, T, ARGS...>(0, o, f, nullptr, {delay_ms, 1000}, vars...);}
 
     
     template<typename C, typename T, typename Call, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_delayed_repetable_with_callback(unsigned int delay_ms, C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(0, srv_function<T(ARGS...)>(f), callback, {delay_ms, 1000}, vars...);}
+    Response<T>     send_delayed_repetable_with_callback(unsigned int delay_ms, C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(0, srv_unique_function<T(ARGS...)>(std::move(f)), std::move(callback), {delay_ms, 1000}, vars...);}
 
     template<typename C, typename Call, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void()>::template check_callable<Call>>
-    Response<void>  send_delayed_repetable_with_callback(unsigned int delay_ms, C f, Call callback, ARGS... vars) { return impSend<ARGS...>(0, srv_function<void(ARGS...)>(f), callback, {delay_ms, 1000}, vars...);}
+    Response<void>  send_delayed_repetable_with_callback(unsigned int delay_ms, C f, Call callback, ARGS... vars) { return impSend<ARGS...>(0, srv_unique_function<void(ARGS...)>(std::move(f)), std::move(callback), {delay_ms, 1000}, vars...);}
 
     template<typename O, typename T, typename Call, typename... ARGS, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_delayed_repetable_with_callback(unsigned int delay_ms, O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(0, o, f, callback, {delay_ms, 1000}, vars...);}
+    Response<T>     send_delayed_repetable_with_callback(unsigned int delay_ms, O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(0, o, f, std::move(callback), {delay_ms, 1000}, vars...);}
     
 
     template<typename C, typename T, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>>
-    Response<T>     send_delayed_repetable(Rational delay, C f, ARGS... vars) { return impSend<T, ARGS...>(0, srv_function<T(ARGS...)>(f), nullptr, delay vars...);}
+    Response<T>     send_delayed_repetable(Rational delay, C f, ARGS... vars) { return impSend<T, ARGS...>(0, srv_unique_function<T(ARGS...)>(std::move(f)), nullptr, delay, vars...);}
     
     template<typename C, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>>
-    Response<void>  send_delayed_repetable(Rational delay, C f, ARGS... vars) { return impSend<ARGS...>(0, srv_function<void(ARGS...)>(f), nullptr, delay, vars...);}
+    Response<void>  send_delayed_repetable(Rational delay, C f, ARGS... vars) { return impSend<ARGS...>(0, srv_unique_function<void(ARGS...)>(std::move(f)), nullptr, delay, vars...);}
 
     template<typename O, typename T, typename... ARGS>
     Response<T>     send_delayed_repetable(Rational delay, O* o, T (O::*f)(ARGS...), ARGS... vars) { return impSend<O, T, ARGS...>(0, o, f, nullptr, delay, vars...);}
 
     
     template<typename C, typename T, typename Call, typename... ARGS, typename Check = srv_function<T(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_delayed_repetable_with_callback(Rational delay, C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(0, srv_function<T(ARGS...)>(f), callback, delay, vars...);}
+    Response<T>     send_delayed_repetable_with_callback(Rational delay, C f, Call callback, ARGS... vars) { return impSend<T, ARGS...>(0, srv_unique_function<T(ARGS...)>(std::move(f)), std::move(callback), delay, vars...);}
 
     template<typename C, typename Call, typename... ARGS, typename Check = srv_function<void(ARGS...)>::template check_callable<C>, typename Check2 = srv_function<void()>::template check_callable<Call>>
-    Response<void>  send_delayed_repetable_with_callback(Rational delay, C f, Call callback, ARGS... vars) { return impSend<ARGS...>(0, srv_function<void(ARGS...)>(f), callback, delay, vars...);}
+    Response<void>  send_delayed_repetable_with_callback(Rational delay, C f, Call callback, ARGS... vars) { return impSend<ARGS...>(0, srv_unique_function<void(ARGS...)>(std::move(f)), std::move(callback), delay, vars...);}
 
     template<typename O, typename T, typename Call, typename... ARGS, typename Check2 = srv_function<void(T&)>::template check_callable<Call>>
-    Response<T>     send_delayed_repetable_with_callback(Rational delay, O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(0, o, f, callback, delay, vars...);}
+    Response<T>     send_delayed_repetable_with_callback(Rational delay, O* o, T (O::*f)(ARGS...), Call callback, ARGS... vars) { return impSend<O, T, ARGS...>(0, o, f, std::move(callback), delay, vars...);}
 
     //------------------------------------------------------------------------------------------------------------------------------------------------
     // send functions
     //------------------------------------------------------------------------------------------------------------------------------------------------
 
-    ~ThredaPool()
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+    // batch functions
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+
+    // calls fn(i) for every i in [begin, end), chunks are never smaller than grain (0 picks one)
+    template<typename F>
+    Response<void>  parallel_for(int prio, size_t begin, size_t end, size_t grain, F fn)
     {
-        run.store(false);
-        for(int i = 0; i < THCOUNT; i++)
+        if(grain == 0)
+            grain = AutoGrain(end > begin ? end - begin : 0);
+        return impParallelFor(prio, begin, end, grain, std::move(fn));
+    }
+
+    template<typename F>
+    Response<void>  parallel_for(size_t begin, size_t end, size_t grain, F fn) { return parallel_for(0, begin, end, grain, std::move(fn)); }
+
+    // calls fn(item) for every item of a random access range
+    template<typename Range, typename F>
+    Response<void>  send_batch(int prio, Range& range, F fn, size_t grain = 0)
+    {
+        auto first = std::begin(range);
+        static_assert(std::is_base_of_v<std::random_access_iterator_tag, typename std::iterator_traits<decltype(first)>::iterator_category>, "send_batch needs a random access range");
+        const size_t count = size_t(std::end(range) - first);
+        return parallel_for(prio, 0, count, grain, [first, fn](size_t i) mutable { fn(*(first + i)); });
+    }
+
+    template<typename Range, typename F>
+    Response<void>  send_batch(Range& range, F fn, size_t grain = 0) { return send_batch(0, range, std::move(fn), grain); }
+
+private:
+    // about 8 chunks per worker
+    size_t AutoGrain(size_t count) const
+    {
+        const size_t chunks = size_t(THCOUNT ? THCOUNT : 1) * 8;
+        return count / chunks ? count / chunks : 1;
+    }
+
+public:
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+    // batch functions
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+    // coroutine functions
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+
+    // A coroutine that returns Response<T> runs on the calling thread until it awaits:
+    //   Response<int> Load(ThredaPool& pool)
+    //   {
+    //       co_await pool.schedule();                       // continue as a message of the pool
+    //       int size = co_await pool.send<...>(ReadSize);   // suspended until the message completed
+    //       co_await pool.sleep_for(std::chrono::milliseconds(5));
+    //       co_return size;
+    //   }
+    // A suspended coroutine holds no worker. drain() timeouts and pool shutdown destroy the coroutines still queued.
+    struct ScheduleAwaiter
+    {
+        ThredaPool* pool;
+        int         prio;
+        int64_t     delay_ns;
+
+        bool await_ready() const { return false; }
+
+        template<typename P>
+        void await_suspend(std::coroutine_handle<P> h)
         {
-            try
+            // waiting on its response helps this pool from now on
+            if constexpr (std::is_base_of_v<PromiseCore, P>)
             {
-                if(pool[i].joinable())
-                    pool[i].join();
+                if(!h.promise().data->pool)
+                {
+                    h.promise().data->pool = pool;
+                    h.promise().data->prio = prio;
+                }
             }
-            catch(const std::exception& e){}
+            if(delay_ns > 0)
+                pool->EnqueueDelayed(prio, new ResumeMessage(h), delay_ns);
+            else
+                pool->Enqueue(prio, new ResumeMessage(h));
+        }
+
+        void await_resume() const {}
+    };
+
+    ScheduleAwaiter schedule(int prio = 0) { return { this, prio, 0 }; }
+
+    template<typename Rep, typename Per>
+    ScheduleAwaiter sleep_for(std::chrono::duration<Rep, Per> d, int prio = 0)
+    {
+        return { this, prio, int64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()) };
+    }
+
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+    // coroutine functions
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+    // shutdown functions
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+
+    // Waits until every one-shot message sent so far, and everything they send in turn, has finished.
+    // Repeating messages keep running. Must not be called from a message of this pool.
+    void quiesce()
+    {
+        WaitIdle(std::chrono::nanoseconds(0));
+    }
+
+    // Stops repeating and delayed messages, then lets the queued one-shot work finish.
+    // What is still queued after the timeout is cancelled: its Response completes with cancelled() set.
+    // Returns true when everything finished in time, timeout 0 waits without limit.
+    bool drain(std::chrono::nanoseconds timeout = std::chrono::nanoseconds(0))
+    {
+        draining.store(true);
+        CancelQueuedTimers(false);
+        bool ret = WaitIdle(timeout);
+        // messages that are running right now may still send more
+        while(!ret && pending.load() > 0)
+        {
+            CancelQueued();
+            WaitIdle(std::chrono::milliseconds(1));
+        }
+        draining.store(false);
+        return ret;
+    }
+
+    // one-shot messages sent and not finished
+    int64_t pending_count() const { return pending.load(); }
+
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+    // shutdown functions
+    //------------------------------------------------------------------------------------------------------------------------------------------------
+
+    // Workers finish the message they are running and exit, queued messages are cancelled.
+    ~ThredaPool()
+    {
+        run.store(false);
+        parker.NotifyAll();
+        for(auto& t : pool)
+        {
+            if(t.joinable() && t.get_id() != std::this_thread::get_id())
+                t.join();
+            else if(t.joinable())
+                t.detach();
         }
+        while(CancelQueued())
+            ;
+        WorkerBudget::Global().Release(budget_taken);
     }
 
 };
+
+inline void ThredaPool::RangeJob::Run(size_t begin, size_t end)
+{
+    while(begin < end)
+    {
+        // hand the upper half to an idle worker
+        while(end - begin > grain && pool && pool->ShouldSplit(prio))
+        {
+            const size_t mid = begin + (end - begin) / 2;
+            pool->Enqueue(prio, new RangeMessage(this, mid, end));
+            end = mid;
+        }
+
+        const size_t n = (end - begin < grain) ? end - begin : grain;
+        Body(begin, begin + n);
+        begin += n;
+        if(remaining.fetch_sub(n, std::memory_order_acq_rel) == n)
+            completed();
+    }
+}
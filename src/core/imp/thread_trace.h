@@ -0,0 +1,289 @@
+#pragma once
+
+
+#ifndef THREAD_TRACE_H
+#define THREAD_TRACE_H
+
+// Event tracing for the thread pools. Build with THREAD_TRACE_ENABLED=1 to compile the hooks in,
+// otherwise every THREAD_TRACE* macro expands to nothing and this header pulls in nothing.
+//   ThreadTrace::Enable(); ... run the pools ... ThreadTrace::Disable();
+//   ThreadTrace::WriteChromeTrace("trace.json"); // chrome://tracing or ui.perfetto.dev
+#ifndef THREAD_TRACE_ENABLED
+#define THREAD_TRACE_ENABLED 0
+#endif
+
+#if THREAD_TRACE_ENABLED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "nlohmannjson.hpp"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+#ifndef THREAD_TRACE_RING
+#define THREAD_TRACE_RING (1 << 15) // events kept per thread, the oldest are overwritten
+#endif
+
+class ThreadTrace
+{
+public:
+    enum Type : uint8_t
+    {
+        Enqueue, // id queued, arg = messages in flight
+        Start,   // id starts running, tag = srv_function::tid()
+        End,     // id finished
+        Steal,   // id taken from another worker, arg = victim
+        Spin,    // worker ran out of work and spins
+        Park,    // worker goes to sleep
+        Wake,    // worker woke up
+    };
+
+    struct Entry
+    {
+        uint64_t    ts;   // raw clock, see Ticks()
+        uint64_t    id;   // message or task address, ties Enqueue to Start
+        uint64_t    tag;
+        const char* name; // static or owned by the traced object
+        uint32_t    arg;
+        Type        type;
+    };
+
+    // writing a record is a thread local store, no locks and no shared cache lines
+    static void Record(Type type, uint64_t id, uint64_t tag = 0, uint32_t arg = 0, const char* name = nullptr)
+    {
+        if(!enabled.load(std::memory_order_relaxed))
+            return;
+        Ring* ring = tl_ring;
+        if(!ring)
+            ring = NewRing();
+        const uint64_t head = ring->head.load(std::memory_order_relaxed);
+        Entry& r = ring->records[head & (THREAD_TRACE_RING - 1)];
+        r.ts   = Ticks();
+        r.id   = id;
+        r.tag  = tag;
+        r.name = name;
+        r.arg  = arg;
+        r.type = type;
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+
+    static void SetThreadName(const std::string& name)
+    {
+        Ring* ring = tl_ring ? tl_ring : NewRing();
+        std::lock_guard<std::mutex> lock(Registry().mutex);
+        ring->name = name;
+    }
+
+    static void Enable()
+    {
+        Calibrate(start_ticks, start_ns);
+        enabled.store(true);
+    }
+
+    static void Disable() { enabled.store(false); }
+
+    // drops the recorded events, call while nothing is traced
+    static void Clear()
+    {
+        std::lock_guard<std::mutex> lock(Registry().mutex);
+        for(auto ring : Registry().rings)
+            ring->head.store(0);
+    }
+
+    // Chrome trace event format. Start/End become slices with the time the message waited in its queue,
+    // Spin/Park/Wake become idle slices, Enqueue and Steal instant events.
+    // Call after Disable(), rings are read without stopping the writers.
+    static nlohmann::json ChromeTrace()
+    {
+        uint64_t end_ticks;
+        int64_t  end_ns;
+        Calibrate(end_ticks, end_ns);
+        const double ns_per_tick = end_ticks > start_ticks ? double(end_ns - start_ns) / double(end_ticks - start_ticks) : 1.0;
+        auto us = [&](uint64_t ts) { return double(int64_t(ts - start_ticks)) * ns_per_tick / 1000.0; };
+
+        struct Event
+        {
+            Entry    r;
+            uint32_t thread;
+        };
+        std::vector<Event> events;
+        auto ret = nlohmann::json::object();
+        auto& out = ret["traceEvents"] = nlohmann::json::array();
+        {
+            std::lock_guard<std::mutex> lock(Registry().mutex);
+            for(uint32_t t = 0; t < Registry().rings.size(); ++t)
+            {
+                Ring* ring = Registry().rings[t];
+                const uint64_t head  = ring->head.load(std::memory_order_acquire);
+                const uint64_t first = head > THREAD_TRACE_RING ? head - THREAD_TRACE_RING : 0;
+                for(uint64_t i = first; i < head; ++i)
+                    events.push_back({ ring->records[i & (THREAD_TRACE_RING - 1)], t });
+                out.push_back({ {"ph", "M"}, {"name", "thread_name"}, {"pid", 0}, {"tid", t},
+                                {"args", { {"name", ring->name.empty() ? "thread " + std::to_string(t) : ring->name} }} });
+            }
+        }
+        std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.r.ts < b.r.ts; });
+
+        std::unordered_map<uint64_t, uint64_t> queued;   // id -> enqueue ts
+        std::unordered_map<uint32_t, Event>    open;     // thread -> running Start
+        std::unordered_map<uint32_t, Event>    idle;     // thread -> Spin or Park
+        char buf[64];
+        auto label = [&](const Entry& r) -> std::string
+        {
+            if(r.name)
+                return r.name;
+            snprintf(buf, sizeof(buf), "fn %016llx", (unsigned long long)r.tag);
+            return buf;
+        };
+        auto close_idle = [&](const Event& e)
+        {
+            auto it = idle.find(e.thread);
+            if(it == idle.end())
+                return;
+            const Event& s = it->second;
+            out.push_back({ {"ph", "X"}, {"name", s.r.type == Spin ? "spin" : "park"}, {"cat", "idle"}, {"pid", 0}, {"tid", e.thread},
+                            {"ts", us(s.r.ts)}, {"dur", us(e.r.ts) - us(s.r.ts)} });
+            idle.erase(it);
+        };
+
+        for(const Event& e : events)
+        {
+            switch(e.r.type)
+            {
+            case Enqueue:
+                queued[e.r.id] = e.r.ts;
+                out.push_back({ {"ph", "i"}, {"s", "t"}, {"name", "enqueue"}, {"pid", 0}, {"tid", e.thread}, {"ts", us(e.r.ts)},
+                                {"args", { {"in_flight", e.r.arg} }} });
+                break;
+            case Steal:
+                out.push_back({ {"ph", "i"}, {"s", "t"}, {"name", "steal"}, {"pid", 0}, {"tid", e.thread}, {"ts", us(e.r.ts)},
+                                {"args", { {"victim", e.r.arg} }} });
+                break;
+            case Start:
+                close_idle(e);
+                open[e.thread] = e;
+                break;
+            case End:
+            {
+                auto it = open.find(e.thread);
+                if(it == open.end())
+                    break;
+                const Event& s = it->second;
+                auto slice = nlohmann::json{ {"ph", "X"}, {"name", label(s.r)}, {"cat", "run"}, {"pid", 0}, {"tid", e.thread},
+                                             {"ts", us(s.r.ts)}, {"dur", us(e.r.ts) - us(s.r.ts)} };
+                auto q = queued.find(s.r.id);
+                if(q != queued.end() && q->second <= s.r.ts)
+                {
+                    slice["args"]["queued_us"] = us(s.r.ts) - us(q->second);
+                    queued.erase(q);
+                }
+                out.push_back(std::move(slice));
+                open.erase(it);
+                break;
+            }
+            case Spin:
+                idle[e.thread] = e;
+                break;
+            case Park:
+                close_idle(e);
+                idle[e.thread] = e;
+                break;
+            case Wake:
+                close_idle(e);
+                break;
+            }
+        }
+        ret["displayTimeUnit"] = "ns";
+        return ret;
+    }
+
+    static bool WriteChromeTrace(const std::string& path)
+    {
+        FILE* f = fopen(path.c_str(), "wb");
+        if(!f)
+            return false;
+        const std::string text = ChromeTrace().dump();
+        const bool ret = fwrite(text.data(), 1, text.size(), f) == text.size();
+        fclose(f);
+        return ret;
+    }
+
+private:
+    struct Ring
+    {
+        std::atomic<uint64_t> head{0};
+        std::string           name;
+        Entry                 records[THREAD_TRACE_RING];
+    };
+
+    struct RingRegistry
+    {
+        std::mutex         mutex;
+        std::vector<Ring*> rings;
+    };
+
+    // rings outlive their threads, the trace is exported after the workers are gone
+    static RingRegistry& Registry()
+    {
+        static RingRegistry* registry = new RingRegistry();
+        return *registry;
+    }
+
+    static Ring* NewRing()
+    {
+        Ring* ring = new Ring();
+        std::lock_guard<std::mutex> lock(Registry().mutex);
+        Registry().rings.push_back(ring);
+        tl_ring = ring;
+        return ring;
+    }
+
+    static uint64_t Ticks()
+    {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+        return __builtin_ia32_rdtsc();
+#else
+        return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    static int64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static void Calibrate(uint64_t& ticks, int64_t& ns)
+    {
+        ticks = Ticks();
+        ns    = NowNs();
+    }
+
+    static inline thread_local Ring* tl_ring = nullptr;
+    static inline std::atomic<bool> enabled{false};
+    static inline uint64_t start_ticks = 0;
+    static inline int64_t  start_ns    = 0;
+};
+
+#define THREAD_TRACE(type, ...) ThreadTrace::Record(ThreadTrace::type, __VA_ARGS__)
+#define THREAD_TRACE_THREAD_NAME(name) ThreadTrace::SetThreadName(name)
+
+#else
+
+#define THREAD_TRACE(...) ((void)0)
+#define THREAD_TRACE_THREAD_NAME(...) ((void)0)
+
+#endif // THREAD_TRACE_ENABLED
+
+
+#endif // THREAD_TRACE_H
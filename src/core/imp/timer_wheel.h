@@ -0,0 +1,159 @@
+#pragma once
+
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Hierarchical timing wheel (Varghese & Lauck).
+// Time is measured in abstract ticks. Level 0 has one slot per tick, every next level
+// covers SLOTS times more ticks, entries cascade down when the lower level wraps.
+// Schedule and Advance are O(1) amortized, not thread safe.
+template<typename T, unsigned BITS = 6, unsigned LEVELS = 4>
+class TimerWheel
+{
+    static constexpr uint64_t SLOTS = uint64_t(1) << BITS;
+    static constexpr uint64_t MASK  = SLOTS - 1;
+
+    struct Entry
+    {
+        T        val;
+        uint64_t due;
+    };
+
+    std::vector<Entry> slots[LEVELS][SLOTS];
+    std::vector<Entry> overflow;
+
+    uint64_t current = 0;
+    size_t   count   = 0;
+
+    // floor is current + 1 for new entries, cascaded entries may still land in the slot being fired
+    void Insert(const Entry& e, uint64_t floor)
+    {
+        const uint64_t due   = (e.due > floor) ? e.due : floor;
+        const uint64_t delta = due - current;
+        for (unsigned level = 0; level < LEVELS; ++level)
+        {
+            if (delta < (uint64_t(1) << (BITS * (level + 1))))
+            {
+                slots[level][(due >> (BITS * level)) & MASK].push_back({e.val, due});
+                return;
+            }
+        }
+        overflow.push_back({e.val, due});
+    }
+
+    void Cascade(unsigned level, uint64_t tick)
+    {
+        if (level >= LEVELS)
+        {
+            std::vector<Entry> moved;
+            moved.swap(overflow);
+            for (auto& e : moved)
+                Insert(e, current);
+            return;
+        }
+        const uint64_t idx = (tick >> (BITS * level)) & MASK;
+        if (idx == 0)
+            Cascade(level + 1, tick);
+
+        std::vector<Entry> moved;
+        moved.swap(slots[level][idx]);
+        for (auto& e : moved)
+            Insert(e, current);
+    }
+
+public:
+    TimerWheel(uint64_t start = 0) : current(start) {}
+
+    void Schedule(T val, uint64_t due)
+    {
+        Insert({val, due}, current + 1);
+        ++count;
+    }
+
+    // fires every entry with due <= now, returns count of fired entries
+    template<typename F>
+    size_t Advance(uint64_t now, F on_expired)
+    {
+        size_t fired = 0;
+        if (count == 0)
+        {
+            if (now > current)
+                current = now;
+            return 0;
+        }
+        while (current < now && count)
+        {
+            ++current;
+            if ((current & MASK) == 0)
+                Cascade(1, current);
+
+            auto& slot = slots[0][current & MASK];
+            if (slot.empty())
+                continue;
+            std::vector<Entry> expired;
+            expired.swap(slot);
+            count -= expired.size();
+            fired += expired.size();
+            for (auto& e : expired)
+                on_expired(e.val);
+        }
+        if (count == 0 && now > current)
+            current = now;
+        return fired;
+    }
+
+    // earliest due tick, UINT64_MAX if empty
+    uint64_t NextDue() const
+    {
+        if (count == 0)
+            return UINT64_MAX;
+        uint64_t ret = UINT64_MAX;
+        for (unsigned level = 0; level < LEVELS; ++level)
+        {
+            const unsigned shift = BITS * level;
+            for (uint64_t i = (level == 0) ? 1 : 0; i <= SLOTS; ++i)
+            {
+                // the i-th slot after the current one on this level
+                const uint64_t first = (((current >> shift) + i) << shift);
+                if (first >= ret)
+                    break;
+                // slots are visited in time order, a slot may also hold entries of the next wheel turn
+                for (const auto& e : slots[level][((current >> shift) + i) & MASK])
+                    if (e.due < ret)
+                        ret = e.due;
+            }
+        }
+        for (const auto& e : overflow)
+            if (e.due < ret)
+                ret = e.due;
+        return ret;
+    }
+
+    // removes every entry without firing it, f is called for each
+    template<typename F>
+    void Clear(F f)
+    {
+        for (auto& level : slots)
+            for (auto& slot : level)
+            {
+                for (auto& e : slot)
+                    f(e.val);
+                slot.clear();
+            }
+        for (auto& e : overflow)
+            f(e.val);
+        overflow.clear();
+        count = 0;
+    }
+
+    uint64_t Current() const { return current; }
+    size_t   Size() const { return count; }
+    bool     Empty() const { return count == 0; }
+};
+
+
+#endif // TIMER_WHEEL_H
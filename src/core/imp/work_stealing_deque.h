@@ -0,0 +1,136 @@
+#pragma once
+
+
+#ifndef WORK_STEALING_DEQUE_H
+#define WORK_STEALING_DEQUE_H
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+
+// Chase-Lev work stealing deque
+// (Le, Pop, Cohen, Zappa Nardelli - "Correct and Efficient Work-Stealing for Weak Memory Models").
+// Push/Pop only from the owner thread (LIFO end), Steal from any thread (FIFO end).
+template<typename T>
+class WorkStealingDeque
+{
+    static_assert(std::is_trivially_copyable_v<T>, "WorkStealingDeque stores trivially copyable values only");
+
+    struct Array
+    {
+        Array(int64_t capacity) : capacity(capacity), mask(capacity - 1), items(new std::atomic<T>[capacity]) {}
+        ~Array() { delete[] items; }
+
+        int64_t         capacity;
+        int64_t         mask;
+        std::atomic<T>* items;
+
+        T Get(int64_t i) const { return items[i & mask].load(std::memory_order_relaxed); }
+        void Put(int64_t i, T val) { items[i & mask].store(val, std::memory_order_relaxed); }
+
+        Array* Grow(int64_t bottom, int64_t top) const
+        {
+            Array* ret = new Array(capacity * 2);
+            for (int64_t i = top; i < bottom; ++i)
+                ret->Put(i, Get(i));
+            return ret;
+        }
+    };
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    alignas(64) std::atomic<Array*> array;
+
+    // stealers may still read from an old array after grow, so the old ones live until the deque dies
+    std::vector<Array*> retired;
+
+public:
+    WorkStealingDeque(int64_t capacity = 1024)
+    {
+        int64_t c = 1;
+        while (c < capacity) c <<= 1;
+        array.store(new Array(c), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&)            = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    ~WorkStealingDeque()
+    {
+        for (auto a : retired)
+            delete a;
+        delete array.load(std::memory_order_relaxed);
+    }
+
+    // owner only
+    void Push(T val)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array*  a = array.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1)
+        {
+            retired.push_back(a);
+            a = a->Grow(b, t);
+            array.store(a, std::memory_order_release);
+        }
+        a->Put(b, val);
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    // owner only
+    bool Pop(T& ret)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array*  a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        ret = a->Get(b);
+        if (t == b)
+        {
+            // last element, race with stealers
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // any thread
+    bool Steal(T& ret)
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+            return false;
+
+        Array* a = array.load(std::memory_order_acquire);
+        T      v = a->Get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return false;
+        ret = v;
+        return true;
+    }
+
+    size_t Size() const
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_relaxed);
+        return b > t ? size_t(b - t) : 0;
+    }
+
+    bool Empty() const { return Size() == 0; }
+};
+
+
+#endif // WORK_STEALING_DEQUE_H
@@ -22,6 +22,7 @@ struct Mesh
     Ref<IRHIMesh> rhimesh  = nullptr;
 };
 DECLARE_DATA_TYPE(Mesh);
+DECLARE_DATA_SER_BULK(Mesh::Vertex);
 
 struct Skeleton
 {
@@ -62,3 +63,4 @@ struct SkeletalMesh
 };
 
 DECLARE_DATA_TYPE(SkeletalMesh);
+DECLARE_DATA_SER_BULK(SkeletalMesh::Vertex);
@@ -13,7 +13,7 @@ class RenderSystem : public ISystem
 {
     DECLARE_SYSTEM(RenderSystem);
     RenderSystem() :
-        thread(0, true)
+        thread(ThredaPool::Config{ .threads = 0, .name = "Render" })
     {
         rhi = GetIRHIHelper();
         wh = GetIWindowsHelper();
@@ -45,6 +45,7 @@ public:
         }
     }
 
+    // one rendered frame, the frame temporaries of this thread are freed at the end
     int Process()
     {
         if(wh && rhi && bridge)
@@ -53,6 +54,7 @@ public:
             thread.Process();
             auto ret = bridge->Render(currnt_world, currnt_ui);
             bridge->Finish();
+            FrameArena::Local().Reset();
             if(ret != 0)
                 return ret;
         }